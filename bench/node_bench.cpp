@@ -0,0 +1,96 @@
+// Microbenchmark for the BVH node test
+// Compares the original per-axis slab test against the precomputed TraversalRay version,
+// and the wide SIMD child test when BVH_WIDTH > 2
+#include "../src/bvh.hpp"
+#include "../src/util/rand.hpp"
+
+#include <chrono>
+#include <cstdio>
+
+static constexpr int NUM_BOXES   = 1 << 14;
+static constexpr int NUM_RAYS    = 1 << 10;
+static constexpr float BOX_RANGE = 10.0f;
+
+template<typename F>
+static void run(const char *name, F &&test) {
+    // Warm up caches before timing
+    test();
+
+    const auto start = std::chrono::steady_clock::now();
+    const int hits   = test();
+    const auto end   = std::chrono::steady_clock::now();
+
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    const double tests   = static_cast<double>(NUM_BOXES) * NUM_RAYS;
+    std::printf("%-24s %8.1f Mtests/s  (%d hits)\n", name, tests / seconds * 1e-6, hits);
+}
+
+int main() {
+    RNG rng(1);
+
+    std::vector<AABB> boxes(NUM_BOXES);
+    for (auto &box: boxes) {
+        const Vec3 c = rng.sample<Vec3>(Vec3(-BOX_RANGE), Vec3(BOX_RANGE));
+        const Vec3 e = rng.sample<Vec3>(Vec3(0.1f), Vec3(1.0f));
+        box          = AABB(c - e, c + e);
+    }
+
+    std::vector<Ray> rays(NUM_RAYS);
+    for (auto &ray: rays) {
+        ray = Ray(rng.sample<Vec3>(Vec3(-BOX_RANGE), Vec3(BOX_RANGE)), rng.sampleUnitVector());
+    }
+
+    const Interval t(0, INF);
+
+    run("AABB::hit(o, d)", [&] {
+        int hits = 0;
+        for (const auto &r: rays) {
+            for (const auto &box: boxes) {
+                hits += box.hit(r.origin, r.dir, t);
+            }
+        }
+        return hits;
+    });
+
+    run("AABB::hit(TraversalRay)", [&] {
+        int hits = 0;
+        for (const auto &r: rays) {
+            const TraversalRay ray(r);
+            for (const auto &box: boxes) {
+                hits += box.hit(ray, t);
+            }
+        }
+        return hits;
+    });
+
+#if BVH_WIDTH > 2
+    // Pack the same boxes into wide nodes
+    std::vector<WBVHNode> nodes(NUM_BOXES / BVH_WIDTH);
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        nodes[n].numChildren = BVH_WIDTH;
+        for (int i = 0; i < BVH_WIDTH; ++i) {
+            const AABB &box       = boxes[n * BVH_WIDTH + i];
+            nodes[n].bounds[0][i] = box.pmin.x;
+            nodes[n].bounds[1][i] = box.pmin.y;
+            nodes[n].bounds[2][i] = box.pmin.z;
+            nodes[n].bounds[3][i] = box.pmax.x;
+            nodes[n].bounds[4][i] = box.pmax.y;
+            nodes[n].bounds[5][i] = box.pmax.z;
+        }
+    }
+
+    run("hitChildren<BVH_WIDTH>", [&] {
+        int hits = 0;
+        float tNear[BVH_WIDTH];
+        for (const auto &r: rays) {
+            const TraversalRay ray(r);
+            for (const auto &node: nodes) {
+                hits += std::popcount(static_cast<unsigned>(hitChildren(node, ray, t.min, t.max, tNear)));
+            }
+        }
+        return hits;
+    });
+#endif
+
+    return 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "bxdf.hpp"
+#include "conductor.hpp"
+#include "dielectric.hpp"
+#include "diffuse.hpp"
+
+#include <variant>
+
+/**
+ * BxDF of one intersection together with its shading frame
+ * Built once per hit, so the integrators can sample, evaluate and take the pdf of the same BSDF without
+ * rebuilding the frame, transforming w_o or looking up the material and texture again for every call.
+ * Directions passed in and returned are in world space.
+ */
+class BSDF {
+public:
+    /**
+     * @param w_o outgoing direction (facing away from the surface), shared by every call on this BSDF
+     */
+    BSDF(const Scene &scene, const Intersection &rec, const Vec3 &w_o);
+
+    /**
+     * @return false if the material has no BxDF or w_o lies in the tangent plane
+     */
+    explicit operator bool() const {
+        return !std::holds_alternative<std::monostate>(bxdf_) && w_o_.z != 0;
+    }
+
+    /**
+     * Samples w_i, s.w_i is returned in world space
+     * @return false if no valid direction was sampled
+     */
+    bool sample(const float uc, const Vec2f &u, BSDFSample &s) const {
+        if (!*this) return false;
+        const bool sampled = std::visit([&](const auto &bxdf) { return sampleLocal(bxdf, uc, u, s); }, bxdf_);
+        if (!sampled || !s.fSample || s.pdf == 0 || s.w_i.z == 0) return false;
+        s.w_i = frame_.toWorld(s.w_i);
+        return true;
+    }
+
+    [[nodiscard]] Vec3 f(const Vec3 &w_i) const {
+        const Vec3 w_i_local = frame_.toLocal(w_i);
+        if (!*this || w_i_local.z == 0) return {};
+        return std::visit([&](const auto &bxdf) { return evaluateLocal(bxdf, w_i_local); }, bxdf_);
+    }
+
+    [[nodiscard]] float pdf(const Vec3 &w_i) const {
+        const Vec3 w_i_local = frame_.toLocal(w_i);
+        if (!*this || w_i_local.z == 0) return 0;
+        return std::visit([&](const auto &bxdf) { return pdfLocal(bxdf, w_i_local); }, bxdf_);
+    }
+
+private:
+    jtx::Frame frame_;
+    Vec3 w_o_;
+    std::variant<std::monostate, DiffuseBxDF, ConductorBxDF, DielectricBxDF> bxdf_;
+
+    template<typename BxDF>
+    bool sampleLocal(const BxDF &bxdf, const float uc, const Vec2f &u, BSDFSample &s) const {
+        return bxdf.sample(w_o_, uc, u, s);
+    }
+
+    template<typename BxDF>
+    Vec3 evaluateLocal(const BxDF &bxdf, const Vec3 &w_i) const {
+        return bxdf.evaluate(w_o_, w_i);
+    }
+
+    template<typename BxDF>
+    float pdfLocal(const BxDF &bxdf, const Vec3 &w_i) const {
+        return bxdf.pdf(w_o_, w_i);
+    }
+
+    bool sampleLocal(std::monostate, float, const Vec2f &, BSDFSample &) const { return false; }
+    Vec3 evaluateLocal(std::monostate, const Vec3 &) const { return {}; }
+    float pdfLocal(std::monostate, const Vec3 &) const { return 0; }
+};
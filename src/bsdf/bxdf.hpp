@@ -117,10 +117,4 @@ struct BSDFSample {
     bool isTransmission = false;
 };
 
-struct Intersection;
-struct Material;
 class Scene;
-
-bool sampleBxdf(const Scene &scene, const Intersection &rec, const Vec3 &w_o, const float uc, const Vec2f &u, BSDFSample &s);
-Vec3 evalBxdf(const Material *mat, const Intersection &rec, const Vec3 &w_o, const Vec3 &w_i);
-float pdfBxdf(const Material *mat, const Intersection &rec, const Vec3 &w_o, const Vec3 &w_i);
\ No newline at end of file
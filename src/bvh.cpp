@@ -1,82 +1,153 @@
 #include "bvh.hpp"
+#include "util/threadpool.hpp"
+
+#include <filesystem>
+#include <fstream>
+
+static constexpr int BVH_NUM_BUCKETS = 12;
+static constexpr int BVH_NUM_SPLITS  = BVH_NUM_BUCKETS - 1;
+
+// Relative costs of an interior node visit and a primitive test
+static constexpr float BVH_TRAVERSAL_COST    = 0.5f;
+static constexpr float BVH_INTERSECTION_COST = 1.0f;
+
+// Ranges smaller than this are reduced and built on the calling thread
+static constexpr size_t BVH_PARALLEL_THRESHOLD = 16384;
 
 struct BVHBucket {
     int count = 0;
     AABB bounds;
 };
 
+struct BVHBuckets {
+    BVHBucket buckets[BVH_NUM_BUCKETS];
 
-BVHNode *buildTree(std::span<Primitive> bvhPrimitives, int *totalNodes, int *orderedPrimitiveOffset, std::vector<Primitive> &orderedPrimitives, int maxPrimsInNode) {
-    const auto node = new BVHNode();
-    (*totalNodes)++;
+    void merge(const BVHBuckets &other) {
+        for (int i = 0; i < BVH_NUM_BUCKETS; ++i) {
+            buckets[i].count += other.buckets[i].count;
+            buckets[i].bounds.expand(other.buckets[i].bounds);
+        }
+    }
+};
 
-    AABB bounds;
-    for (const auto &prim: bvhPrimitives) {
-        bounds.expand(prim.bounds);
+/**
+ * Splits [0, count) into numChunks contiguous chunks and runs f(chunk, begin, end) for each
+ * Chunks after the first are submitted to the thread pool
+ */
+template<typename F>
+static void parallelChunks(const size_t count, const int numChunks, F &&f) {
+    TaskGroup group;
+    const size_t chunkSize = (count + numChunks - 1) / numChunks;
+    for (int c = 1; c < numChunks; ++c) {
+        const size_t begin = jtx::min(c * chunkSize, count);
+        const size_t end   = jtx::min(begin + chunkSize, count);
+        group.run([&f, c, begin, end] { f(c, begin, end); });
     }
+    f(0, 0, jtx::min(chunkSize, count));
+    group.wait();
+}
 
-    if (bounds.surfaceArea() == 0 || bvhPrimitives.size() == 1) {
-        // CASE: single prim or empty bbox;
-        const int firstOffset = *orderedPrimitiveOffset;
-        *orderedPrimitiveOffset += bvhPrimitives.size();
-        for (size_t i = 0; i < bvhPrimitives.size(); ++i) {
-            // const int index                    = ;
-            orderedPrimitives[firstOffset + i] = bvhPrimitives[i];
-        }
-        node->initLeaf(firstOffset, bvhPrimitives.size(), bounds);
-        return node;
-    } else {
-        // Chose split dimensions
-        AABB centroidBounds;
-        for (const auto &prim: bvhPrimitives) {
-            centroidBounds.expand(prim.centroid());
+static int buildThreadCount() {
+#ifdef ENABLE_MULTI_THREADING
+    return ThreadPool::global().concurrency();
+#else
+    return 1;
+#endif
+}
+
+// Subtrees are forked until there are a few tasks per thread
+static int maxParallelDepth(const int numThreads) {
+    if (numThreads == 1) return 0;
+    int depth = 0;
+    while ((1 << depth) < 4 * numThreads) depth++;
+    return depth;
+}
+
+/**
+ * Appends a subtree that was built into its own node arena
+ * Child offsets in the subtree are relative to its arena, so they are shifted to the new position
+ * @return index of the subtree root within nodes
+ */
+static int spliceSubtree(std::vector<LinearBVHNode> &nodes, const std::vector<LinearBVHNode> &subtree) {
+    const int base = static_cast<int>(nodes.size());
+    for (auto node: subtree) {
+        if (node.numPrimitives == 0) node.secondChildOffset += base;
+        nodes.push_back(node);
+    }
+    return base;
+}
+
+static void initLeaf(LinearBVHNode &node, const size_t first, const size_t n, const AABB &bounds) {
+    node.bbox             = bounds;
+    node.primitivesOffset = static_cast<int>(first);
+    node.numPrimitives    = static_cast<uint16_t>(n);
+}
+
+static void initInterior(LinearBVHNode &node, const int secondChild, const int axis, const AABB &bounds) {
+    node.bbox              = bounds;
+    node.secondChildOffset = secondChild;
+    node.numPrimitives     = 0;
+    node.axis              = axis;
+}
+
+class SAHBuilder {
+public:
+    SAHBuilder(const std::span<Primitive> primitives, const int maxPrimsInNode)
+        : primitives_(primitives),
+          maxPrimsInNode_(maxPrimsInNode),
+          numThreads_(buildThreadCount()),
+          maxParallelDepth_(maxParallelDepth(numThreads_)) {}
+
+    /**
+     * Builds the subtree over primitives [begin, end), appending its nodes to the given arena
+     * Child offsets are relative to the start of the arena
+     * @return index of the subtree root within nodes
+     */
+    int build(std::vector<LinearBVHNode> &nodes, const size_t begin, const size_t end, const int depth) {
+        const int nodeIndex = static_cast<int>(nodes.size());
+        nodes.emplace_back();
+
+        const size_t n      = end - begin;
+        const bool parallel = depth < maxParallelDepth_ && n >= BVH_PARALLEL_THRESHOLD;
+
+        AABB bounds, centroidBounds;
+        computeBounds(begin, end, parallel, bounds, centroidBounds);
+
+        if (bounds.surfaceArea() == 0 || n <= 1) {
+            // CASE: single prim or empty bbox
+            initLeaf(nodes[nodeIndex], begin, n, bounds);
+            return nodeIndex;
         }
-        int dim = centroidBounds.longestAxis();
 
+        // Chose split dimensions
+        const int dim = centroidBounds.longestAxis();
         if (centroidBounds.pmin[dim] == centroidBounds.pmax[dim]) {
-            // CASE: empty bbox
-            const int firstOffset = *orderedPrimitiveOffset;
-            *orderedPrimitiveOffset += bvhPrimitives.size();
-            for (size_t i = 0; i < bvhPrimitives.size(); ++i) {
-                // const int index                    = bvhPrimitives[i].index;
-                orderedPrimitives[firstOffset + i] = bvhPrimitives[i];
-            }
-            node->initLeaf(firstOffset, bvhPrimitives.size(), bounds);
-            return node;
+            // CASE: empty centroid bbox
+            initLeaf(nodes[nodeIndex], begin, n, bounds);
+            return nodeIndex;
         }
 
-        int mid = bvhPrimitives.size() / 2;
-
-        if (bvhPrimitives.size() == 2) {
+        size_t mid = begin + n / 2;
+        if (n == 2) {
             std::nth_element(
-                    bvhPrimitives.begin(),
-                    bvhPrimitives.begin() + mid,
-                    bvhPrimitives.end(),
+                    primitives_.begin() + begin,
+                    primitives_.begin() + mid,
+                    primitives_.begin() + end,
                     [dim](const Primitive &a, const Primitive &b) {
                         return a.centroid()[dim] < b.centroid()[dim];
                     });
         } else {
-            // Setup buckets
-            constexpr int BVH_NUM_BUCKETS = 12;
-            BVHBucket buckets[BVH_NUM_BUCKETS];
-
-            for (const auto &prim: bvhPrimitives) {
-                int b = BVH_NUM_BUCKETS * centroidBounds.offset(prim.centroid())[dim];
-                if (b == BVH_NUM_BUCKETS) b = BVH_NUM_BUCKETS - 1;
-                buckets[b].count++;
-                buckets[b].bounds.expand(prim.bounds);
-            }
+            const BVHBuckets buckets = computeBuckets(begin, end, parallel, dim, centroidBounds);
 
             // Setup bucket costs
-            constexpr int BVH_NUM_SPLITS = BVH_NUM_BUCKETS - 1;
-            float costs[BVH_NUM_SPLITS]  = {};
+            float costs[BVH_NUM_SPLITS] = {};
 
             // Forward pass
             int countBelow = 0;
             AABB boundsBelow;
             for (int i = 0; i < BVH_NUM_SPLITS; ++i) {
-                countBelow += buckets[i].count;
-                boundsBelow.expand(buckets[i].bounds);
+                countBelow += buckets.buckets[i].count;
+                boundsBelow.expand(buckets.buckets[i].bounds);
                 costs[i] += countBelow * boundsBelow.surfaceArea();
             }
 
@@ -84,8 +155,8 @@ BVHNode *buildTree(std::span<Primitive> bvhPrimitives, int *totalNodes, int *ord
             int countAbove = 0;
             AABB boundsAbove;
             for (int i = BVH_NUM_BUCKETS - 1; i > 0; --i) {
-                countAbove += buckets[i].count;
-                boundsAbove.expand(buckets[i].bounds);
+                countAbove += buckets.buckets[i].count;
+                boundsAbove.expand(buckets.buckets[i].bounds);
                 costs[i - 1] += countAbove * boundsAbove.surfaceArea();
             }
 
@@ -100,50 +171,541 @@ BVHNode *buildTree(std::span<Primitive> bvhPrimitives, int *totalNodes, int *ord
             }
 
             // Calculate split cost
-            const float leafCost = bvhPrimitives.size();
-            minCost              = 0.5f + minCost / bounds.surfaceArea();
-            if (bvhPrimitives.size() > maxPrimsInNode || minCost < leafCost) {
-                // Build interior node
-                auto midIterator = std::partition(bvhPrimitives.begin(), bvhPrimitives.end(), [=](const Primitive &p) {
-                    int b = BVH_NUM_BUCKETS * centroidBounds.offset(p.centroid())[dim];
-                    if (b == BVH_NUM_BUCKETS) b = BVH_NUM_BUCKETS - 1;
-                    return b <= minBucket;
+            const float leafCost = BVH_INTERSECTION_COST * static_cast<float>(n);
+            minCost              = BVH_TRAVERSAL_COST + BVH_INTERSECTION_COST * minCost / bounds.surfaceArea();
+            if (n > maxPrimsInNode_ || minCost < leafCost) {
+                const auto midIterator = std::partition(primitives_.begin() + begin, primitives_.begin() + end, [&](const Primitive &p) {
+                    return bucketIndex(p, dim, centroidBounds) <= minBucket;
                 });
-                mid              = midIterator - bvhPrimitives.begin();
+                mid = midIterator - primitives_.begin();
             } else {
-                // Build leaf node
-                const int firstOffset = *orderedPrimitiveOffset;
-                *orderedPrimitiveOffset += bvhPrimitives.size();
-                for (size_t i = 0; i < bvhPrimitives.size(); ++i) {
-                    // const int index                    = bvhPrimitives[i].index;
-                    orderedPrimitives[firstOffset + i] = bvhPrimitives[i];
-                }
-                node->initLeaf(firstOffset, bvhPrimitives.size(), bounds);
-                return node;
+                initLeaf(nodes[nodeIndex], begin, n, bounds);
+                return nodeIndex;
+            }
+        }
+
+        int secondChild;
+        if (parallel) {
+            // The first child has to directly follow its parent, so it is built into this arena
+            // The second child is built into its own arena by a pool task, then spliced in
+            std::vector<LinearBVHNode> secondNodes;
+            secondNodes.reserve(2 * (end - mid));
+            TaskGroup group;
+            group.run([&] { build(secondNodes, mid, end, depth + 1); });
+            build(nodes, begin, mid, depth + 1);
+            group.wait();
+            secondChild = spliceSubtree(nodes, secondNodes);
+        } else {
+            build(nodes, begin, mid, depth + 1);
+            secondChild = build(nodes, mid, end, depth + 1);
+        }
+
+        initInterior(nodes[nodeIndex], secondChild, dim, bounds);
+        return nodeIndex;
+    }
+
+private:
+    std::span<Primitive> primitives_;
+    int maxPrimsInNode_;
+    int numThreads_;
+    int maxParallelDepth_;
+
+    static int bucketIndex(const Primitive &p, const int dim, const AABB &centroidBounds) {
+        int b = BVH_NUM_BUCKETS * centroidBounds.offset(p.centroid())[dim];
+        if (b == BVH_NUM_BUCKETS) b = BVH_NUM_BUCKETS - 1;
+        return b;
+    }
+
+    void computeBounds(const size_t begin, const size_t end, const bool parallel, AABB &bounds, AABB &centroidBounds) const {
+        const int numChunks = parallel ? numThreads_ : 1;
+        std::vector<AABB> chunkBounds(numChunks), chunkCentroids(numChunks);
+        parallelChunks(end - begin, numChunks, [&](const int c, const size_t chunkBegin, const size_t chunkEnd) {
+            for (size_t i = begin + chunkBegin; i < begin + chunkEnd; ++i) {
+                chunkBounds[c].expand(primitives_[i].bounds);
+                chunkCentroids[c].expand(primitives_[i].centroid());
+            }
+        });
+        for (int c = 0; c < numChunks; ++c) {
+            bounds.expand(chunkBounds[c]);
+            centroidBounds.expand(chunkCentroids[c]);
+        }
+    }
+
+    BVHBuckets computeBuckets(const size_t begin, const size_t end, const bool parallel, const int dim, const AABB &centroidBounds) const {
+        const int numChunks = parallel ? numThreads_ : 1;
+        std::vector<BVHBuckets> chunkBuckets(numChunks);
+        parallelChunks(end - begin, numChunks, [&](const int c, const size_t chunkBegin, const size_t chunkEnd) {
+            for (size_t i = begin + chunkBegin; i < begin + chunkEnd; ++i) {
+                const Primitive &prim = primitives_[i];
+                BVHBucket &bucket     = chunkBuckets[c].buckets[bucketIndex(prim, dim, centroidBounds)];
+                bucket.count++;
+                bucket.bounds.expand(prim.bounds);
+            }
+        });
+        for (int c = 1; c < numChunks; ++c) {
+            chunkBuckets[0].merge(chunkBuckets[c]);
+        }
+        return chunkBuckets[0];
+    }
+};
+
+void buildBVHSAH(const std::span<Primitive> primitives, const int maxPrimsInNode, std::vector<LinearBVHNode> &nodes) {
+    nodes.clear();
+    // A binary tree has at most 2n - 1 nodes, so the root arena never reallocates
+    nodes.reserve(2 * primitives.size());
+
+    SAHBuilder builder(primitives, maxPrimsInNode);
+    builder.build(nodes, 0, primitives.size(), 0);
+}
+
+// Morton codes use 10 bits per axis, and are sorted 10 bits per radix pass
+static constexpr int MORTON_BITS   = 10;
+static constexpr int MORTON_SCALE  = 1 << MORTON_BITS;
+static constexpr int RADIX_BITS    = 10;
+static constexpr int RADIX_BUCKETS = 1 << RADIX_BITS;
+static constexpr int RADIX_PASSES  = 3 * MORTON_BITS / RADIX_BITS;
+
+struct MortonPrimitive {
+    uint32_t code;
+    uint32_t index;
+};
+
+// Spreads the lower 10 bits of x so there are two zero bits between each
+inline uint32_t leftShift3(uint32_t x) {
+    if (x == (1 << 10)) --x;
+    x = (x | (x << 16)) & 0b00000011000000000000000011111111;
+    x = (x | (x << 8)) & 0b00000011000000001111000000001111;
+    x = (x | (x << 4)) & 0b00000011000011000011000011000011;
+    x = (x | (x << 2)) & 0b00001001001001001001001001001001;
+    return x;
+}
+
+// Bit b of the code comes from axis b % 3
+inline uint32_t encodeMorton3(const float x, const float y, const float z) {
+    return (leftShift3(z) << 2) | (leftShift3(y) << 1) | leftShift3(x);
+}
+
+/**
+ * Parallel LSD radix sort of Morton codes
+ * Each chunk histograms its own range, so scattering stays stable without any atomics
+ */
+static void radixSort(std::vector<MortonPrimitive> &v, const int numChunks) {
+    std::vector<MortonPrimitive> temp(v.size());
+    std::vector<size_t> counts(numChunks * RADIX_BUCKETS);
+
+    for (int pass = 0; pass < RADIX_PASSES; ++pass) {
+        const int shift = pass * RADIX_BITS;
+        std::ranges::fill(counts, 0);
+
+        parallelChunks(v.size(), numChunks, [&](const int c, const size_t begin, const size_t end) {
+            size_t *chunkCounts = &counts[c * RADIX_BUCKETS];
+            for (size_t i = begin; i < end; ++i) {
+                chunkCounts[(v[i].code >> shift) & (RADIX_BUCKETS - 1)]++;
+            }
+        });
+
+        // Exclusive prefix sum in (bucket, chunk) order gives each chunk its output offset per bucket
+        size_t offset = 0;
+        for (int b = 0; b < RADIX_BUCKETS; ++b) {
+            for (int c = 0; c < numChunks; ++c) {
+                const size_t count            = counts[c * RADIX_BUCKETS + b];
+                counts[c * RADIX_BUCKETS + b] = offset;
+                offset += count;
+            }
+        }
+
+        parallelChunks(v.size(), numChunks, [&](const int c, const size_t begin, const size_t end) {
+            size_t *chunkOffsets = &counts[c * RADIX_BUCKETS];
+            for (size_t i = begin; i < end; ++i) {
+                temp[chunkOffsets[(v[i].code >> shift) & (RADIX_BUCKETS - 1)]++] = v[i];
+            }
+        });
+
+        v.swap(temp);
+    }
+}
+
+class LBVHBuilder {
+public:
+    LBVHBuilder(const std::span<Primitive> primitives, const std::vector<MortonPrimitive> &mortonPrims, const int maxPrimsInNode)
+        : primitives_(primitives),
+          mortonPrims_(mortonPrims),
+          maxPrimsInNode_(maxPrimsInNode),
+          maxParallelDepth_(maxParallelDepth(buildThreadCount())) {}
+
+    /**
+     * Emits the subtree over sorted primitives [begin, end), splitting at the highest differing Morton bit
+     * Bounds are computed bottom-up from the children
+     * @return index of the subtree root within nodes
+     */
+    int build(std::vector<LinearBVHNode> &nodes, const size_t begin, const size_t end, int bitIndex, const int depth) {
+        const int nodeIndex = static_cast<int>(nodes.size());
+        nodes.emplace_back();
+
+        const size_t n = end - begin;
+        if (n <= maxPrimsInNode_) {
+            AABB bounds;
+            for (size_t i = begin; i < end; ++i) {
+                bounds.expand(primitives_[i].bounds);
             }
+            initLeaf(nodes[nodeIndex], begin, n, bounds);
+            return nodeIndex;
+        }
+
+        // Find the highest bit that differs within the range
+        // Codes are sorted, so comparing the first and last code is enough
+        while (bitIndex >= 0) {
+            const uint32_t mask = 1u << bitIndex;
+            if ((mortonPrims_[begin].code & mask) != (mortonPrims_[end - 1].code & mask)) break;
+            --bitIndex;
+        }
+
+        size_t mid;
+        int axis;
+        if (bitIndex < 0) {
+            // All codes are equal, split in the middle
+            mid  = begin + n / 2;
+            axis = 0;
+        } else {
+            const uint32_t mask = 1u << bitIndex;
+            const auto it       = std::partition_point(mortonPrims_.begin() + begin, mortonPrims_.begin() + end, [mask](const MortonPrimitive &p) {
+                return (p.code & mask) == 0;
+            });
+            mid  = it - mortonPrims_.begin();
+            axis = bitIndex % 3;
+        }
+
+        int secondChild;
+        if (depth < maxParallelDepth_ && n >= BVH_PARALLEL_THRESHOLD) {
+            std::vector<LinearBVHNode> secondNodes;
+            secondNodes.reserve(2 * (end - mid));
+            TaskGroup group;
+            group.run([&] { build(secondNodes, mid, end, bitIndex - 1, depth + 1); });
+            build(nodes, begin, mid, bitIndex - 1, depth + 1);
+            group.wait();
+            secondChild = spliceSubtree(nodes, secondNodes);
+        } else {
+            build(nodes, begin, mid, bitIndex - 1, depth + 1);
+            secondChild = build(nodes, mid, end, bitIndex - 1, depth + 1);
+        }
+
+        initInterior(nodes[nodeIndex], secondChild, axis, AABB(nodes[nodeIndex + 1].bbox, nodes[secondChild].bbox));
+        return nodeIndex;
+    }
+
+private:
+    std::span<Primitive> primitives_;
+    const std::vector<MortonPrimitive> &mortonPrims_;
+    int maxPrimsInNode_;
+    int maxParallelDepth_;
+};
+
+void buildBVHLBVH(const std::span<Primitive> primitives, const int maxPrimsInNode, std::vector<LinearBVHNode> &nodes) {
+    nodes.clear();
+    nodes.reserve(2 * primitives.size());
+
+    const size_t n      = primitives.size();
+    const int numChunks = n >= BVH_PARALLEL_THRESHOLD ? buildThreadCount() : 1;
+
+    // Centroid bounds
+    std::vector<AABB> chunkCentroids(numChunks);
+    parallelChunks(n, numChunks, [&](const int c, const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            chunkCentroids[c].expand(primitives[i].centroid());
+        }
+    });
+    AABB centroidBounds;
+    for (const auto &bounds: chunkCentroids) {
+        centroidBounds.expand(bounds);
+    }
+
+    // Morton codes, quantized within the centroid bounds
+    std::vector<MortonPrimitive> mortonPrims(n);
+    parallelChunks(n, numChunks, [&](int, const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const Vec3 offset = MORTON_SCALE * centroidBounds.offset(primitives[i].centroid());
+            mortonPrims[i]    = {encodeMorton3(offset.x, offset.y, offset.z), static_cast<uint32_t>(i)};
+        }
+    });
+
+    radixSort(mortonPrims, numChunks);
+
+    // Reorder primitives to match the sorted codes, so leaves reference contiguous ranges
+    std::vector<Primitive> sorted(n);
+    parallelChunks(n, numChunks, [&](int, const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            sorted[i] = primitives[mortonPrims[i].index];
+        }
+    });
+    std::ranges::copy(sorted, primitives.begin());
+
+    LBVHBuilder builder(primitives, mortonPrims, maxPrimsInNode);
+    builder.build(nodes, 0, n, 3 * MORTON_BITS - 1, 0);
+}
+
+void buildBVH(const BVHBuildMethod method, const std::span<Primitive> primitives, const int maxPrimsInNode, std::vector<LinearBVHNode> &nodes) {
+    switch (method) {
+        case BVHBuildMethod::LBVH:
+            buildBVHLBVH(primitives, maxPrimsInNode, nodes);
+            break;
+        case BVHBuildMethod::SAH:
+        default:
+            buildBVHSAH(primitives, maxPrimsInNode, nodes);
+            break;
+    }
+}
+
+static void refitNode(const std::span<Primitive> primitives, const std::function<AABB(const Primitive &)> &primitiveBounds, std::vector<LinearBVHNode> &nodes, const int nodeIndex, const int depth, const int parallelDepth) {
+    LinearBVHNode &node = nodes[nodeIndex];
+    if (node.numPrimitives > 0) {
+        AABB bounds;
+        for (int i = node.primitivesOffset; i < node.primitivesOffset + node.numPrimitives; ++i) {
+            primitives[i].bounds = primitiveBounds(primitives[i]);
+            bounds.expand(primitives[i].bounds);
         }
+        node.bbox = bounds;
+        return;
+    }
 
-        BVHNode *children[2];
-        children[0] = buildTree(bvhPrimitives.subspan(0, mid), totalNodes, orderedPrimitiveOffset, orderedPrimitives, maxPrimsInNode);
-        children[1] = buildTree(bvhPrimitives.subspan(mid), totalNodes, orderedPrimitiveOffset, orderedPrimitives, maxPrimsInNode);
-        node->initBranch(dim, children[0], children[1]);
+    if (depth < parallelDepth) {
+        TaskGroup group;
+        group.run([&] { refitNode(primitives, primitiveBounds, nodes, node.secondChildOffset, depth + 1, parallelDepth); });
+        refitNode(primitives, primitiveBounds, nodes, nodeIndex + 1, depth + 1, parallelDepth);
+        group.wait();
+    } else {
+        refitNode(primitives, primitiveBounds, nodes, nodeIndex + 1, depth + 1, parallelDepth);
+        refitNode(primitives, primitiveBounds, nodes, node.secondChildOffset, depth + 1, parallelDepth);
     }
+    node.bbox = AABB(nodes[nodeIndex + 1].bbox, nodes[node.secondChildOffset].bbox);
+}
+
+void refitBVH(const std::span<Primitive> primitives, const std::function<AABB(const Primitive &)> &primitiveBounds, std::vector<LinearBVHNode> &nodes) {
+    if (nodes.empty()) return;
+    // Only fork when there is enough work to cover the task overhead
+    const int parallelDepth = primitives.size() >= BVH_PARALLEL_THRESHOLD ? maxParallelDepth(buildThreadCount()) : 0;
+    refitNode(primitives, primitiveBounds, nodes, 0, 0, parallelDepth);
+}
 
-    return node;
+float bvhCost(const std::vector<LinearBVHNode> &nodes) {
+    if (nodes.empty()) return 0;
+
+    float cost = 0;
+    for (const auto &node: nodes) {
+        if (node.numPrimitives > 0) {
+            cost += BVH_INTERSECTION_COST * node.numPrimitives * node.bbox.surfaceArea();
+        } else {
+            cost += BVH_TRAVERSAL_COST * node.bbox.surfaceArea();
+        }
+    }
+    return cost / nodes[0].bbox.surfaceArea();
 }
 
-int flattenBVH(const BVHNode *node, LinearBVHNode *nodes, int *offset) {
-    LinearBVHNode *linearNode = &nodes[*offset];
-    linearNode->bbox          = node->bbox;
-    const int nodeOffset      = (*offset)++;
-    if (node->numPrimitives > 0) {
-        linearNode->primitivesOffset = node->firstPrimOffset;
-        linearNode->numPrimitives    = node->numPrimitives;
+template<int N>
+static int collapseNode(const LinearBVHNode *nodes, const int nodeIndex, std::vector<WideBVHNode<N>> &wideNodes) {
+    // Gather up to N children by repeatedly opening the largest interior child
+    int children[N];
+    int numChildren = 0;
+
+    const LinearBVHNode &node = nodes[nodeIndex];
+    if (node.numPrimitives > 0) {
+        children[numChildren++] = nodeIndex;
     } else {
-        linearNode->axis          = node->splitAxis;
-        linearNode->numPrimitives = 0;
-        flattenBVH(node->children[0], nodes, offset);
-        linearNode->secondChildOffset = flattenBVH(node->children[1], nodes, offset);
+        children[numChildren++] = nodeIndex + 1;
+        children[numChildren++] = node.secondChildOffset;
+    }
+
+    while (numChildren < N) {
+        int best       = -1;
+        float bestArea = -1;
+        for (int i = 0; i < numChildren; ++i) {
+            const LinearBVHNode &child = nodes[children[i]];
+            if (child.numPrimitives > 0) continue;
+            const float area = child.bbox.surfaceArea();
+            if (area > bestArea) {
+                bestArea = area;
+                best     = i;
+            }
+        }
+        if (best == -1) break;
+
+        const int opened        = children[best];
+        children[best]          = opened + 1;
+        children[numChildren++] = nodes[opened].secondChildOffset;
     }
-    return nodeOffset;
-}
\ No newline at end of file
+
+    const int wideIndex = static_cast<int>(wideNodes.size());
+    wideNodes.emplace_back();
+
+    WideBVHNode<N> wideNode{};
+    wideNode.numChildren = numChildren;
+    for (int i = 0; i < numChildren; ++i) {
+        const LinearBVHNode &child = nodes[children[i]];
+        wideNode.bounds[0][i]      = child.bbox.pmin.x;
+        wideNode.bounds[1][i]      = child.bbox.pmin.y;
+        wideNode.bounds[2][i]      = child.bbox.pmin.z;
+        wideNode.bounds[3][i]      = child.bbox.pmax.x;
+        wideNode.bounds[4][i]      = child.bbox.pmax.y;
+        wideNode.bounds[5][i]      = child.bbox.pmax.z;
+
+        if (child.numPrimitives > 0) {
+            wideNode.offset[i]        = child.primitivesOffset;
+            wideNode.numPrimitives[i] = child.numPrimitives;
+        } else {
+            wideNode.offset[i]        = collapseNode(nodes, children[i], wideNodes);
+            wideNode.numPrimitives[i] = 0;
+        }
+    }
+
+    // Recursion may have grown the vector, so write through the index
+    wideNodes[wideIndex] = wideNode;
+    return wideIndex;
+}
+
+template<int N>
+void collapseBVH(const LinearBVHNode *nodes, std::vector<WideBVHNode<N>> &wideNodes) {
+    wideNodes.clear();
+    collapseNode(nodes, 0, wideNodes);
+}
+
+template void collapseBVH<4>(const LinearBVHNode *nodes, std::vector<WideBVHNode<4>> &wideNodes);
+template void collapseBVH<8>(const LinearBVHNode *nodes, std::vector<WideBVHNode<8>> &wideNodes);
+
+void BVH::build(const BVHBuildMethod buildMethod, const int maxPrimsInNode) {
+    method = buildMethod;
+    if (primitives.empty()) {
+        nodes.clear();
+        wideNodes.clear();
+        cost = 0;
+        return;
+    }
+
+    buildBVH(method, primitives, maxPrimsInNode, nodes);
+    cost = bvhCost(nodes);
+
+#if BVH_WIDTH > 2
+    collapseBVH(nodes.data(), wideNodes);
+#endif
+}
+
+float BVH::refit(const std::function<AABB(const Primitive &)> &primitiveBounds) {
+    if (nodes.empty()) return 1;
+
+    refitBVH(primitives, primitiveBounds, nodes);
+
+#if BVH_WIDTH > 2
+    // Wide nodes store copies of the binary bounds
+    collapseBVH(nodes.data(), wideNodes);
+#endif
+
+    return bvhCost(nodes) / cost;
+}
+
+// BVH file layout, little endian:
+//   magic, version, BVH_WIDTH, sizes of LinearBVHNode, WBVHNode and Primitive, build method (all 32 bit),
+//   key (64 bit), SAH cost (32 bit float), number of primitives, nodes and wide nodes (64 bit)
+//   followed by the primitives, nodes and wide nodes as they are in memory
+static constexpr uint32_t BVH_FILE_MAGIC   = 0x4258544a; // "JTXB"
+static constexpr uint32_t BVH_FILE_VERSION = 1;
+
+bool BVH::save(const std::string &path, const uint64_t key) const {
+    const std::string tempPath = path + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary);
+        if (!out) return false;
+
+        const auto write = [&](const auto value) { out.write(reinterpret_cast<const char *>(&value), sizeof(value)); };
+        const auto writeArray = [&]<typename T>(const std::vector<T> &values) {
+            out.write(reinterpret_cast<const char *>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)));
+        };
+        write(BVH_FILE_MAGIC);
+        write(BVH_FILE_VERSION);
+        write(static_cast<uint32_t>(BVH_WIDTH));
+        write(static_cast<uint32_t>(sizeof(LinearBVHNode)));
+        write(static_cast<uint32_t>(sizeof(WBVHNode)));
+        write(static_cast<uint32_t>(sizeof(Primitive)));
+        write(static_cast<uint32_t>(method));
+        write(key);
+        write(cost);
+        write(static_cast<uint64_t>(primitives.size()));
+        write(static_cast<uint64_t>(nodes.size()));
+        write(static_cast<uint64_t>(wideNodes.size()));
+        writeArray(primitives);
+        writeArray(nodes);
+        writeArray(wideNodes);
+        if (!out) return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+    return !error;
+}
+
+bool BVH::load(const std::string &path, const uint64_t key, const size_t numPrimitives) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+
+    const auto read = [&]<typename T>(T &value) { in.read(reinterpret_cast<char *>(&value), sizeof(value)); };
+    uint32_t magic = 0, version = 0, width = 0, nodeSize = 0, wideNodeSize = 0, primitiveSize = 0, fileMethod = 0;
+    uint64_t fileKey = 0, fileNumPrimitives = 0, numNodes = 0, numWideNodes = 0;
+    float fileCost = 0;
+    read(magic);
+    read(version);
+    read(width);
+    read(nodeSize);
+    read(wideNodeSize);
+    read(primitiveSize);
+    read(fileMethod);
+    read(fileKey);
+    read(fileCost);
+    read(fileNumPrimitives);
+    read(numNodes);
+    read(numWideNodes);
+    if (!in || magic != BVH_FILE_MAGIC || version != BVH_FILE_VERSION || width != BVH_WIDTH ||
+        nodeSize != sizeof(LinearBVHNode) || wideNodeSize != sizeof(WBVHNode) || primitiveSize != sizeof(Primitive) ||
+        fileKey != key || fileNumPrimitives != numPrimitives || numNodes == 0 || numNodes > 2 * numPrimitives ||
+        numWideNodes > numNodes || (BVH_WIDTH > 2) != (numWideNodes > 0)) {
+        return false;
+    }
+
+    std::vector<Primitive> filePrimitives(numPrimitives);
+    std::vector<LinearBVHNode> fileNodes(numNodes);
+    std::vector<WBVHNode> fileWideNodes(numWideNodes);
+    in.read(reinterpret_cast<char *>(filePrimitives.data()), static_cast<std::streamsize>(numPrimitives * sizeof(Primitive)));
+    in.read(reinterpret_cast<char *>(fileNodes.data()), static_cast<std::streamsize>(numNodes * sizeof(LinearBVHNode)));
+    in.read(reinterpret_cast<char *>(fileWideNodes.data()), static_cast<std::streamsize>(numWideNodes * sizeof(WBVHNode)));
+    if (!in) return false;
+
+    // Traversal trusts every offset, so a damaged or foreign file must not get through
+    std::vector<uint8_t> seen(numPrimitives);
+    for (const Primitive &primitive: filePrimitives) {
+        if (primitive.index >= numPrimitives || seen[primitive.index]) return false;
+        seen[primitive.index] = 1;
+    }
+    for (size_t i = 0; i < numNodes; ++i) {
+        const LinearBVHNode &node = fileNodes[i];
+        if (node.numPrimitives > 0) {
+            if (node.primitivesOffset < 0 || node.primitivesOffset + static_cast<size_t>(node.numPrimitives) > numPrimitives) return false;
+        } else if (i + 1 >= numNodes || node.secondChildOffset <= static_cast<int>(i) + 1 ||
+                   static_cast<size_t>(node.secondChildOffset) >= numNodes) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < numWideNodes; ++i) {
+        const WBVHNode &node = fileWideNodes[i];
+        if (node.numChildren < 1 || node.numChildren > BVH_WIDTH) return false;
+        for (int c = 0; c < node.numChildren; ++c) {
+            if (node.offset[c] < 0) return false;
+            if (node.numPrimitives[c] > 0 ? node.offset[c] + static_cast<size_t>(node.numPrimitives[c]) > numPrimitives
+                                          : static_cast<size_t>(node.offset[c]) <= i || static_cast<size_t>(node.offset[c]) >= numWideNodes) {
+                return false;
+            }
+        }
+    }
+
+    primitives = std::move(filePrimitives);
+    nodes      = std::move(fileNodes);
+    wideNodes  = std::move(fileWideNodes);
+    method     = static_cast<BVHBuildMethod>(fileMethod);
+    cost       = fileCost;
+    return true;
+}
@@ -1,8 +1,25 @@
 #pragma once
 
+#include "packet.hpp"
 #include "primitives.hpp"
 #include "rt.hpp"
 
+#include <bit>
+#include <functional>
+#include <string>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// Branching factor used for traversal, set via the BVH_WIDTH CMake option
+// 2 traverses the LinearBVHNode array directly, 4 and 8 traverse a collapsed wide BVH
+#ifndef BVH_WIDTH
+#define BVH_WIDTH 4
+#endif
+
+static_assert(BVH_WIDTH == 2 || BVH_WIDTH == 4 || BVH_WIDTH == 8, "BVH_WIDTH must be 2, 4 or 8");
+
 struct alignas(32) LinearBVHNode {
     AABB bbox;
     union {
@@ -13,47 +30,548 @@ struct alignas(32) LinearBVHNode {
     uint8_t axis;
 };
 
-struct BVHNode {
-    AABB bbox;
-    BVHNode *children[2];
-    int splitAxis;
-    int firstPrimOffset;
-    int numPrimitives;
+enum class BVHBuildMethod {
+    // Binned SAH, best traversal performance
+    SAH = 0,
+    // Morton-sorted linear BVH, fast enough to rebuild while editing
+    LBVH = 1
+};
+
+/**
+ * Builds a flattened BVH over primitives using binned SAH
+ * Primitives are partitioned in place, so each leaf references a contiguous range of the input span
+ * Bounds reductions and binning run in parallel at the top levels, after which subtrees are built in parallel
+ * @param primitives primitives to build over, reordered on return
+ * @param maxPrimsInNode maximum number of primitives in a leaf, unless they cannot be split
+ * @param nodes output nodes in depth-first order (root at index 0)
+ */
+void buildBVHSAH(std::span<Primitive> primitives, int maxPrimsInNode, std::vector<LinearBVHNode> &nodes);
+
+/**
+ * Builds a flattened BVH over primitives by sorting them along a 30-bit Morton curve
+ * Codes are computed from primitive centroids and sorted with a parallel radix sort,
+ * then the hierarchy is emitted top-down by splitting at the highest differing bit
+ * @param primitives primitives to build over, reordered on return
+ * @param maxPrimsInNode maximum number of primitives in a leaf, unless they share a Morton code
+ * @param nodes output nodes in depth-first order (root at index 0)
+ */
+void buildBVHLBVH(std::span<Primitive> primitives, int maxPrimsInNode, std::vector<LinearBVHNode> &nodes);
+
+void buildBVH(BVHBuildMethod method, std::span<Primitive> primitives, int maxPrimsInNode, std::vector<LinearBVHNode> &nodes);
+
+/**
+ * Recomputes primitive and node bounds bottom-up without changing the topology
+ * Subtrees near the root are refit in parallel
+ * @param primitives primitives referenced by the leaves, their bounds are updated in place
+ * @param primitiveBounds returns the current bounds of a primitive
+ * @param nodes flattened BVH to refit
+ */
+void refitBVH(std::span<Primitive> primitives, const std::function<AABB(const Primitive &)> &primitiveBounds, std::vector<LinearBVHNode> &nodes);
+
+/**
+ * Evaluates the SAH cost of a flattened BVH, using the same traversal and intersection costs as the SAH builder
+ * Useful for comparing a refit tree against the tree it was built as
+ * @return expected cost of a ray that hits the root bounds
+ */
+float bvhCost(const std::vector<LinearBVHNode> &nodes);
+
+// Wide BVH node with SoA child bounds, so all N boxes can be tested in one SIMD pass
+// Children are packed to the front, numChildren gives the number of valid slots
+// A child with numPrimitives == 0 is an interior node, offset indexes the wide node array
+// Otherwise it is a leaf, and offset indexes the primitive array
+template<int N>
+struct alignas(32) WideBVHNode {
+    float bounds[6][N];// minX, minY, minZ, maxX, maxY, maxZ
+    int offset[N];
+    int numPrimitives[N];
+    int numChildren;
+};
+
+using WBVHNode = WideBVHNode<BVH_WIDTH>;
+
+/**
+ * Collapses a flattened binary BVH into an N-wide BVH
+ * Interior nodes are opened greedily, largest surface area first, until N children are gathered
+ * @param nodes flattened binary BVH (root at index 0)
+ * @param wideNodes output wide nodes (root at index 0)
+ */
+template<int N>
+void collapseBVH(const LinearBVHNode *nodes, std::vector<WideBVHNode<N>> &wideNodes);
+
+/**
+ * Tests one ray against all children of a wide node
+ * Near/far planes are picked with the ray's dirIsNeg, so no per-axis swap is needed
+ * @param tNear entry distance for each child
+ * @return bitmask of children that are hit within [tMin, tMax]
+ */
+template<int N>
+inline int hitChildren(const WideBVHNode<N> &node, const TraversalRay &r, const float tMin, const float tMax, float tNear[N]) {
+    const Vec3 &o       = r.origin;
+    const Vec3 &invDir  = r.invDir;
+    const int *dirIsNeg = r.dirIsNeg;
+
+    const int nx = dirIsNeg[0] * 3, fx = 3 - nx;
+    const int ny = dirIsNeg[1] * 3 + 1, fy = 4 - dirIsNeg[1] * 3;
+    const int nz = dirIsNeg[2] * 3 + 2, fz = 5 - dirIsNeg[2] * 3;
+
+    int mask = 0;
+    for (int i = 0; i < node.numChildren; ++i) {
+        const float t0 = jtx::max(jtx::max((node.bounds[nx][i] - o.x) * invDir.x, (node.bounds[ny][i] - o.y) * invDir.y),
+                                  jtx::max((node.bounds[nz][i] - o.z) * invDir.z, tMin));
+        float t1       = jtx::min(jtx::min((node.bounds[fx][i] - o.x) * invDir.x, (node.bounds[fy][i] - o.y) * invDir.y),
+                                  (node.bounds[fz][i] - o.z) * invDir.z);
+#ifdef ROBUST_TRAVERSAL
+        t1 *= SLAB_FAR_SCALE;
+#endif
+        t1 = jtx::min(t1, tMax);
+
+        tNear[i] = t0;
+        mask |= static_cast<int>(t0 <= t1) << i;
+    }
+    return mask;
+}
+
+#if defined(__SSE__) || defined(_M_X64)
+template<>
+inline int hitChildren<4>(const WideBVHNode<4> &node, const TraversalRay &r, const float tMin, const float tMax, float tNear[4]) {
+    const Vec3 &o       = r.origin;
+    const Vec3 &invDir  = r.invDir;
+    const int *dirIsNeg = r.dirIsNeg;
+
+    const int nx = dirIsNeg[0] * 3, fx = 3 - nx;
+    const int ny = dirIsNeg[1] * 3 + 1, fy = 4 - dirIsNeg[1] * 3;
+    const int nz = dirIsNeg[2] * 3 + 2, fz = 5 - dirIsNeg[2] * 3;
+
+    const __m128 ox = _mm_set1_ps(o.x), oy = _mm_set1_ps(o.y), oz = _mm_set1_ps(o.z);
+    const __m128 ix = _mm_set1_ps(invDir.x), iy = _mm_set1_ps(invDir.y), iz = _mm_set1_ps(invDir.z);
+
+    const __m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[nx]), ox), ix);
+    const __m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[ny]), oy), iy);
+    const __m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[nz]), oz), iz);
+    const __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[fx]), ox), ix);
+    const __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[fy]), oy), iy);
+    const __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[fz]), oz), iz);
+
+    const __m128 t0 = _mm_max_ps(_mm_max_ps(tx0, ty0), _mm_max_ps(tz0, _mm_set1_ps(tMin)));
+#ifdef ROBUST_TRAVERSAL
+    const __m128 t1 = _mm_min_ps(_mm_mul_ps(_mm_min_ps(_mm_min_ps(tx1, ty1), tz1), _mm_set1_ps(SLAB_FAR_SCALE)), _mm_set1_ps(tMax));
+#else
+    const __m128 t1 = _mm_min_ps(_mm_min_ps(tx1, ty1), _mm_min_ps(tz1, _mm_set1_ps(tMax)));
+#endif
+
+    _mm_storeu_ps(tNear, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1)) & ((1 << node.numChildren) - 1);
+}
+#endif
+
+#if defined(__AVX2__)
+template<>
+inline int hitChildren<8>(const WideBVHNode<8> &node, const TraversalRay &r, const float tMin, const float tMax, float tNear[8]) {
+    const Vec3 &o       = r.origin;
+    const Vec3 &invDir  = r.invDir;
+    const int *dirIsNeg = r.dirIsNeg;
+
+    const int nx = dirIsNeg[0] * 3, fx = 3 - nx;
+    const int ny = dirIsNeg[1] * 3 + 1, fy = 4 - dirIsNeg[1] * 3;
+    const int nz = dirIsNeg[2] * 3 + 2, fz = 5 - dirIsNeg[2] * 3;
+
+    const __m256 ox = _mm256_set1_ps(o.x), oy = _mm256_set1_ps(o.y), oz = _mm256_set1_ps(o.z);
+    const __m256 ix = _mm256_set1_ps(invDir.x), iy = _mm256_set1_ps(invDir.y), iz = _mm256_set1_ps(invDir.z);
+
+    const __m256 tx0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[nx]), ox), ix);
+    const __m256 ty0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ny]), oy), iy);
+    const __m256 tz0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[nz]), oz), iz);
+    const __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[fx]), ox), ix);
+    const __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[fy]), oy), iy);
+    const __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[fz]), oz), iz);
+
+    const __m256 t0 = _mm256_max_ps(_mm256_max_ps(tx0, ty0), _mm256_max_ps(tz0, _mm256_set1_ps(tMin)));
+#ifdef ROBUST_TRAVERSAL
+    const __m256 t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_min_ps(_mm256_min_ps(tx1, ty1), tz1), _mm256_set1_ps(SLAB_FAR_SCALE)), _mm256_set1_ps(tMax));
+#else
+    const __m256 t1 = _mm256_min_ps(_mm256_min_ps(tx1, ty1), _mm256_min_ps(tz1, _mm256_set1_ps(tMax)));
+#endif
+
+    _mm256_storeu_ps(tNear, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)) & ((1 << node.numChildren) - 1);
+}
+#endif
+
+/**
+ * Flattened BVH over a set of primitives, plus its collapsed wide copy when BVH_WIDTH > 2
+ * Used for both levels of the scene: one per mesh in object space, and one over instances and spheres
+ * Leaf tests are passed in as callables, so each level supplies its own primitive intersection
+ * They receive the primitive's position in leaf order, so per-primitive data can be stored alongside
+ */
+struct BVH {
+    std::vector<Primitive> primitives;
+    std::vector<LinearBVHNode> nodes;
+    std::vector<WBVHNode> wideNodes;
+
+    BVHBuildMethod method = BVHBuildMethod::SAH;
+    // SAH cost at build time
+    float cost = 0;
+
+    /**
+     * Builds over primitives, whose bounds must already be set
+     * Primitives are reordered to match the leaves
+     */
+    void build(BVHBuildMethod buildMethod, int maxPrimsInNode);
+
+    /**
+     * Refits to updated primitive bounds, keeping the topology
+     * @return SAH cost relative to the cost at build time
+     */
+    float refit(const std::function<AABB(const Primitive &)> &primitiveBounds);
+
+    /**
+     * Writes the built BVH to path, under a temporary name first so readers never see a partial file
+     * @param key identifies what was built over, load() only accepts a file with the same key
+     */
+    bool save(const std::string &path, uint64_t key) const;
+
+    /**
+     * Reads a BVH written by save(), which has to be over numPrimitives primitives indexed 0 to numPrimitives - 1
+     * The file is checked to be a valid tree over them, the BVH is left untouched if it is not
+     * @return false if there is no matching file
+     */
+    bool load(const std::string &path, uint64_t key, size_t numPrimitives);
+
+    void clear() {
+        primitives.clear();
+        nodes.clear();
+        wideNodes.clear();
+        cost = 0;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return nodes.empty();
+    }
+
+    [[nodiscard]] AABB bounds() const {
+        if (nodes.empty()) return {};
+        return nodes[0].bbox;
+    }
+
+    /**
+     * Finds the closest primitive along r
+     * @param hitPrimitive bool(int offset, Interval &t), shrinks t.max on a hit
+     */
+    template<typename F>
+    bool closestHit(const Ray &r, Interval &t, F &&hitPrimitive) const;
+
+    /**
+     * Finds any primitive along r
+     * @param hitPrimitive bool(int offset, const Interval &t)
+     */
+    template<typename F>
+    bool anyHit(const Ray &r, const Interval &t, F &&hitPrimitive) const;
+
+    /**
+     * Traces a coherent packet through the binary nodes
+     * Whole nodes are culled with interval arithmetic before lanes are tested individually
+     * @param hitPrimitive uint32_t(int offset, uint32_t lanes), tests lanes against one primitive,
+     *        shrinks packet.tMax for the lanes that hit and returns them
+     * @return lanes that hit anything
+     */
+    template<int N, typename F>
+    uint32_t closestHit(RayPacket<N> &packet, F &&hitPrimitive) const;
+
+    /**
+     * @param hitPrimitive uint32_t(int offset, uint32_t lanes), returns the lanes that are occluded
+     * @return lanes that are occluded
+     */
+    template<int N, typename F>
+    uint32_t anyHit(const RayPacket<N> &packet, F &&hitPrimitive) const;
+};
 
-    HOST void initLeaf(const int first, const int n, const AABB &bounds) {
-        firstPrimOffset = first;
-        numPrimitives = n;
-        bbox = bounds;
-        children[0] = children[1] = nullptr;
+struct PacketStackEntry {
+    int node;
+    uint32_t lanes;
+};
+
+template<int N>
+float packetMaxT(const RayPacket<N> &packet, uint32_t lanes) {
+    float tMax = -INF;
+    for (; lanes; lanes &= lanes - 1) {
+        tMax = jtx::max(tMax, packet.tMax[std::countr_zero(lanes)]);
     }
+    return tMax;
+}
 
-    HOST void initBranch(const int axis, BVHNode *child0, BVHNode *child1) {
-        children[0] = child0;
-        children[1] = child1;
-        bbox = AABB(child0->bbox, child1->bbox);
-        splitAxis = axis;
-        numPrimitives = 0;
+template<int N, typename F>
+uint32_t BVH::closestHit(RayPacket<N> &packet, F &&hitPrimitive) const {
+    if (nodes.empty() || !packet.active) return 0;
+
+    const TraversalPacket<N> tp(packet);
+    float tMin = INF;
+    for (uint32_t lanes = packet.active; lanes; lanes &= lanes - 1) {
+        tMin = jtx::min(tMin, packet.tMin[std::countr_zero(lanes)]);
     }
+    float tMax = packetMaxT(packet, packet.active);
+
+    PacketStackEntry stack[64];
+    int toVisitOffset        = 0;
+    PacketStackEntry current = {0, packet.active};
+    uint32_t hitLanes        = 0;
 
-    HOSTDEV [[nodiscard]] bool isLeaf() const {
-        return children[0] == nullptr && children[1] == nullptr;
+    while (true) {
+        const LinearBVHNode &node = nodes[current.node];
+        // Cheap whole-packet rejection first, then the exact per-lane test
+        uint32_t lanes = 0;
+        if (tp.mayHit(node.bbox, tMin, tMax)) {
+            lanes = tp.hit(node.bbox, packet, current.lanes);
+        }
+
+        if (lanes) {
+            if (node.numPrimitives > 0) {
+                for (int i = 0; i < node.numPrimitives; ++i) {
+                    hitLanes |= hitPrimitive(node.primitivesOffset + i, lanes);
+                }
+                tMax = packetMaxT(packet, packet.active);
+            } else {
+                // Children only need the lanes that reached their parent
+                const int first  = current.node + 1;
+                const int second = node.secondChildOffset;
+                stack[toVisitOffset++] = {tp.dirIsNeg[node.axis] ? first : second, lanes};
+                current                = {tp.dirIsNeg[node.axis] ? second : first, lanes};
+                continue;
+            }
+        }
+
+        if (toVisitOffset == 0) break;
+        current = stack[--toVisitOffset];
     }
 
-    HOSTDEV bool isBranch() const {
-        return !isLeaf();
+    return hitLanes;
+}
+
+template<int N, typename F>
+uint32_t BVH::anyHit(const RayPacket<N> &packet, F &&hitPrimitive) const {
+    if (nodes.empty() || !packet.active) return 0;
+
+    const TraversalPacket<N> tp(packet);
+    float tMin = INF;
+    for (uint32_t lanes = packet.active; lanes; lanes &= lanes - 1) {
+        tMin = jtx::min(tMin, packet.tMin[std::countr_zero(lanes)]);
     }
+    const float tMax = packetMaxT(packet, packet.active);
+
+    PacketStackEntry stack[64];
+    int toVisitOffset        = 0;
+    PacketStackEntry current = {0, packet.active};
+    uint32_t occluded        = 0;
+
+    while (true) {
+        const LinearBVHNode &node = nodes[current.node];
+        // Occluded lanes are done, drop them from the rest of the traversal
+        uint32_t lanes = 0;
+        if (tp.mayHit(node.bbox, tMin, tMax)) {
+            lanes = tp.hit(node.bbox, packet, current.lanes & ~occluded);
+        }
+
+        if (lanes) {
+            if (node.numPrimitives > 0) {
+                for (int i = 0; i < node.numPrimitives && lanes; ++i) {
+                    const uint32_t hit = hitPrimitive(node.primitivesOffset + i, lanes);
+                    occluded |= hit;
+                    lanes &= ~hit;
+                }
+                if (occluded == packet.active) break;
+            } else {
+                const int first  = current.node + 1;
+                const int second = node.secondChildOffset;
+                stack[toVisitOffset++] = {tp.dirIsNeg[node.axis] ? first : second, lanes};
+                current                = {tp.dirIsNeg[node.axis] ? second : first, lanes};
+                continue;
+            }
+        }
+
+        if (toVisitOffset == 0) break;
+        current = stack[--toVisitOffset];
+    }
+
+    return occluded;
+}
+
+#if BVH_WIDTH == 2
+template<typename F>
+bool BVH::closestHit(const Ray &r, Interval &t, F &&hitPrimitive) const {
+    if (nodes.empty()) return false;
+
+    const TraversalRay ray(r);
+
+    int toVisitOffset    = 0;
+    int currentNodeIndex = 0;
+    int stack[64];
+    bool hitAnything = false;
+
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        // 1. Check the ray intersects the current node
+        //    If it doesn't, pop the stack and continue
+        if (node->bbox.hit(ray, t)) {
+            // 2. If we are at a leaf node, loop through all primitives
+            //    Otherwise, push the children onto the stack
+            if (node->numPrimitives > 0) {
+                // Leaf node
+                for (int i = 0; i < node->numPrimitives; ++i) {
+                    if (hitPrimitive(node->primitivesOffset + i, t)) {
+                        hitAnything = true;
+                    }
+                }
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = stack[--toVisitOffset];
+            } else {
+                // Interior node
+                if (ray.dirIsNeg[node->axis]) {
+                    stack[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex       = node->secondChildOffset;
+                } else {
+                    stack[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex       = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = stack[--toVisitOffset];
+        }
+    }
+
+    return hitAnything;
+}
 
-    HOST void destroy() const {
-        if (isBranch()) {
-            children[0]->destroy();
-            children[1]->destroy();
+template<typename F>
+bool BVH::anyHit(const Ray &r, const Interval &t, F &&hitPrimitive) const {
+    if (nodes.empty()) return false;
 
-            delete children[0];
-            delete children[1];
+    const TraversalRay ray(r);
+
+    int toVisitOffset    = 0;
+    int currentNodeIndex = 0;
+    int stack[64];
+
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        if (node->bbox.hit(ray, t)) {
+            if (node->numPrimitives > 0) {
+                for (int i = 0; i < node->numPrimitives; ++i) {
+                    if (hitPrimitive(node->primitivesOffset + i, t)) {
+                        return true;
+                    }
+                }
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = stack[--toVisitOffset];
+            } else {
+                // Interior node
+                if (ray.dirIsNeg[node->axis]) {
+                    stack[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex       = node->secondChildOffset;
+                } else {
+                    stack[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex       = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = stack[--toVisitOffset];
         }
     }
+
+    return false;
+}
+#else
+// Each popped node pushes at most BVH_WIDTH - 1 more entries than it removes
+static constexpr int WIDE_STACK_SIZE = 64 * BVH_WIDTH;
+
+struct WideStackEntry {
+    int offset;
+    int numPrimitives;
+    float tNear;
 };
 
-BVHNode *buildTree(std::span<Primitive> bvhPrimitives, int *totalNodes, int *orderedPrimitiveOffset, std::vector<Primitive> &orderedPrimitives, int maxPrimsInNode);
+template<typename F>
+bool BVH::closestHit(const Ray &r, Interval &t, F &&hitPrimitive) const {
+    if (wideNodes.empty()) return false;
+
+    const TraversalRay ray(r);
+
+    WideStackEntry stack[WIDE_STACK_SIZE];
+    int toVisitOffset      = 0;
+    stack[toVisitOffset++] = {0, 0, t.min};
+    bool hitAnything       = false;
+
+    while (toVisitOffset > 0) {
+        const WideStackEntry entry = stack[--toVisitOffset];
+        // Skip anything that starts behind the closest hit found so far
+        if (entry.tNear > t.max) continue;
+
+        if (entry.numPrimitives > 0) {
+            // Leaf
+            for (int i = 0; i < entry.numPrimitives; ++i) {
+                if (hitPrimitive(entry.offset + i, t)) {
+                    hitAnything = true;
+                }
+            }
+            continue;
+        }
+
+        // Interior node: test all children at once, then push them far to near
+        const WBVHNode &node = wideNodes[entry.offset];
+        float tNear[BVH_WIDTH];
+        auto mask = static_cast<unsigned>(hitChildren(node, ray, t.min, t.max, tNear));
+
+        const int first = toVisitOffset;
+        while (mask) {
+            const int i = std::countr_zero(mask);
+            mask &= mask - 1;
+
+            const WideStackEntry child{node.offset[i], node.numPrimitives[i], tNear[i]};
+            int j = toVisitOffset++;
+            while (j > first && stack[j - 1].tNear < child.tNear) {
+                stack[j] = stack[j - 1];
+                --j;
+            }
+            stack[j] = child;
+        }
+    }
+
+    return hitAnything;
+}
+
+template<typename F>
+bool BVH::anyHit(const Ray &r, const Interval &t, F &&hitPrimitive) const {
+    if (wideNodes.empty()) return false;
+
+    const TraversalRay ray(r);
+
+    WideStackEntry stack[WIDE_STACK_SIZE];
+    int toVisitOffset      = 0;
+    stack[toVisitOffset++] = {0, 0, t.min};
+
+    while (toVisitOffset > 0) {
+        const WideStackEntry entry = stack[--toVisitOffset];
+
+        if (entry.numPrimitives > 0) {
+            for (int i = 0; i < entry.numPrimitives; ++i) {
+                if (hitPrimitive(entry.offset + i, t)) {
+                    return true;
+                }
+            }
+            continue;
+        }
+
+        // Any hit terminates, so child order does not matter here
+        const WBVHNode &node = wideNodes[entry.offset];
+        float tNear[BVH_WIDTH];
+        auto mask = static_cast<unsigned>(hitChildren(node, ray, t.min, t.max, tNear));
+        while (mask) {
+            const int i = std::countr_zero(mask);
+            mask &= mask - 1;
+            stack[toVisitOffset++] = {node.offset[i], node.numPrimitives[i], tNear[i]};
+        }
+    }
 
-int flattenBVH(const BVHNode *node, LinearBVHNode *nodes, int *offset);
+    return false;
+}
+#endif
@@ -1,9 +1,26 @@
 #include "camera.hpp"
 #include "bvh.hpp"
 #include "integrator.hpp"
+#include "util/threadpool.hpp"
+#include "wavefront.hpp"
 
-#include <barrier>
-#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// Primary rays are traced in square packets of PACKET_DIM x PACKET_DIM pixels
+static constexpr int PACKET_DIM  = 4;
+static constexpr int PACKET_SIZE = PACKET_DIM * PACKET_DIM;
+static constexpr int TILE_SIZE   = 32;
+
+// Tiles go back to the deques after this many samples, so every tile makes progress during the render
+static constexpr int TILE_SAMPLES_PER_TASK = 4;
+
+// Adaptive sampling only trusts variance estimates from at least this many samples
+static constexpr int ADAPTIVE_MIN_SAMPLES = 16;
+// Pixels darker than this are held to an absolute error, a relative one would never converge
+static constexpr float ADAPTIVE_LUMINANCE_FLOOR = 0.05f;
 
 struct RayTraceJob {
     uint32_t startRow;
@@ -13,105 +30,309 @@ struct RayTraceJob {
 
     const Scene *scene;
     RGB8Image *img;
+
+    // Samples accumulated so far, pixels of the tile are always normalized by this count
+    int samples;
+};
+
+// Run of consecutive samples of one tile
+// The next run is queued once this one finishes, so a tile is never rendered by two threads at once
+struct TileTask {
+    uint32_t job;
+    int endSample;
+};
+
+// Each render thread owns a deque, it takes tasks from the front and others steal from the back
+struct TileDeque {
+    std::mutex mutex;
+    std::deque<TileTask> tasks;
+
+    void push(const TileTask &task) {
+        std::lock_guard lock(mutex);
+        tasks.push_back(task);
+    }
+
+    bool pop(TileTask &task) {
+        std::lock_guard lock(mutex);
+        if (tasks.empty()) return false;
+        task = tasks.front();
+        tasks.pop_front();
+        return true;
+    }
+
+    bool steal(TileTask &task) {
+        std::lock_guard lock(mutex);
+        if (tasks.empty()) return false;
+        task = tasks.back();
+        tasks.pop_back();
+        return true;
+    }
 };
+
 // i really like mich <3
 struct WorkQueue {
     std::vector<RayTraceJob> jobs;
+    std::vector<TileDeque> deques;
 
     std::atomic<uint64_t> totalBounces;
-    std::atomic<uint64_t> nextJobIndex;
+    std::atomic<uint64_t> completedSamples;
+    std::atomic<int> remainingJobs;
+
+    // Tasks sitting in the deques, threads that find none sleep on tileQueued until a tile is requeued or the frame ends
+    std::atomic<int> queuedTiles;
+    std::mutex waitMutex;
+    std::condition_variable tileQueued;
+
+    void requeue(TileDeque &deque, const TileTask &task) {
+        deque.push(task);
+        queuedTiles.fetch_add(1, std::memory_order_release);
+        notify(false);
+    }
+
+    void notify(const bool all) {
+        // Taking the lock orders the notification after a waiter's last check, so it cannot be missed
+        { std::lock_guard lock(waitMutex); }
+        if (all) tileQueued.notify_all();
+        else tileQueued.notify_one();
+    }
 };
 
 void Camera::render(const Scene &scene) {
+    using Clock = std::chrono::steady_clock;
+    const auto renderStart = Clock::now();
+
     // Need to re-initialize everytime to reflect changes via UI
     init();
     stopRender_ = false;
     acc_.clear();
 
+#ifdef ENABLE_MULTI_THREADING
+    // One task per thread that can run it, each works through its own deque of tiles
+    // The UI calls render from a pool worker, that worker only helps in group.wait() and is not counted twice
+    const int threadCount = ThreadPool::global().availableConcurrency();
+#else
+    const int threadCount = 1;
+#endif
+
+    const int spp = xPixelSamples_ * yPixelSamples_;
+
     // Setup work queue and work orders
-    // We will create 32x32 tiles for each thread to work on
+    // We will create TILE_SIZE x TILE_SIZE tiles, dealt round-robin to the threads' deques
     WorkQueue queue{};
-    queue.totalBounces = 0;
-    queue.nextJobIndex = 0;
-    for (int r = 0; r < height_; r += 32) {
-        for (int c = 0; c < width_; c += 32) {
+    queue.deques           = std::vector<TileDeque>(threadCount);
+    queue.totalBounces     = 0;
+    queue.completedSamples = 0;
+    for (int r = 0; r < height_; r += TILE_SIZE) {
+        for (int c = 0; c < width_; c += TILE_SIZE) {
             RayTraceJob job{};
             job.scene    = &scene;
             job.img      = &img_;
             job.startRow = r;
             job.startCol = c;
-            job.endRow   = std::min(r + 32, height_);
-            job.endCol   = std::min(c + 32, width_);
+            job.endRow   = std::min(r + TILE_SIZE, height_);
+            job.endCol   = std::min(c + TILE_SIZE, width_);
+            job.samples  = 0;
+
+            const auto jobIndex = static_cast<uint32_t>(queue.jobs.size());
             queue.jobs.push_back(job);
+            queue.deques[jobIndex % threadCount].push({jobIndex, std::min(TILE_SAMPLES_PER_TASK, spp)});
         }
     }
+    const int numJobs   = static_cast<int>(queue.jobs.size());
+    queue.remainingJobs = spp > 0 ? numJobs : 0;
+    queue.queuedTiles   = numJobs;
 
-#ifdef ENABLE_MULTI_THREADING
-    // Set up threads
-    unsigned int threadCount = std::thread::hardware_concurrency();
-    if (threadCount == 0) threadCount = 4;
-#else
-    unsigned int threadCount = 1;
-#endif
+    // Per-task state, reused across tiles and samples
+    struct RenderSlot {
+        WavefrontIntegrator wavefront;
+        std::vector<Vec2i> pixels;
+    };
+    std::vector<RenderSlot> slots(threadCount, {WavefrontIntegrator(integrator_ == IntegratorType::WAVEFRONT ? TILE_SIZE * TILE_SIZE : 0), {}});
 
-    // reset the current sample to 0
-    currentSample_.store(0);
+    const auto accumulate = [this](Color sampleColor, const int row, const int col, const int sample) {
+        // Clamp the color
+        if (sampleColor[0] > 1.0f) sampleColor[0] = 1.0f;
+        if (sampleColor[1] > 1.0f) sampleColor[1] = 1.0f;
+        if (sampleColor[2] > 1.0f) sampleColor[2] = 1.0f;
 
-    std::barrier endBarrier(threadCount, [&]() noexcept {
-        currentSample_.fetch_add(1);
-        queue.nextJobIndex = 0;
-    });
+        auto currAcc = acc_.updatePixel(sampleColor, row, col);
+        img_.setPixel(currAcc / static_cast<float>(sample + 1), row, col);
+    };
 
-    std::vector<std::thread> threads;
-    threads.reserve(threadCount);
+    // Renders one sample of a tile
+    // @return summed path lengths
+    const Sampler pixelSampler(samplerType_, xPixelSamples_, yPixelSamples_, width_, height_);
 
-    const int spp = xPixelSamples_ * yPixelSamples_;
+    const auto renderTile = [this, &accumulate, &pixelSampler](RenderSlot &slot, const RayTraceJob &job, const int sample) -> uint64_t {
+        auto &[wavefront, pixels] = slot;
+        uint64_t numBounces       = 0;
 
-    for (unsigned int t = 0; t < threadCount; ++t) {
-        threads.emplace_back([this, &queue, &endBarrier, &spp] {
-            while (true) {
-                const int sample = currentSample_.load();
-                if (sample >= spp || stopRender_) { break; }
+        if (integrator_ == IntegratorType::WAVEFRONT) {
+            wavefront.clear();
+            pixels.clear();
 
-                int numRays = 0;
-                while (true) {
-                    const auto jobIndex = queue.nextJobIndex.fetch_add(1, std::memory_order_relaxed);
-                    if (jobIndex >= queue.jobs.size()) { break; }
+            // Queue camera rays block by block, so each packet of primary rays covers a square of pixels
+            for (int blockRow = job.startRow; blockRow < job.endRow; blockRow += PACKET_DIM) {
+                for (int blockCol = job.startCol; blockCol < job.endCol; blockCol += PACKET_DIM) {
+                    for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+                        const int row = blockRow + lane / PACKET_DIM;
+                        const int col = blockCol + lane % PACKET_DIM;
+                        if (row >= job.endRow || col >= job.endCol) continue;
 
-                    const auto &job = queue.jobs[jobIndex];
+                        Sampler sampler = pixelSampler;
+                        sampler.startPixelSample({col, row}, sample);
+                        const RayDifferential ray = getRay(col, row, sampler);
+                        wavefront.addPath(ray, sampler);
+                        pixels.emplace_back(col, row);
+                    }
+                }
+            }
 
-                    for (int row = job.startRow; row < job.endRow; ++row) {
-                        for (int col = job.startCol; col < job.endCol; ++col) {
-                            if (stopRender_) break;
-                            // Seeds with FNV1-a
-                            // PCG via RXS-M-XS
-                            RNG sampler(row, col, sample + 1);
+            wavefront.trace(*job.scene, maxDepth_, rrDepth_);
+            numBounces += wavefront.numBounces();
 
-                            const Ray r = getRay(col, row, sample, sampler);
+            for (int path = 0; path < wavefront.numPaths(); ++path) {
+                accumulate(wavefront.radiance(path), pixels[path].y, pixels[path].x, sample);
+            }
+            return numBounces;
+        }
 
-                            Color sampleColor = integrateBasic(r, *job.scene, maxDepth_, sampler);
-                             // Color sampleColor = integrate(r, *job.scene, maxDepth_, sampler);
+        for (int blockRow = job.startRow; blockRow < job.endRow; blockRow += PACKET_DIM) {
+            for (int blockCol = job.startCol; blockCol < job.endCol; blockCol += PACKET_DIM) {
+                if (stopRender_) break;
 
-                            // Clamp the color
-                            if (sampleColor[0] > 1.0f) sampleColor[0] = 1.0f;
-                            if (sampleColor[1] > 1.0f) sampleColor[1] = 1.0f;
-                            if (sampleColor[2] > 1.0f) sampleColor[2] = 1.0f;
+                // Generate the block's camera rays, lanes past the tile edge stay inactive
+                Sampler samplers[PACKET_SIZE];
+                RayDifferential rays[PACKET_SIZE];
+                RayPacket<PACKET_SIZE> packet;
+                for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+                    const int row = blockRow + lane / PACKET_DIM;
+                    const int col = blockCol + lane % PACKET_DIM;
+                    if (row >= job.endRow || col >= job.endCol) continue;
 
-                            auto currAcc = acc_.updatePixel(sampleColor, row, col);
-                            auto px      = currAcc / static_cast<float>(sample + 1);
-                            img_.setPixel(currAcc / static_cast<float>(sample + 1), row, col);
-                        }
+                    samplers[lane] = pixelSampler;
+                    samplers[lane].startPixelSample({col, row}, sample);
+                    rays[lane] = getRay(col, row, samplers[lane]);
+                    packet.set(lane, rays[lane], Interval(0.001, INF));
+                }
+
+                Intersection records[PACKET_SIZE];
+                const uint32_t hits = job.scene->closestHit(packet, records);
+
+                for (uint32_t lanes = packet.active; lanes; lanes &= lanes - 1) {
+                    const int lane = std::countr_zero(lanes);
+                    const int row  = blockRow + lane / PACKET_DIM;
+                    const int col  = blockCol + lane % PACKET_DIM;
+
+                    const PrimaryHit primary{static_cast<bool>(hits >> lane & 1), records[lane]};
+                    Color sampleColor;
+                    int pathLength = 0;
+                    switch (integrator_) {
+                        case IntegratorType::PATH:
+                            sampleColor = integrate(rays[lane], *job.scene, maxDepth_, rrDepth_, samplers[lane], &primary, &pathLength);
+                            break;
+                        case IntegratorType::MIS:
+                            sampleColor = integrateMIS(rays[lane], *job.scene, maxDepth_, rrDepth_, false, samplers[lane], &primary, &pathLength);
+                            break;
+                        default:
+                            sampleColor = integrateBasic(rays[lane], *job.scene, maxDepth_, rrDepth_, samplers[lane], &primary, &pathLength);
+                            break;
                     }
+                    numBounces += pathLength;
+
+                    accumulate(sampleColor, row, col, sample);
+                }
+            }
+        }
+
+        return numBounces;
+    };
+
+    // Mean relative error of the tile's pixels, compared against adaptiveError_ every time the tile is requeued
+    const auto tileConverged = [this](const RayTraceJob &job) {
+        if (adaptiveError_ <= 0 || job.samples < ADAPTIVE_MIN_SAMPLES) return false;
+
+        float error = 0;
+        for (int row = job.startRow; row < job.endRow; ++row) {
+            for (int col = job.startCol; col < job.endCol; ++col) {
+                error += acc_.relativeError(row, col, job.samples, ADAPTIVE_LUMINANCE_FLOOR);
+            }
+        }
+        const auto numPixels = static_cast<float>((job.endRow - job.startRow) * (job.endCol - job.startCol));
+        return error / numPixels < adaptiveError_;
+    };
+
+    // reset the current sample to 0
+    currentSample_.store(0);
+
+    std::vector<double> idleMs(threadCount, 0.0);
+
+    TaskGroup group;
+    for (int t = 0; t < threadCount; ++t) {
+        group.run([&, t] {
+            TileDeque &own = queue.deques[t];
+            Clock::duration idle{};
+
+            while (!stopRender_ && queue.remainingJobs.load(std::memory_order_acquire) > 0) {
+                TileTask task;
+                bool found = own.pop(task);
+                for (int i = 1; i < threadCount && !found; ++i) {
+                    found = queue.deques[(t + i) % threadCount].steal(task);
+                }
+
+                if (!found) {
+                    // Every tile left is being rendered by another thread, sleep until one is requeued
+                    const auto idleStart = Clock::now();
+                    std::unique_lock lock(queue.waitMutex);
+                    queue.tileQueued.wait(lock, [&] {
+                        return stopRender_ || queue.queuedTiles.load(std::memory_order_acquire) > 0 ||
+                               queue.remainingJobs.load(std::memory_order_acquire) == 0;
+                    });
+                    idle += Clock::now() - idleStart;
+                    continue;
                 }
-                queue.totalBounces.fetch_add(numRays, std::memory_order_relaxed);
-                endBarrier.arrive_and_wait();
+                queue.queuedTiles.fetch_sub(1, std::memory_order_relaxed);
+
+                RayTraceJob &job = queue.jobs[task.job];
+                uint64_t numBounces = 0;
+                for (; job.samples < task.endSample && !stopRender_; ++job.samples) {
+                    numBounces += renderTile(slots[t], job, job.samples);
+
+                    // Progress counts whole passes over the image
+                    const uint64_t completed = queue.completedSamples.fetch_add(1, std::memory_order_relaxed) + 1;
+                    currentSample_.store(static_cast<int>(completed / numJobs), std::memory_order_relaxed);
+                }
+                queue.totalBounces.fetch_add(numBounces, std::memory_order_relaxed);
+
+                if (job.samples < spp && !tileConverged(job)) {
+                    queue.requeue(own, {task.job, std::min(job.samples + TILE_SAMPLES_PER_TASK, spp)});
+                    continue;
+                }
+
+                // Samples skipped by a converged tile still count towards progress
+                if (job.samples < spp) {
+                    const uint64_t completed = queue.completedSamples.fetch_add(spp - job.samples, std::memory_order_relaxed) + spp - job.samples;
+                    currentSample_.store(static_cast<int>(completed / numJobs), std::memory_order_relaxed);
+                }
+                if (queue.remainingJobs.fetch_sub(1, std::memory_order_release) == 1) queue.notify(true);
             }
+
+            // A stopped render ends with tiles still queued, wake the sleepers so they see stopRender_
+            if (stopRender_) queue.notify(true);
+            idleMs[t] = std::chrono::duration<double, std::milli>(idle).count();
         });
     }
+    group.wait();
 
-    for (auto &thread: threads) {
-        thread.join();
+    uint64_t numSamples = 0;
+    for (const auto &job: queue.jobs) {
+        numSamples += static_cast<uint64_t>(job.samples) * (job.endRow - job.startRow) * (job.endCol - job.startCol);
     }
+
+    renderStats_.renderMs          = std::chrono::duration<double, std::milli>(Clock::now() - renderStart).count();
+    renderStats_.averageSpp        = static_cast<double>(numSamples) / (static_cast<double>(width_) * height_);
+    renderStats_.averagePathLength = numSamples ? static_cast<double>(queue.totalBounces) / static_cast<double>(numSamples) : 0;
+    renderStats_.threadIdleMs      = std::move(idleMs);
 }
 
 void Camera::init() {
@@ -1,11 +1,25 @@
 #pragma once
 
 #include "image.hpp"
+#include "integrator.hpp"
+#include "sampling.hpp"
 #include "util/rand.hpp"
 #include <atomic>
 #include <thread>
+#include <vector>
 #include "scene.hpp"
 
+/**
+ * Timings of the last call to Camera::render
+ */
+struct RenderStats {
+    double renderMs          = 0;
+    double averageSpp        = 0;
+    double averagePathLength = 0;
+    // Time each render thread spent waiting for a tile, shows how well the scheduler balances the load
+    std::vector<double> threadIdleMs;
+};
+
 // Update this to use PBRTv4 Camera
 class Camera {
 public:
@@ -15,6 +29,13 @@ public:
     int xPixelSamples_;
     int yPixelSamples_;
     int maxDepth_;
+    // Paths are subject to russian roulette after this many bounces
+    int rrDepth_ = 3;
+    IntegratorType integrator_ = IntegratorType::BASIC;
+    Sampler::Type samplerType_ = Sampler::ZSOBOL;
+    // Target relative error for adaptive sampling, tiles below it stop before getSpp() samples
+    // 0 disables adaptive sampling
+    float adaptiveError_ = 0.0f;
 
     RGB8Image img_;
 
@@ -67,6 +88,10 @@ public:
         return xPixelSamples_ * yPixelSamples_;
     }
 
+    [[nodiscard]] const RenderStats &renderStats() const {
+        return renderStats_;
+    }
+
 private:
     Vec3 vp00_;
     Vec3 du_;
@@ -77,6 +102,8 @@ private:
 
     bool stopRender_ = false;
 
+    RenderStats renderStats_;
+
     // Similar to img, but stores floats
     // Accumulate here, then divide by sample # for img_
     AccumulationBuffer acc_;
@@ -86,23 +113,26 @@ private:
      */
     void init();
 
-    [[nodiscard]] Ray getRay(const int i, const int j, const int stratum, RNG &rng) const {
-        // Find stratum of pixel (j, i)
-        const int x = stratum % xPixelSamples_;
-        const int y = stratum / xPixelSamples_;
-
-        const float dx = rng.sample<float>();
-        const float dy = rng.sample<float>();
-
-        const auto offset = Vec2f((x + dx) / xPixelSamples_, (y + dy) / yPixelSamples_);
+    [[nodiscard]] RayDifferential getRay(const int i, const int j, Sampler &sampler) const {
+        // Stratification within the pixel is up to the sampler
+        const auto offset = sampler.getPixel2D();
         const auto sample = vp00_ + (i + offset.x) * du_ + (j + offset.y) * dv_;
 
-        auto origin = (properties_.defocusAngle <= 0) ? properties_.center : sampleDefocusDisc(rng);
-        return {origin, sample - origin, rng.sample<float>()};
+        auto origin = (properties_.defocusAngle <= 0) ? properties_.center : sampleDefocusDisc(sampler.get2D());
+        RayDifferential ray = Ray(origin, sample - origin, sampler.get1D());
+
+        // Offset rays go through the neighbouring pixels from the same lens position
+        ray.rxOrigin         = ray.ryOrigin = origin;
+        ray.rxDirection      = sample + du_ - origin;
+        ray.ryDirection      = sample + dv_ - origin;
+        ray.hasDifferentials = true;
+        // Samples are closer together than pixels, PBRT's estimate of their spacing
+        ray.scaleDifferentials(jtx::max(0.125f, 1 / jtx::sqrt(static_cast<float>(getSpp()))));
+        return ray;
     }
 
-    [[nodiscard]] Vec3 sampleDefocusDisc(RNG &rng) const {
-        Vec3 p = rng.sampleUnitDisc();
+    [[nodiscard]] Vec3 sampleDefocusDisc(const Vec2f &u) const {
+        const Vec2f p = sampleUniformDiskConcentric(u);
         return properties_.center + (p.x * defocus_u_) + (p.y * defocus_v_);
     }
 };
\ No newline at end of file
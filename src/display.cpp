@@ -2,6 +2,7 @@
 
 #include "bvh.hpp"
 #include "camera.hpp"
+#include "util/threadpool.hpp"
 
 #include <SDL.h>
 #include <future>
@@ -10,6 +11,9 @@
 #include <imgui_impl_sdl2.h>
 #include <iostream>
 
+// Refit BVHs are rebuilt once their SAH cost grows past this ratio
+constexpr float MAX_REFIT_COST_RATIO = 1.5f;
+
 const auto VERTEX_SOURCE = R"(
         #version 330 core
         layout(location = 0) in vec2 aPos;
@@ -325,6 +329,77 @@ void Display::renderConfig() {
             fullWidth();
             ImGui::InputInt("##MaxDepth", &camera_->maxDepth_, 0);
 
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            rightAlignText("RR Depth");
+            ImGui::TableSetColumnIndex(1);
+            fullWidth();
+            ImGui::InputInt("##RRDepth", &camera_->rrDepth_, 0);
+
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            rightAlignText("Integrator");
+            ImGui::TableSetColumnIndex(1);
+            fullWidth();
+            const char *integratorTypes[] = {"BASIC", "PATH", "MIS", "WAVEFRONT"};
+            int currentIntegrator         = static_cast<int>(camera_->integrator_);
+            if (ImGui::Combo("##Integrator", &currentIntegrator, integratorTypes, IM_ARRAYSIZE(integratorTypes))) {
+                camera_->integrator_ = static_cast<IntegratorType>(currentIntegrator);
+            }
+
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            rightAlignText("Sampler");
+            ImGui::TableSetColumnIndex(1);
+            fullWidth();
+            const char *samplerTypes[] = {"INDEPENDENT", "STRATIFIED", "SOBOL", "ZSOBOL"};
+            int currentSampler         = camera_->samplerType_;
+            if (ImGui::Combo("##Sampler", &currentSampler, samplerTypes, IM_ARRAYSIZE(samplerTypes))) {
+                camera_->samplerType_ = static_cast<Sampler::Type>(currentSampler);
+            }
+
+            // Interactive renders rebuild the BVH with the LBVH builder, final renders use SAH
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            rightAlignText("Interactive");
+            ImGui::TableSetColumnIndex(1);
+            ImGui::Checkbox("##Interactive", &interactiveMode_);
+
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            rightAlignText("Adaptive Error");
+            ImGui::TableSetColumnIndex(1);
+            fullWidth();
+            ImGui::InputFloat("##AdaptiveError", &camera_->adaptiveError_, 0.0f, 0.0f, "%.3f");
+
+            // Stats are written at the end of a render, only read them in between
+            if (!isRendering_ && !camera_->renderStats().threadIdleMs.empty()) {
+                const auto &stats = camera_->renderStats();
+                double idleMs     = 0;
+                for (const double ms: stats.threadIdleMs) idleMs += ms;
+
+                ImGui::TableNextRow();
+                ImGui::TableSetColumnIndex(0);
+                rightAlignText("Last Render");
+                ImGui::TableSetColumnIndex(1);
+                ImGui::Text("%.0f ms, %.1f spp, %.1f ms idle/thread", stats.renderMs, stats.averageSpp, idleMs / static_cast<double>(stats.threadIdleMs.size()));
+
+                ImGui::TableNextRow();
+                ImGui::TableSetColumnIndex(0);
+                rightAlignText("Path Length");
+                ImGui::TableSetColumnIndex(1);
+                ImGui::Text("%.2f", stats.averagePathLength);
+
+                if (scene_ && scene_->textureCache()) {
+                    const TextureCacheStats cacheStats = scene_->textureCache()->stats();
+                    ImGui::TableNextRow();
+                    ImGui::TableSetColumnIndex(0);
+                    rightAlignText("Texture Cache");
+                    ImGui::TableSetColumnIndex(1);
+                    ImGui::Text("%.1f%% hits, %.1f MB", 100 * cacheStats.hitRate(), static_cast<double>(cacheStats.bytesResident) / (1 << 20));
+                }
+            }
+
             ImGui::EndTable();
         }
     }
@@ -555,7 +630,7 @@ void Display::renderSceneEditor() {
                 auto &mesh = scene_->meshes[selectedMeshIndex];
                 mesh.translate = Transform::translate(translation);
                 mesh.recalculateTransform();
-                rebuildBVH_ = true;
+                refitBVH_ = true;
             }
 
             tableRow("Rotation X");
@@ -577,6 +652,7 @@ void Display::renderSceneEditor() {
                 mesh.rY = Transform::rotateY(rotation[1]);
                 mesh.rZ = Transform::rotateZ(rotation[2]);
                 mesh.recalculateTransform();
+                refitBVH_ = true;
             }
 
             tableRow("Scale X");
@@ -596,7 +672,7 @@ void Display::renderSceneEditor() {
                 auto &mesh = scene_->meshes[selectedMeshIndex];
                 mesh.scale = Transform::scale(scale);
                 mesh.recalculateTransform();
-                rebuildBVH_ = true;
+                refitBVH_ = true;
             }
 
             ImGui::EndTable();
@@ -802,14 +878,23 @@ void Display::renderScene() {
     if (isRendering_) return;
 
     isRendering_ = true;
-    if (rebuildBVH_) {
-        scene_->rebuildBVH();
-        rebuildBVH_ = false;
+    const auto buildMethod = interactiveMode_ ? BVHBuildMethod::LBVH : BVHBuildMethod::SAH;
+    if (rebuildBVH_ || scene_->bvhBuildMethod() != buildMethod) {
+        scene_->rebuildBVH(buildMethod);
+    } else if (refitBVH_) {
+        // Refitting keeps the old topology, rebuild once it has degraded too far
+        // Mesh BLASes live in object space, so only the TLAS ever needs it
+        if (scene_->refitBVH() > MAX_REFIT_COST_RATIO) {
+            scene_->rebuildTLAS();
+        }
     }
-    std::thread([this]() {
+    rebuildBVH_ = false;
+    refitBVH_   = false;
+    // Runs on the shared pool, so the UI thread never waits on the render
+    ThreadPool::global().submit([this] {
         camera_->render(*scene_);
         isRendering_ = false;
-    }).detach();
+    });
 }
 
 void Display::updateScale() {
@@ -54,6 +54,7 @@ private:
 
     Scene *scene_;
     bool rebuildBVH_ = false;
+    bool refitBVH_ = false;
 
     SDL_Window *window_;
     SDL_GLContext glContext_;
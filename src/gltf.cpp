@@ -0,0 +1,550 @@
+#include "gltf.hpp"
+#include "util/threadpool.hpp"
+
+// stb_image is compiled in image.cpp, images are decoded by TextureImage when the scene adds the asset
+#define TINYGLTF_IMPLEMENTATION
+#define TINYGLTF_NO_STB_IMAGE
+#define TINYGLTF_NO_STB_IMAGE_WRITE
+#define TINYGLTF_NO_EXTERNAL_IMAGE
+#include "tiny_gltf.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <iostream>
+
+// Vertices or triangles converted per task
+static constexpr size_t IMPORT_CHUNK = 1 << 16;
+
+namespace {
+// A parsed file and the bytes of each of its buffers
+struct GLTFFile {
+    tinygltf::Model model;
+    // Binary files stay mapped, their first buffer is the BIN chunk of the mapping
+    std::unique_ptr<MappedFile> mapping;
+    std::vector<std::span<uint8_t>> buffers;
+};
+
+// Elements of an accessor, all within their buffer
+struct AccessorView {
+    uint8_t *data     = nullptr;
+    size_t stride     = 0;
+    size_t count      = 0;
+    int componentType = 0;
+    int componentSize = 0;
+    int components    = 0;
+    bool normalized   = false;
+};
+
+// Mesh of a triangle primitive, before the asset takes it in
+struct PrimitiveMesh {
+    int gltfMesh;
+    int material;
+    Mesh mesh;
+    bool generateNormals;
+};
+}
+
+static std::string extensionOf(const std::string &path) {
+    const size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos) return "";
+    std::string ext = path.substr(dot + 1);
+    std::ranges::transform(ext, ext.begin(), [](const unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return ext;
+}
+
+bool isGLTF(const std::string &path) {
+    const std::string ext = extensionOf(path);
+    return ext == "gltf" || ext == "glb";
+}
+
+// Images are decoded when the scene adds the asset, only the bytes of data URIs are kept as tinygltf frees them
+static bool keepImageBytes(tinygltf::Image *image, int, std::string *, std::string *, int, int,
+                           const unsigned char *bytes, const int size, void *) {
+    if (image->bufferView < 0) image->image.assign(bytes, bytes + size);
+    return true;
+}
+
+static bool loadFile(const std::string &path, GLTFFile &file) {
+    tinygltf::TinyGLTF loader;
+    loader.SetImageLoader(keepImageBytes, nullptr);
+
+    std::string err, warn;
+    bool loaded;
+    const bool binary = extensionOf(path) == "glb";
+    if (binary) {
+        file.mapping = MappedFile::open(path);
+        if (!file.mapping || file.mapping->size() > UINT_MAX) {
+            std::cerr << "Failed to open glTF file: " << path << std::endl;
+            return false;
+        }
+        const size_t lastSlash = path.find_last_of("/\\");
+        loaded = loader.LoadBinaryFromMemory(&file.model, &err, &warn, file.mapping->data(), static_cast<unsigned>(file.mapping->size()),
+                                             lastSlash == std::string::npos ? "" : path.substr(0, lastSlash + 1));
+    } else {
+        loaded = loader.LoadASCIIFromFile(&file.model, &err, &warn, path);
+    }
+    if (!warn.empty()) std::cerr << "glTF warning: " << warn << std::endl;
+    if (!loaded) {
+        std::cerr << "glTF error: " << err << std::endl;
+        return false;
+    }
+
+    for (tinygltf::Buffer &buffer: file.model.buffers) file.buffers.emplace_back(buffer.data);
+
+    // tinygltf copies the BIN chunk into the first buffer, the meshes point into the mapping instead and the copy is dropped
+    // Layout: 12 byte header, then chunks of a 32 bit length, a 32 bit type and the data, JSON first
+    const uint8_t *glb = file.mapping ? file.mapping->data() : nullptr;
+    const size_t size  = file.mapping ? file.mapping->size() : 0;
+    if (binary && !file.model.buffers.empty() && file.model.buffers[0].uri.empty() && size >= 20) {
+        uint32_t jsonLength, binLength;
+        std::memcpy(&jsonLength, glb + 12, sizeof(uint32_t));
+        const size_t binChunk = 20 + static_cast<size_t>(jsonLength);
+        if (binChunk + 8 <= size) {
+            std::memcpy(&binLength, glb + binChunk, sizeof(uint32_t));
+            file.buffers[0] = {file.mapping->data() + binChunk + 8, std::min<size_t>(binLength, size - binChunk - 8)};
+            std::vector<unsigned char>().swap(file.model.buffers[0].data);
+        }
+    }
+    return true;
+}
+
+static bool accessorView(const GLTFFile &file, const int index, AccessorView &view) {
+    const tinygltf::Model &model = file.model;
+    if (index < 0 || index >= static_cast<int>(model.accessors.size())) return false;
+    const tinygltf::Accessor &accessor = model.accessors[index];
+
+    // Sparse accessors and accessors without a buffer view would have to be assembled first
+    if (accessor.sparse.isSparse || accessor.bufferView < 0 || accessor.bufferView >= static_cast<int>(model.bufferViews.size())) return false;
+    const tinygltf::BufferView &bufferView = model.bufferViews[accessor.bufferView];
+    if (bufferView.buffer < 0 || bufferView.buffer >= static_cast<int>(file.buffers.size())) return false;
+
+    const int stride        = accessor.ByteStride(bufferView);
+    const int componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+    const int components    = tinygltf::GetNumComponentsInType(accessor.type);
+    if (stride <= 0 || componentSize <= 0 || components <= 0 || accessor.count > INT_MAX) return false;
+
+    // Every element has to lie inside the buffer view, and the view inside the buffer
+    const std::span<uint8_t> buffer = file.buffers[bufferView.buffer];
+    const size_t elementSize        = static_cast<size_t>(componentSize) * components;
+    if (bufferView.byteOffset > buffer.size() || bufferView.byteLength > buffer.size() - bufferView.byteOffset) return false;
+    if (accessor.count > 0 && (accessor.byteOffset > bufferView.byteLength ||
+                               (accessor.count - 1) * stride + elementSize > bufferView.byteLength - accessor.byteOffset)) {
+        return false;
+    }
+
+    view.data          = buffer.data() + bufferView.byteOffset + accessor.byteOffset;
+    view.stride        = static_cast<size_t>(stride);
+    view.count         = accessor.count;
+    view.componentType = accessor.componentType;
+    view.componentSize = componentSize;
+    view.components    = components;
+    view.normalized    = accessor.normalized;
+    return true;
+}
+
+// Normalized integers map to [0, 1], or [-1, 1] when signed
+static float readComponent(const uint8_t *p, const int componentType, const bool normalized) {
+    switch (componentType) {
+        case TINYGLTF_COMPONENT_TYPE_FLOAT: {
+            float v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+            return normalized ? static_cast<float>(*p) / 255 : static_cast<float>(*p);
+        case TINYGLTF_COMPONENT_TYPE_BYTE: {
+            const auto v = static_cast<float>(static_cast<int8_t>(*p));
+            return normalized ? std::max(v / 127, -1.0f) : v;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+            uint16_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return normalized ? static_cast<float>(v) / 65535 : static_cast<float>(v);
+        }
+        case TINYGLTF_COMPONENT_TYPE_SHORT: {
+            int16_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return normalized ? std::max(static_cast<float>(v) / 32767, -1.0f) : static_cast<float>(v);
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: {
+            uint32_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return static_cast<float>(v);
+        }
+        default:
+            return 0;
+    }
+}
+
+static uint32_t readIndex(const uint8_t *p, const int componentType) {
+    switch (componentType) {
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+            return *p;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+            uint16_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+        default: {
+            uint32_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+    }
+}
+
+template<typename T>
+static T *newArray(const size_t count, std::vector<std::shared_ptr<void>> &storage) {
+    std::shared_ptr<T[]> array(new T[count]);
+    storage.push_back(array);
+    return array.get();
+}
+
+/**
+ * Points at the elements of an attribute when they are stored as T, a vector of N floats,
+ * otherwise converts them into a new array in storage on the task group
+ */
+template<typename T, int N>
+static T *attributeArray(const AccessorView &view, TaskGroup &group, std::vector<std::shared_ptr<void>> &storage) {
+    if (view.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && sizeof(T) == N * sizeof(float) && view.stride == sizeof(T) &&
+        reinterpret_cast<uintptr_t>(view.data) % alignof(T) == 0) {
+        return reinterpret_cast<T *>(view.data);
+    }
+
+    T *array = newArray<T>(view.count, storage);
+    for (size_t begin = 0; begin < view.count; begin += IMPORT_CHUNK) {
+        const size_t end = std::min(begin + IMPORT_CHUNK, view.count);
+        group.run([=] {
+            for (size_t i = begin; i < end; ++i) {
+                const uint8_t *element = view.data + i * view.stride;
+                float v[N];
+                for (int c = 0; c < N; ++c) v[c] = readComponent(element + c * view.componentSize, view.componentType, view.normalized);
+                if constexpr (N == 3) {
+                    array[i] = T(v[0], v[1], v[2]);
+                } else {
+                    array[i] = T(v[0], v[1]);
+                }
+            }
+        });
+    }
+    return array;
+}
+
+/**
+ * Triangles of a primitive, pointing at its indices when they are tightly packed 32 bit values
+ * Primitives without indices get the implied 0, 1, 2, ...
+ * Out of range indices are only found by checkIndices()
+ */
+static Vec3i *indexArray(const AccessorView &view, const bool hasIndices, const int numVertices, TaskGroup &group,
+                         std::vector<std::shared_ptr<void>> &storage) {
+    if (hasIndices && view.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT && view.stride == sizeof(uint32_t) &&
+        sizeof(Vec3i) == 3 * sizeof(uint32_t) && reinterpret_cast<uintptr_t>(view.data) % alignof(Vec3i) == 0) {
+        return reinterpret_cast<Vec3i *>(view.data);
+    }
+
+    const size_t numTriangles = (hasIndices ? view.count : static_cast<size_t>(numVertices)) / 3;
+    Vec3i *array              = newArray<Vec3i>(numTriangles, storage);
+    for (size_t begin = 0; begin < numTriangles; begin += IMPORT_CHUNK) {
+        const size_t end = std::min(begin + IMPORT_CHUNK, numTriangles);
+        group.run([=] {
+            for (size_t i = begin; i < end; ++i) {
+                if (!hasIndices) {
+                    const int first = static_cast<int>(3 * i);
+                    array[i]        = Vec3i(first, first + 1, first + 2);
+                    continue;
+                }
+                const uint8_t *triangle = view.data + 3 * i * view.stride;
+                array[i] = Vec3i(static_cast<int>(readIndex(triangle, view.componentType)),
+                                 static_cast<int>(readIndex(triangle + view.stride, view.componentType)),
+                                 static_cast<int>(readIndex(triangle + 2 * view.stride, view.componentType)));
+            }
+        });
+    }
+    return array;
+}
+
+// Counts the triangles of mesh that index past its vertices into invalid
+static void checkIndices(const Mesh &mesh, TaskGroup &group, std::atomic<int> &invalid) {
+    for (int begin = 0; begin < mesh.numIndices; begin += static_cast<int>(IMPORT_CHUNK)) {
+        const int end = std::min(begin + static_cast<int>(IMPORT_CHUNK), mesh.numIndices);
+        group.run([&mesh, &invalid, begin, end] {
+            int count = 0;
+            for (int t = begin; t < end; ++t) {
+                const Vec3i i = mesh.indices[t];
+                for (int v = 0; v < 3; ++v) count += static_cast<uint32_t>(i[v]) >= static_cast<uint32_t>(mesh.numVertices);
+            }
+            if (count > 0) invalid.fetch_add(count, std::memory_order_relaxed);
+        });
+    }
+}
+
+// Area weighted vertex normals, for primitives that come without normals
+static void generateNormals(Mesh &mesh) {
+    std::fill_n(mesh.normals, mesh.numVertices, Vec3(0, 0, 0));
+    for (int t = 0; t < mesh.numIndices; ++t) {
+        Vec3 v0, v1, v2;
+        mesh.getVertices(t, v0, v1, v2);
+        const Vec3 n = jtx::cross(v1 - v0, v2 - v0);
+        for (int v = 0; v < 3; ++v) mesh.normals[mesh.indices[t][v]] += n;
+    }
+    for (int v = 0; v < mesh.numVertices; ++v) {
+        const Vec3 n    = mesh.normals[v];
+        mesh.normals[v] = n.lenSqr() > 0 ? jtx::normalize(n) : Vec3(0, 1, 0);
+    }
+}
+
+// Number property of a material extension, fallback if either is missing
+static float extensionNumber(const tinygltf::Material &material, const char *extension, const char *property, const float fallback) {
+    const auto it = material.extensions.find(extension);
+    if (it == material.extensions.end() || !it->second.Has(property)) return fallback;
+    const tinygltf::Value &value = it->second.Get(property);
+    return value.IsNumber() ? static_cast<float>(value.GetNumberAsDouble()) : fallback;
+}
+
+/**
+ * Closest Material to a metallic-roughness material, texture is the asset texture of its base color, -1 if none
+ * Mostly metallic materials become conductors, transmissive ones (KHR_materials_transmission) dielectrics and
+ * everything else diffuse, blends between them and the metallic-roughness texture are not represented.
+ * Roughness is squared into the GGX alpha like in the glTF BRDF.
+ */
+static Material convertMaterial(const tinygltf::Material &gltf, const int texture) {
+    const tinygltf::PbrMetallicRoughness &pbr = gltf.pbrMetallicRoughness;
+    const float baseColor[3] = {static_cast<float>(pbr.baseColorFactor[0]),
+                                static_cast<float>(pbr.baseColorFactor[1]),
+                                static_cast<float>(pbr.baseColorFactor[2])};
+    const float alpha        = static_cast<float>(pbr.roughnessFactor * pbr.roughnessFactor);
+
+    Material material{};
+    material.emission = Vec3(static_cast<float>(gltf.emissiveFactor[0]),
+                             static_cast<float>(gltf.emissiveFactor[1]),
+                             static_cast<float>(gltf.emissiveFactor[2])) *
+                        extensionNumber(gltf, "KHR_materials_emissive_strength", "emissiveStrength", 1);
+    material.alphaX = material.alphaY = alpha;
+    material.texId                    = -1;
+
+    if (extensionNumber(gltf, "KHR_materials_transmission", "transmissionFactor", 0) > 0.5f) {
+        const float ior          = extensionNumber(gltf, "KHR_materials_ior", "ior", 1.5f);
+        material.type            = Material::DIELECTRIC;
+        material.refractionIndex = ior;
+        material.IOR             = Vec3(ior, ior, ior);
+    } else if (pbr.metallicFactor >= 0.5) {
+        // IOR and absorption with the base color as reflectance at normal incidence, from Gulbrandsen's
+        // "Artist Friendly Metallic Fresnel" with the edge tint equal to the base color
+        // The tint g blends the IOR between n_min (g = 1) and n_max (g = 0), k then keeps the reflectance at r
+        float eta[3], k[3];
+        for (int c = 0; c < 3; ++c) {
+            const float r    = std::clamp(baseColor[c], 0.0f, 0.999f);
+            const float g    = r;
+            const float nMin = (1 - r) / (1 + r);
+            const float nMax = (1 + std::sqrt(r)) / (1 - std::sqrt(r));
+            eta[c]           = g * nMin + (1 - g) * nMax;
+            const float k2   = ((eta[c] + 1) * (eta[c] + 1) * r - (eta[c] - 1) * (eta[c] - 1)) / (1 - r);
+            k[c]             = std::sqrt(std::max(k2, 0.0f));
+        }
+        material.type = Material::CONDUCTOR;
+        material.IOR  = Vec3(eta[0], eta[1], eta[2]);
+        material.k    = Vec3(k[0], k[1], k[2]);
+    } else {
+        material.type   = Material::DIFFUSE;
+        material.albedo = Vec3(baseColor[0], baseColor[1], baseColor[2]);
+        material.texId  = texture;
+    }
+    return material;
+}
+
+// Asset texture of a glTF image, added on first use
+static int assetTexture(const GLTFFile &file, const std::string &path, const int image, std::vector<int> &imageTextures, MeshAsset &asset) {
+    if (image < 0 || image >= static_cast<int>(file.model.images.size())) return -1;
+    if (imageTextures[image] >= 0) return imageTextures[image];
+
+    const tinygltf::Image &gltfImage = file.model.images[image];
+    std::string texturePath;
+    std::span<const uint8_t> data;
+    if (gltfImage.bufferView >= 0 && gltfImage.bufferView < static_cast<int>(file.model.bufferViews.size())) {
+        // Embedded in a buffer, decoded straight from it
+        const tinygltf::BufferView &view = file.model.bufferViews[gltfImage.bufferView];
+        if (view.buffer < 0 || view.buffer >= static_cast<int>(file.buffers.size())) return -1;
+        const std::span<uint8_t> buffer = file.buffers[view.buffer];
+        if (view.byteOffset > buffer.size() || view.byteLength > buffer.size() - view.byteOffset) return -1;
+        data        = buffer.subspan(view.byteOffset, view.byteLength);
+        texturePath = path + "#image" + std::to_string(image);
+    } else if (!gltfImage.image.empty()) {
+        // Data URI, kept by keepImageBytes()
+        data        = gltfImage.image;
+        texturePath = path + "#image" + std::to_string(image);
+    } else {
+        std::string uri;
+        tinygltf::URIDecode(gltfImage.uri, &uri, nullptr);
+        const size_t lastSlash = path.find_last_of("/\\");
+        texturePath            = (lastSlash == std::string::npos ? "" : path.substr(0, lastSlash + 1)) + uri;
+    }
+
+    asset.texturePaths.push_back(texturePath);
+    asset.textureData.push_back(data);
+    imageTextures[image] = static_cast<int>(asset.texturePaths.size()) - 1;
+    return imageTextures[image];
+}
+
+// Matrix of a node relative to its parent, from its matrix or its translation, rotation and scale
+static Affine localTransform(const tinygltf::Node &node) {
+    if (node.matrix.size() == 16) {
+        // Column-major
+        const auto column = [&](const int c) {
+            return Vec3(static_cast<float>(node.matrix[4 * c]), static_cast<float>(node.matrix[4 * c + 1]), static_cast<float>(node.matrix[4 * c + 2]));
+        };
+        return Affine::fromColumns(column(0), column(1), column(2), column(3));
+    }
+
+    Vec3 t(0, 0, 0), s(1, 1, 1);
+    if (node.translation.size() == 3) t = Vec3(static_cast<float>(node.translation[0]), static_cast<float>(node.translation[1]), static_cast<float>(node.translation[2]));
+    if (node.scale.size() == 3) s = Vec3(static_cast<float>(node.scale[0]), static_cast<float>(node.scale[1]), static_cast<float>(node.scale[2]));
+
+    // Unit quaternion (x, y, z, w) to the columns of its rotation matrix
+    float x = 0, y = 0, z = 0, w = 1;
+    if (node.rotation.size() == 4) {
+        x = static_cast<float>(node.rotation[0]);
+        y = static_cast<float>(node.rotation[1]);
+        z = static_cast<float>(node.rotation[2]);
+        w = static_cast<float>(node.rotation[3]);
+    }
+    const Vec3 c0 = Vec3(1 - 2 * (y * y + z * z), 2 * (x * y + w * z), 2 * (x * z - w * y));
+    const Vec3 c1 = Vec3(2 * (x * y - w * z), 1 - 2 * (x * x + z * z), 2 * (y * z + w * x));
+    const Vec3 c2 = Vec3(2 * (x * z + w * y), 2 * (y * z - w * x), 1 - 2 * (x * x + y * y));
+    return Affine::fromColumns(c0 * s.x, c1 * s.y, c2 * s.z, t);
+}
+
+bool importGLTF(const std::string &path, MeshAsset &asset) {
+    auto file = std::make_shared<GLTFFile>();
+    if (!loadFile(path, *file)) return false;
+    const tinygltf::Model &model = file->model;
+    asset.storage.push_back(file);
+
+    // Materials map one to one, primitives without one get the glTF default material after them
+    std::vector<int> imageTextures(model.images.size(), -1);
+    for (const tinygltf::Material &gltfMaterial: model.materials) {
+        int texture           = -1;
+        const int gltfTexture = gltfMaterial.pbrMetallicRoughness.baseColorTexture.index;
+        if (gltfTexture >= 0 && gltfTexture < static_cast<int>(model.textures.size())) {
+            texture = assetTexture(*file, path, model.textures[gltfTexture].source, imageTextures, asset);
+        }
+        asset.materials.push_back(convertMaterial(gltfMaterial, texture));
+    }
+    int defaultMaterial = -1;
+
+    // Arrays are mapped or allocated here, conversions run as tasks like in importMesh
+    std::vector<PrimitiveMesh> primitives;
+    TaskGroup group;
+    for (size_t m = 0; m < model.meshes.size(); ++m) {
+        const tinygltf::Mesh &gltfMesh = model.meshes[m];
+        for (size_t p = 0; p < gltfMesh.primitives.size(); ++p) {
+            const tinygltf::Primitive &primitive = gltfMesh.primitives[p];
+            std::string name = gltfMesh.name.empty() ? "mesh_" + std::to_string(m) : gltfMesh.name;
+            if (gltfMesh.primitives.size() > 1) name += "_" + std::to_string(p);
+
+            if (primitive.mode != TINYGLTF_MODE_TRIANGLES && primitive.mode != -1) {
+                std::cerr << "Warning: skipping " << name << ", only triangle primitives are supported\n";
+                continue;
+            }
+
+            const auto attribute = [&](const char *semantic, AccessorView &view, const int components) {
+                const auto it = primitive.attributes.find(semantic);
+                return it != primitive.attributes.end() && accessorView(*file, it->second, view) && view.components == components;
+            };
+            AccessorView positions, normals, uvs, indices;
+            if (!attribute("POSITION", positions, 3) || positions.count == 0) {
+                std::cerr << "Warning: skipping " << name << ", its positions cannot be read\n";
+                continue;
+            }
+            const bool hasIndices = primitive.indices >= 0;
+            if (hasIndices && (!accessorView(*file, primitive.indices, indices) || indices.components != 1 ||
+                               indices.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)) {
+                std::cerr << "Warning: skipping " << name << ", its indices cannot be read\n";
+                continue;
+            }
+
+            const int numVertices  = static_cast<int>(positions.count);
+            const int numTriangles = static_cast<int>((hasIndices ? indices.count : positions.count) / 3);
+            const bool hasNormals  = attribute("NORMAL", normals, 3) && normals.count == positions.count;
+
+            Vec3 *vertexArray = attributeArray<Vec3, 3>(positions, group, asset.storage);
+            Vec3 *normalArray = hasNormals ? attributeArray<Vec3, 3>(normals, group, asset.storage) : newArray<Vec3>(numVertices, asset.storage);
+            Vec2f *uvArray;
+            if (attribute("TEXCOORD_0", uvs, 2) && uvs.count == positions.count) {
+                uvArray = attributeArray<Vec2f, 2>(uvs, group, asset.storage);
+            } else {
+                // Lookups always interpolate uvs
+                uvArray = newArray<Vec2f>(numVertices, asset.storage);
+                std::fill_n(uvArray, numVertices, Vec2f(0, 0));
+            }
+            Vec3i *indexArray = ::indexArray(indices, hasIndices, numVertices, group, asset.storage);
+
+            int material = primitive.material;
+            if (material < 0 || material >= static_cast<int>(model.materials.size())) {
+                if (defaultMaterial < 0) {
+                    asset.materials.push_back(convertMaterial(tinygltf::Material(), -1));
+                    defaultMaterial = static_cast<int>(asset.materials.size()) - 1;
+                }
+                material = defaultMaterial;
+            }
+
+            PrimitiveMesh &added = primitives.emplace_back(static_cast<int>(m), material,
+                                                           Mesh(name, indexArray, numTriangles, vertexArray, numVertices, normalArray, uvArray, nullptr),
+                                                           !hasNormals);
+            added.mesh.ownsData = false;
+        }
+    }
+    group.wait();
+
+    // Indices are checked against the vertices before anything reads through them
+    std::vector<std::atomic<int>> invalid(primitives.size());
+    for (size_t p = 0; p < primitives.size(); ++p) {
+        checkIndices(primitives[p].mesh, group, invalid[p]);
+    }
+    group.wait();
+    for (size_t p = 0; p < primitives.size(); ++p) {
+        if (invalid[p] == 0 && primitives[p].generateNormals) {
+            group.run([&mesh = primitives[p].mesh] { generateNormals(mesh); });
+        }
+    }
+    group.wait();
+
+    std::vector<std::vector<int>> meshPrimitives(model.meshes.size());
+    for (size_t p = 0; p < primitives.size(); ++p) {
+        if (invalid[p] > 0) {
+            std::cerr << "Warning: skipping " << primitives[p].mesh.name << ", " << invalid[p] << " of its indices are out of range\n";
+            continue;
+        }
+        meshPrimitives[primitives[p].gltfMesh].push_back(static_cast<int>(asset.meshes.size()));
+        asset.meshes.push_back(primitives[p].mesh);
+        asset.meshMaterials.push_back(primitives[p].material);
+    }
+
+    // Every node of the default scene that references a mesh places its primitives, without copying them
+    if (model.scenes.empty()) return true;
+    const tinygltf::Scene &scene = model.scenes[model.defaultScene >= 0 && model.defaultScene < static_cast<int>(model.scenes.size()) ? model.defaultScene : 0];
+
+    struct PendingNode {
+        int node;
+        Affine parent;
+        size_t depth;
+    };
+    std::vector<PendingNode> pending;
+    for (const int node: scene.nodes) pending.push_back({node, Affine::identity(), 0});
+    while (!pending.empty()) {
+        const PendingNode current = pending.back();
+        pending.pop_back();
+        // Hierarchies are trees, deeper paths can only come from a cycle
+        if (current.node < 0 || current.node >= static_cast<int>(model.nodes.size()) || current.depth >= model.nodes.size()) continue;
+
+        const tinygltf::Node &node = model.nodes[current.node];
+        const Affine world         = current.parent * localTransform(node);
+        if (node.mesh >= 0 && node.mesh < static_cast<int>(model.meshes.size())) {
+            for (const int mesh: meshPrimitives[node.mesh]) asset.instances.push_back({mesh, world});
+        }
+        for (const int child: node.children) pending.push_back({child, world, current.depth + 1});
+    }
+    return true;
+}
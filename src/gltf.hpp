@@ -0,0 +1,18 @@
+#pragma once
+
+#include "scenecache.hpp"
+
+#include <string>
+
+/**
+ * True for the extensions of glTF 2.0 files, .gltf and .glb
+ */
+bool isGLTF(const std::string &path);
+
+/**
+ * Converts the default scene of a glTF 2.0 file into an asset, with an instance per node that references a mesh
+ * Nodes that share a mesh share its geometry. Accessors laid out like the Mesh arrays are used in place,
+ * the meshes point into the file's buffers (binary files are mapped) and never own their arrays.
+ * Metallic-roughness materials are mapped onto the closest Material type, see gltf.cpp
+ */
+bool importGLTF(const std::string &path, MeshAsset &asset);
@@ -8,6 +8,8 @@
 #define TINYEXR_IMPLEMENTATION
 #include "tinyexr.h"
 
+#include <climits>
+
 void RGB8Image::save(const char *path) const {
     std::vector<unsigned char> flipped_buffer(w_ * h_ * 3);
 
@@ -25,36 +27,38 @@ void RGB8Image::save(const char *path) const {
 }
 
 
-TextureImage &TextureImage::operator=(TextureImage &&other) noexcept {
-    if (this != &other) {
-        if (data_) {
-            if (isExr_) {
-                free(data_);
-            } else {
-                stbi_image_free(data_);
-            }
+// Copies the RGB channels of interleaved pixels, replicating grayscale
+template<typename T, typename Convert>
+static void copyTexels(const T *pixels, const int channels, TexelBuffer &texels, Convert convert) {
+    for (int y = 0; y < texels.height(); ++y) {
+        for (int x = 0; x < texels.width(); ++x) {
+            const T *pixel = pixels + (static_cast<size_t>(y) * texels.width() + x) * channels;
+            convert(pixel, channels >= 3 ? pixel + 1 : pixel, channels >= 3 ? pixel + 2 : pixel, x, y);
         }
-
-        data_ = other.data_;
-        width_ = other.width_;
-        height_ = other.height_;
-        channels_ = other.channels_;
-        isExr_ = other.isExr_;
-
-        other.data_ = nullptr;
-        other.width_ = other.height_ = other.channels_ = 0;
     }
-    return *this;
 }
 
-TextureImage::~TextureImage() {
-    if (data_) {
-        if (isExr_) {
-            free(data_);
-        } else {
-            stbi_image_free(data_);
-        }
-    }
+namespace {
+// stb_image entry points for images read from a file
+struct FileSource {
+    const char *path;
+
+    [[nodiscard]] bool isHDR() const { return stbi_is_hdr(path); }
+    [[nodiscard]] bool is16Bit() const { return stbi_is_16_bit(path); }
+    float *loadf(int *w, int *h, int *c) const { return stbi_loadf(path, w, h, c, 0); }
+    unsigned char *load(int *w, int *h, int *c) const { return stbi_load(path, w, h, c, 0); }
+};
+
+// stb_image entry points for images already in memory
+struct MemorySource {
+    const stbi_uc *data;
+    int size;
+
+    [[nodiscard]] bool isHDR() const { return stbi_is_hdr_from_memory(data, size); }
+    [[nodiscard]] bool is16Bit() const { return stbi_is_16_bit_from_memory(data, size); }
+    float *loadf(int *w, int *h, int *c) const { return stbi_loadf_from_memory(data, size, w, h, c, 0); }
+    unsigned char *load(int *w, int *h, int *c) const { return stbi_load_from_memory(data, size, w, h, c, 0); }
+};
 }
 
 bool TextureImage::load(const char *path) {
@@ -63,19 +67,74 @@ bool TextureImage::load(const char *path) {
 
     if (ext == "exr" || ext == "EXR") {
         // Use TinyEXR for EXR files
-        isExr_ = true;
         return loadEXR(path);
-    } else {
-        // Use stb_image for other formats
-        isExr_ = false;
-        data_ = stbi_loadf(path, &width_, &height_, &channels_, 0);
-        return data_ != nullptr;
     }
+
+    // Use stb_image for other formats
+    return loadSTB(FileSource{path});
+}
+
+bool TextureImage::load(const uint8_t *data, const size_t size) {
+    path_.clear();
+    if (size > INT_MAX) return false;
+    return loadSTB(MemorySource{data, static_cast<int>(size)});
+}
+
+template<typename Source>
+bool TextureImage::loadSTB(const Source &source) {
+    int width, height;
+    if (source.isHDR() || source.is16Bit()) {
+        // Radiance files keep their floats, 16 bit PNGs fit into halves
+        float *data = source.loadf(&width, &height, &channels_);
+        if (!data) return false;
+        texels_ = TexelBuffer(source.isHDR() ? TexelFormat::FLOAT : TexelFormat::HALF, width, height);
+        copyTexels(data, channels_, texels_, [&](const float *r, const float *g, const float *b, const int x, const int y) {
+            texels_.set(x, y, Vec3(*r, *g, *b));
+        });
+        stbi_image_free(data);
+        return true;
+    }
+
+    // 8 bit images are kept as they are, decoded through the sRGB table on lookup
+    unsigned char *data = source.load(&width, &height, &channels_);
+    if (!data) return false;
+    texels_     = TexelBuffer(TexelFormat::SRGB8, width, height);
+    uint8_t *t  = texels_.data();
+    copyTexels(data, channels_, texels_, [&](const unsigned char *r, const unsigned char *g, const unsigned char *b, const int x, const int y) {
+        uint8_t *texel = t + (static_cast<size_t>(y) * width + x) * 3;
+        texel[0]       = *r;
+        texel[1]       = *g;
+        texel[2]       = *b;
+    });
+    stbi_image_free(data);
+    return true;
+}
+
+// True if every channel of the EXR is stored as half
+static bool isHalfEXR(const char *path) {
+    EXRVersion version;
+    if (ParseEXRVersionFromFile(&version, path) != TINYEXR_SUCCESS || version.multipart) return false;
+
+    EXRHeader header;
+    InitEXRHeader(&header);
+    const char *err = nullptr;
+    if (ParseEXRHeaderFromFile(&header, &version, path, &err) != TINYEXR_SUCCESS) {
+        if (err) FreeEXRErrorMessage(err);
+        return false;
+    }
+    bool half = header.num_channels > 0;
+    for (int c = 0; c < header.num_channels; ++c) {
+        half = half && header.pixel_types[c] == TINYEXR_PIXELTYPE_HALF;
+    }
+    FreeEXRHeader(&header);
+    return half;
 }
 
 bool TextureImage::loadEXR(const char *path) {
     const char *err = nullptr;
-    const int ret = LoadEXR(&data_, &width_, &height_, path, &err);
+    float *data     = nullptr;
+    int width, height;
+    const int ret = LoadEXR(&data, &width, &height, path, &err);
 
     if (ret != TINYEXR_SUCCESS) {
         if (err) {
@@ -85,6 +144,12 @@ bool TextureImage::loadEXR(const char *path) {
         return false;
     }
 
+    // LoadEXR always returns RGBA floats, half files are converted back without loss
     channels_ = 4;
+    texels_   = TexelBuffer(isHalfEXR(path) ? TexelFormat::HALF : TexelFormat::FLOAT, width, height);
+    copyTexels(data, channels_, texels_, [&](const float *r, const float *g, const float *b, const int x, const int y) {
+        texels_.set(x, y, Vec3(*r, *g, *b));
+    });
+    free(data);
     return true;
-}
\ No newline at end of file
+}
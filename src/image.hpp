@@ -2,6 +2,7 @@
 
 #include "rt.hpp"
 #include "util/color.hpp"
+#include "util/texel.hpp"
 
 constexpr Float MIN_INTENSITY = 0;
 constexpr Float MAX_INTENSITY = 0.999;
@@ -70,83 +71,102 @@ public:
           h_(1080) {}
     AccumulationBuffer(const int w, const int h)
         : w_(w),
-          h_(h) { buffer_.resize(w_ * h_); }
+          h_(h) {
+        buffer_.resize(w_ * h_);
+        luminanceSq_.resize(w_ * h_);
+    }
 
     void resize(const int w, const int h) {
         w_ = w;
         h_ = h;
         buffer_.resize(w * h);
+        luminanceSq_.resize(w * h);
+    }
+    void clear() {
+        std::ranges::fill(buffer_, Vec3{0, 0, 0});
+        std::ranges::fill(luminanceSq_, 0.0f);
     }
-    void clear() { std::ranges::fill(buffer_, Vec3{0, 0, 0}); }
 
     Vec3 &updatePixel(const Vec3 &v, const int row, const int col) {
         const int i = row * w_ + col;
         buffer_[i] += v;
+        luminanceSq_[i] += luminance(v) * luminance(v);
         return buffer_[i];
     }
 
+    /**
+     * Relative standard error of the pixel's mean luminance after numSamples samples
+     * Dark pixels are measured against floor instead of their mean, so they can converge
+     */
+    [[nodiscard]] float relativeError(const int row, const int col, const int numSamples, const float floor) const {
+        const int i      = row * w_ + col;
+        const float n    = static_cast<float>(numSamples);
+        const float mean = luminance(buffer_[i]) / n;
+        const float var  = jtx::max(luminanceSq_[i] / n - mean * mean, 0.0f);
+        return jtx::sqrt(var / n) / jtx::max(mean, floor);
+    }
+
     const Vec3 *data() const { return buffer_.data(); }
 
 private:
     std::vector<Vec3> buffer_;
+    // Second moment of the luminance, for variance estimates
+    std::vector<float> luminanceSq_;
 };
 
+/**
+ * RGB texture decoded to linear floats on every read, stored in the precision of the source file
+ * 8 bit images stay sRGB encoded bytes, 16 bit images and half EXRs are kept as halves, the rest as floats
+ */
 class TextureImage {
 public:
-    TextureImage()
-        : width_(0),
-          height_(0),
-          channels_(0),
-          data_(nullptr) {}
+    TextureImage() = default;
 
     explicit TextureImage(const char *path) { load(path); }
 
-    TextureImage(TextureImage &&other) noexcept
-        : isExr_(other.isExr_),
-          path_(other.path_),
-          width_(other.width_),
-          height_(other.height_),
-          channels_(other.channels_),
-          data_(other.data_) {
-        other.data_  = nullptr;
-        other.path_  = "";
-        other.width_ = other.height_ = other.channels_ = 0;
-    }
-
-    TextureImage(const TextureImage &) = delete;
+    TextureImage(TextureImage &&other) noexcept            = default;
+    TextureImage &operator=(TextureImage &&other) noexcept = default;
 
+    TextureImage(const TextureImage &)            = delete;
     TextureImage &operator=(const TextureImage &) = delete;
-    TextureImage &operator=(TextureImage &&other) noexcept;
-
-    ~TextureImage();
 
     bool load(const char *path);
 
-    int width() const { return width_; }
-    int height() const { return height_; }
+    /**
+     * Decodes an image file held in memory, e.g. one embedded in a glTF buffer
+     * EXR is not supported here
+     */
+    bool load(const uint8_t *data, size_t size);
+
+    int width() const { return texels_.width(); }
+    int height() const { return texels_.height(); }
+    // Of the source file, grayscale images are replicated to RGB and alpha is dropped
     int channels() const { return channels_; }
+    TexelFormat format() const { return texels_.format(); }
 
-    const float *data() const { return data_; }
+    const TexelBuffer &texels() const { return texels_; }
 
     Vec3 getTexel(const int u, const int v) const {
-        int wrappedU = u % width_;
+        const int width  = texels_.width();
+        const int height = texels_.height();
+
+        int wrappedU = u % width;
         if (wrappedU < 0) {
-            wrappedU += width_;
+            wrappedU += width;
         }
 
-        int wrappedV = v % height_;
+        int wrappedV = v % height;
         if (wrappedV < 0) {
-            wrappedV += height_;
+            wrappedV += height;
         }
 
-        const float *pixel = data_ + (wrappedV * width_ + wrappedU) * channels_;
-        return Vec3(pixel[0], pixel[1], pixel[2]);
+        return texels_.get(wrappedU, wrappedV);
     }
 
     // Interpolated texel
     Vec3 getTexel(const float u, const float v) const {
-        const int x0 = static_cast<int>(u * width_);
-        const int y0 = static_cast<int>(v * height_);
+        const int x0 = static_cast<int>(u * texels_.width());
+        const int y0 = static_cast<int>(v * texels_.height());
         return getTexel(x0, y0);
     }
 
@@ -155,13 +175,14 @@ public:
     }
 
 private:
-    bool isExr_;
     std::string path_;
 
     bool loadEXR(const char *path);
 
-    int width_;
-    int height_;
-    int channels_;
-    float *data_;
+    // Decodes through stb_image, source reads a file or memory (see image.cpp)
+    template<typename Source>
+    bool loadSTB(const Source &source);
+
+    int channels_ = 0;
+    TexelBuffer texels_;
 };
\ No newline at end of file
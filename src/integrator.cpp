@@ -1,5 +1,5 @@
 #include "integrator.hpp"
-#include "bsdf/bxdf.hpp"
+#include "bsdf/bsdf.hpp"
 #include "material.hpp"
 #include "util/interval.hpp"
 #include "bsdf/microfacet.hpp"
@@ -10,14 +10,40 @@ float powerHeuristic(float nf, float fPdf, float ng, float gPdf) {
     return f * f / (f * f + g * g);
 }
 
-Vec3 integrateBasic(Ray ray, const Scene &scene, int maxDepth, RNG &rng) {
+// Uses the packet-traced primary hit on the first bounce, then traces as usual
+// Bounce rays are plain rays without differentials, so textures are only filtered at the first hit
+static bool closestHit(const RayDifferential &ray, const Scene &scene, const PrimaryHit *&primary, Intersection &record) {
+    bool hit;
+    if (primary) {
+        hit     = primary->hit;
+        record  = primary->record;
+        primary = nullptr;
+    } else {
+        hit = scene.closestHit(ray, Interval(0.001, INF), record);
+    }
+    if (hit && ray.hasDifferentials) record.computeDifferentials(ray);
+    return hit;
+}
+
+bool russianRoulette(Vec3 &beta, const float etaScale, const int depth, const int rrDepth, Sampler &sampler) {
+    // Refracted radiance is scaled by eta^2, which should not count towards termination
+    const float rrBeta = maxComponent(beta) * etaScale;
+    if (depth <= rrDepth || rrBeta >= 1) return true;
+
+    const float q = jtx::max(0.0f, 1 - rrBeta);
+    if (sampler.get1D() < q) return false;
+    beta = beta / (1 - q);
+    return true;
+}
+
+Vec3 integrateBasic(RayDifferential ray, const Scene &scene, int maxDepth, int rrDepth, Sampler &sampler, const PrimaryHit *primary, int *pathLength) {
     Vec3 radiance = {};
     Vec3 beta     = {1, 1, 1};
     int depth     = 0;
 
     Intersection record;
     while (beta) {
-        const bool hit = scene.closestHit(ray, Interval(0.001, INF), record);
+        const bool hit = closestHit(ray, scene, primary, record);
 
         if (!hit) {
             radiance += beta * scene.lights[0].evaluate(ray);
@@ -31,28 +57,31 @@ Vec3 integrateBasic(Ray ray, const Scene &scene, int maxDepth, RNG &rng) {
         if (depth++ == maxDepth) break;
 
         // Both w_o and w_i face outwards
-        Vec3 w_o = -ray.dir;
+        const BSDF bsdf(scene, record, -ray.dir);
 
         // TODO: light sampling (once we add lights)
 
         // Generate samples
-        float u  = rng.sample<float>();
-        Vec2f u2 = rng.sample<Vec2f>();
+        float u  = sampler.get1D();
+        Vec2f u2 = sampler.get2D();
 
         // Sample BSDF
         BSDFSample s;
-        bool success = sampleBxdf(scene, record, w_o, u, u2, s);
+        bool success = bsdf.sample(u, u2, s);
         if (!success) break;
 
         // Update beta and set next ray
         beta *= s.fSample * jtx::absdot(s.w_i, record.normal) / s.pdf;
         ray = Ray(record.point + s.w_i * RAY_EPSILON, s.w_i, record.t);
+
+        if (!russianRoulette(beta, 1.0f, depth, rrDepth, sampler)) break;
     }
 
+    if (pathLength) *pathLength = depth;
     return radiance;
 }
 
-Vec3 integrate(Ray ray, const Scene &scene, const int maxDepth, RNG &rng) {
+Vec3 integrate(RayDifferential ray, const Scene &scene, const int maxDepth, const int rrDepth, Sampler &sampler, const PrimaryHit *primary, int *pathLength) {
     Vec3 radiance       = {};
     Vec3 beta           = {1, 1, 1};
     int depth           = 0;
@@ -60,7 +89,7 @@ Vec3 integrate(Ray ray, const Scene &scene, const int maxDepth, RNG &rng) {
     Intersection record;
 
     while (beta) {
-        const bool hit = scene.closestHit(ray, Interval(0.001, INF), record);
+        const bool hit = closestHit(ray, scene, primary, record);
 
         if (!hit) {
             if (specularBounce && scene.lights[0].type == Light::INFINITE) {
@@ -80,46 +109,45 @@ Vec3 integrate(Ray ray, const Scene &scene, const int maxDepth, RNG &rng) {
         if (depth++ == maxDepth) break;
 
         // Both w_o and w_i face outwards
-        Vec3 w_o = -ray.dir;
+        const BSDF bsdf(scene, record, -ray.dir);
 
         {// Light sampling
-            auto lightIdx = rng.sampleRange(scene.lights.size() - 1);
-            //            std::cout << "Light index: " << lightIdx << std::endl;
-            const Light &light = scene.lights[lightIdx];
-
             LightSample ls;
             LightSampleContext ctx;
             ctx.p  = record.point;
             ctx.n  = record.normal;
             ctx.sn = record.normal;
 
-            Vec2f u = rng.sample<Vec2f>();
+            // Pick a light by its estimated contribution
+            const float uLight = sampler.get1D();
+            Vec2f u            = sampler.get2D();
 
-            bool lightSampled = light.sample(ctx, ls, u);
+            SampledLight sampledLight;
+            bool lightSampled = scene.lightSampler().sample(ctx, uLight, sampledLight) && sampledLight.light->sample(ctx, ls, u);
             if (lightSampled && ls.pdf > 0) {
                 Vec3 w_i = ls.wi;
-                auto f   = evalBxdf(record.material, record, w_o, w_i) * jtx::absdot(w_i, ctx.sn);
+                auto f   = bsdf.f(w_i) * jtx::absdot(w_i, ctx.sn);
 
                 // Occlusion
                 // Offset ray from origin along normal to avoid self-collisions
                 const Vec3 sOrigin = record.point + record.normal * RAY_EPSILON;
                 const auto sRay    = Ray(sOrigin, ls.wi);
-                // Calculate distance for t parameter
-                const auto lDist = jtx::distance(record.point, ls.p);
+                // Calculate distance for t parameter, from the offset origin so area lights do not occlude themselves
+                const auto lDist = jtx::distance(sOrigin, ls.p);
 
                 if (f && !scene.anyHit(sRay, Interval(0.0f, lDist - RAY_EPSILON))) {
-                    radiance += beta * f * ls.radiance / (ls.pdf * (1.0f / static_cast<float>(scene.lights.size())));
+                    radiance += beta * f * ls.radiance / (ls.pdf * sampledLight.pmf);
                 }
             }
         }
 
         // Generate samples
-        float u = rng.sample<float>();
-        auto u2 = rng.sample<Vec2f>();
+        float u = sampler.get1D();
+        auto u2 = sampler.get2D();
 
         // Sample BSDF
         BSDFSample s;
-        bool success = sampleBxdf(scene, record, w_o, u, u2, s);
+        bool success = bsdf.sample(u, u2, s);
         if (!success) break;
 
         // Update beta and set next ray
@@ -127,8 +155,11 @@ Vec3 integrate(Ray ray, const Scene &scene, const int maxDepth, RNG &rng) {
         specularBounce = s.isSpecular;
 
         ray = Ray(record.point + s.w_i * RAY_EPSILON, s.w_i, record.t);
+
+        if (!russianRoulette(beta, 1.0f, depth, rrDepth, sampler)) break;
     }
 
+    if (pathLength) *pathLength = depth;
     return radiance;
 }
 
@@ -139,7 +170,7 @@ bool isNonSpecular(const Material *mat) {
     return true;
 }
 
-Vec3 integrateMIS(Ray ray, const Scene &scene, int maxDepth, bool regularize, RNG &rng) {
+Vec3 integrateMIS(RayDifferential ray, const Scene &scene, int maxDepth, int rrDepth, bool regularize, Sampler &sampler, const PrimaryHit *primary, int *pathLength) {
     Vec3 radiance             = {};
     Vec3 beta                 = {1, 1, 1};
     int depth                 = 0;
@@ -152,7 +183,7 @@ Vec3 integrateMIS(Ray ray, const Scene &scene, int maxDepth, bool regularize, RN
 
     while (true) {
         // Cast ray & find the closest hit
-        const bool hit = scene.closestHit(ray, Interval(0.001, INF), record);
+        const bool hit = closestHit(ray, scene, primary, record);
 
         if (!hit) {
             // Incorporate infinite lights and break
@@ -163,22 +194,36 @@ Vec3 integrateMIS(Ray ray, const Scene &scene, int maxDepth, bool regularize, RN
                 if (depth == 0 || specularBounce) {
                     radiance += beta * L;
                 } else {
-                    // Use MIS
-                    float pl = 1.0f / static_cast<float>(scene.lights.size()) * light.pdf(prevCtx, ray.dir, true);
-                    float wb = powerHeuristic(1, pl, 1, pbPrev);
+                    // Use MIS, the background is the first light of the light sampler
+                    float pl = scene.lightSampler().pmf(prevCtx, 0) * light.pdf(prevCtx, ray.dir);
+                    float wb = powerHeuristic(1, pbPrev, 1, pl);
                     radiance += beta * wb * L;
                 }
             }
             break;
         }
 
-        // TODO: check for emission (we don't support emission yet)
+        // Emission (L_e), area lights were also reachable by light sampling
+        if (record.material->emission) {
+            const Vec3 Le = record.material->emission;
+            if (depth == 0 || specularBounce || record.light < 0) {
+                radiance += beta * Le;
+            } else {
+                const LightSampler &lights = scene.lightSampler();
+                float pl = lights.pmf(prevCtx, record.light) * lights.light(record.light).pdf(prevCtx, ray.dir);
+                float wb = powerHeuristic(1, pbPrev, 1, pl);
+                radiance += beta * wb * Le;
+            }
+        }
 
         // TODO: Regularize
 
         // Check depth
         if (depth++ == maxDepth) break;
 
+        // Both w_o and w_i face outwards
+        const BSDF bsdf(scene, record, -ray.dir);
+
         // Sample direct illumination if non-specular
         if (isNonSpecular(record.material)) {
             LightSample ls;
@@ -187,34 +232,35 @@ Vec3 integrateMIS(Ray ray, const Scene &scene, int maxDepth, bool regularize, RN
             ctx.n  = record.normal;
             ctx.sn = record.normal;
 
-            // Uniformly sample a light
-            float u            = rng.sample<float>();
-            int lightIndex     = jtx::min<int>(u * scene.lights.size(), scene.lights.size() - 1);
-            const Light &light = scene.lights[lightIndex];
+            // Pick a light by its estimated contribution
+            float u  = sampler.get1D();
+            Vec2f u2 = sampler.get2D();
+            SampledLight sampledLight;
 
             // Sample the light
-            bool lightSampled = light.sample(ctx, ls, rng.sample<Vec2f>());
+            bool lightSampled = scene.lightSampler().sample(ctx, u, sampledLight) && sampledLight.light->sample(ctx, ls, u2);
             if (lightSampled && ls.pdf > 0 && ls.radiance) {
+                const Light &light = *sampledLight.light;
+
                 // Evaluate BSDF for light sample
-                Vec3 wo = -ray.dir;
                 Vec3 wi = ls.wi;
-                Vec3 f  = evalBxdf(record.material, record, wo, wi) * jtx::absdot(wi, ctx.sn);
+                Vec3 f  = bsdf.f(wi) * jtx::absdot(wi, ctx.sn);
 
                 // Calculate shadow ray
                 const Vec3 sOrigin = record.point + record.normal * RAY_EPSILON;
                 const auto sRay    = Ray(sOrigin, ls.wi);
-                const auto lDist   = jtx::distance(record.point, ls.p);
+                const auto lDist   = jtx::distance(sOrigin, ls.p);
 
                 // Check for occlusion
                 if (f && !scene.anyHit(sRay, Interval(0.0f, lDist - RAY_EPSILON))) {
-                    float pl = 1.0f / static_cast<float>(scene.lights.size()) * ls.pdf;
+                    float pl = sampledLight.pmf * ls.pdf;
                     if (light.type == Light::POINT) {
                         // Delta distribution
                         radiance += beta * ls.radiance * f / pl;
                     } else {
                         // MIS
-                        float pb     = pdfBxdf(record.material, record, wo, wi);
-                        float weight = powerHeuristic(1, ls.pdf * pl, 1, pb);
+                        float pb     = bsdf.pdf(wi);
+                        float weight = powerHeuristic(1, pl, 1, pb);
                         radiance += beta * weight * ls.radiance * f / pl;
                     }
                 }
@@ -222,10 +268,9 @@ Vec3 integrateMIS(Ray ray, const Scene &scene, int maxDepth, bool regularize, RN
         }
 
         // Sample BSDF for next ray
-        Vec3 wo = -ray.dir;
-        float u = rng.sample<float>();
+        float u = sampler.get1D();
         BSDFSample bs;
-        bool success = sampleBxdf(scene, record, wo, u, rng.sample<Vec2f>(), bs);
+        bool success = bsdf.sample(u, sampler.get2D(), bs);
         if (!success) break;
 
         // Update variables
@@ -239,8 +284,9 @@ Vec3 integrateMIS(Ray ray, const Scene &scene, int maxDepth, bool regularize, RN
         // Set next ray
         ray = Ray(record.point + bs.w_i * RAY_EPSILON, bs.w_i, record.t);
 
-        // TODO: Russian Roulette
+        if (!russianRoulette(beta, etaScale, depth, rrDepth, sampler)) break;
     }
 
+    if (pathLength) *pathLength = depth;
     return radiance;
 }
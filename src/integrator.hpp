@@ -1,12 +1,42 @@
 #pragma once
 
 #include "rt.hpp"
+#include "sampler.hpp"
 #include "scene.hpp"
 #include "util/color.hpp"
-#include "util/rand.hpp"
 
-Vec3 integrateBasic(Ray ray, const Scene &scene, int maxDepth, RNG &rng);
+/**
+ * Integrator used by Camera::render
+ * WAVEFRONT traces the same paths as PATH, but a whole tile at a time (see wavefront.hpp)
+ */
+enum class IntegratorType {
+    BASIC,
+    PATH,
+    MIS,
+    WAVEFRONT
+};
 
-Vec3 integrate(Ray ray, const Scene &scene, int maxDepth, RNG &rng);
+/**
+ * Closest hit of the camera ray, when it was already traced as part of a packet
+ */
+struct PrimaryHit {
+    bool hit;
+    Intersection record;
+};
 
-Vec3 integrateMIS(Ray ray, const Scene &scene, int maxDepth, bool regularize, RNG &rng);
\ No newline at end of file
+/**
+ * Russian roulette, past rrDepth bounces paths with throughput below 1 are terminated at random
+ * Survivors are reweighted so the estimate stays unbiased
+ * @return false if the path was terminated
+ */
+bool russianRoulette(Vec3 &beta, float etaScale, int depth, int rrDepth, Sampler &sampler);
+
+// Integrators stop paths at maxDepth bounces, and apply russian roulette after rrDepth
+// If given, pathLength is set to the number of surfaces the path hit
+// Differentials of the camera ray set the texture footprint at the first hit
+
+Vec3 integrateBasic(RayDifferential ray, const Scene &scene, int maxDepth, int rrDepth, Sampler &sampler, const PrimaryHit *primary = nullptr, int *pathLength = nullptr);
+
+Vec3 integrate(RayDifferential ray, const Scene &scene, int maxDepth, int rrDepth, Sampler &sampler, const PrimaryHit *primary = nullptr, int *pathLength = nullptr);
+
+Vec3 integrateMIS(RayDifferential ray, const Scene &scene, int maxDepth, int rrDepth, bool regularize, Sampler &sampler, const PrimaryHit *primary = nullptr, int *pathLength = nullptr);
\ No newline at end of file
@@ -0,0 +1,34 @@
+#include "environment.hpp"
+#include "../util/threadpool.hpp"
+
+EnvironmentMap::EnvironmentMap(TextureImage image)
+    : image_(std::move(image)) {
+    const int width  = image_.width();
+    const int height = image_.height();
+    columns_.resize(height);
+    std::vector<float> rowWeights(height);
+
+    // Each row only touches its own table and weight, so rows are built independently
+    constexpr int ROWS_PER_TASK = 16;
+    TaskGroup group;
+    for (int start = 0; start < height; start += ROWS_PER_TASK) {
+        group.run([&, start] {
+            std::vector<float> weights(width);
+            for (int y = start; y < std::min(start + ROWS_PER_TASK, height); ++y) {
+                // Texels near the poles cover less solid angle
+                const float sinTheta = std::sin((static_cast<float>(y) + 0.5f) / static_cast<float>(height) * PI);
+
+                double rowWeight = 0;
+                for (int x = 0; x < width; ++x) {
+                    weights[x] = jtx::max(maxComponent(image_.getTexel(x, y)), 0.0f) * sinTheta;
+                    rowWeight += weights[x];
+                }
+                columns_[y]   = AliasTable(weights);
+                rowWeights[y] = static_cast<float>(rowWeight);
+            }
+        });
+    }
+    group.wait();
+
+    rows_ = AliasTable(rowWeights);
+}
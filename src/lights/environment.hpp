@@ -0,0 +1,89 @@
+#pragma once
+
+#include "../image.hpp"
+#include "../sampling.hpp"
+#include "../util/aliastable.hpp"
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * Equirectangular (latitude-longitude) environment image with a piecewise-constant sampling distribution
+ * +y is up, the top row of the image maps to +y and u = 0 to +x. Radiance is looked up per texel, so the
+ * distribution matches it exactly and directions are sampled proportionally to the texel radiance times
+ * the solid angle it covers. Sampling picks a row, then a column within it, with one alias table each.
+ */
+class EnvironmentMap {
+public:
+    /**
+     * Builds the distribution, rows are split over the thread pool
+     */
+    explicit EnvironmentMap(TextureImage image);
+
+    /**
+     * @param dir direction away from the scene, does not need to be normalized
+     */
+    [[nodiscard]] Vec3 lookup(const Vec3 &dir) const {
+        int x, y;
+        texelOf(directionToUV(dir), x, y);
+        return image_.getTexel(x, y);
+    }
+
+    /**
+     * @param pdf solid angle pdf of the returned direction
+     * @return false if the map is black everywhere
+     */
+    bool sample(const Vec2f &u, Vec3 &dir, float &pdf) const {
+        float pRow, pColumn, uRow, uColumn;
+        const int y = rows_.sample(u[0], &pRow, &uRow);
+        if (y < 0) return false;
+        const int x = columns_[y].sample(u[1], &pColumn, &uColumn);
+
+        const Vec2f uv((static_cast<float>(x) + uColumn) / static_cast<float>(image_.width()),
+                       (static_cast<float>(y) + uRow) / static_cast<float>(image_.height()));
+        dir = uvToDirection(uv);
+        pdf = uvToSolidAnglePDF(pRow * pColumn, uv);
+        return pdf > 0;
+    }
+
+    [[nodiscard]] float pdf(const Vec3 &dir) const {
+        if (rows_.size() == 0) return 0;
+        const Vec2f uv = directionToUV(dir);
+        int x, y;
+        texelOf(uv, x, y);
+        if (columns_[y].size() == 0) return 0;
+        return uvToSolidAnglePDF(rows_.pmf(y) * columns_[y].pmf(x), uv);
+    }
+
+private:
+    TextureImage image_;
+    // Marginal over rows, then conditional over the columns of each row
+    AliasTable rows_;
+    std::vector<AliasTable> columns_;
+
+    static Vec2f directionToUV(const Vec3 &dir) {
+        const Vec3 d    = jtx::normalize(dir);
+        const float phi = std::atan2(d.z, d.x);
+        return {(phi < 0 ? phi + TWO_PI : phi) * INV_TWO_PI, std::acos(jtx::clamp(d.y, -1, 1)) * INV_PI};
+    }
+
+    static Vec3 uvToDirection(const Vec2f &uv) {
+        const float phi      = uv.x * TWO_PI;
+        const float theta    = uv.y * PI;
+        const float sinTheta = std::sin(theta);
+        return {sinTheta * std::cos(phi), std::cos(theta), sinTheta * std::sin(phi)};
+    }
+
+    void texelOf(const Vec2f &uv, int &x, int &y) const {
+        x = std::clamp(static_cast<int>(uv.x * static_cast<float>(image_.width())), 0, image_.width() - 1);
+        y = std::clamp(static_cast<int>(uv.y * static_cast<float>(image_.height())), 0, image_.height() - 1);
+    }
+
+    // A texel covers 1 / (width * height) of the uv square, and d(omega) = 2 pi^2 sin(theta) du dv
+    [[nodiscard]] float uvToSolidAnglePDF(const float texelPMF, const Vec2f &uv) const {
+        const float sinTheta = std::sin(uv.y * PI);
+        if (sinTheta == 0) return 0;
+        const float texels = static_cast<float>(image_.width()) * static_cast<float>(image_.height());
+        return texelPMF * texels / (2 * PI * PI * sinTheta);
+    }
+};
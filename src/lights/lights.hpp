@@ -2,9 +2,11 @@
 
 #include "../rt.hpp"
 #include "../sampling.hpp"
+#include "environment.hpp"
 
 // Plan to implement
 // - Point lights
+// - Triangle area lights
 // - Spotlight
 // - Directional Lights
 // - Uniform/Image Infinite Lights
@@ -25,6 +27,7 @@ struct LightSampleContext {
 struct Light {
     enum Type {
         POINT = 0,
+        TRIANGLE = 1,
         INFINITE = 2
     };
 
@@ -34,9 +37,25 @@ struct Light {
     float scale;
     float sceneRadius;
 
+    // TRIANGLE: position is the first vertex, all in world space
+    // Emits intensity * scale from both sides, like emissive materials
+    Vec3 v1, v2;
+
+    // INFINITE: radiance comes from this map instead of intensity when set, owned by the scene
+    const EnvironmentMap *environment = nullptr;
+
+    [[nodiscard]] Vec3 triangleNormal() const {
+        return jtx::normalize(jtx::cross(v1 - position, v2 - position));
+    }
+
+    [[nodiscard]] float triangleArea() const {
+        return 0.5f * jtx::cross(v1 - position, v2 - position).len();
+    }
+
     Vec3 evaluate(const Ray &r) const {
         switch (type) {
             case INFINITE:
+                if (environment) return scale * environment->lookup(r.dir);
                 return scale * intensity;
             default:
                 return {};
@@ -51,12 +70,34 @@ struct Light {
                 sample.radiance = scale * intensity / jtx::distanceSqr(position, ctx.p);
                 sample.pdf = 1;
                 return true;
+            case TRIANGLE: {
+                // Uniform over the area, converted to solid angle
+                const Vec3 b = sampleUniformTriangle(u);
+                sample.p     = b[0] * position + b[1] * v1 + b[2] * v2;
+
+                const Vec3 d      = sample.p - ctx.p;
+                const float dist2 = d.lenSqr();
+                const float area  = triangleArea();
+                if (dist2 == 0 || area == 0) return false;
+                sample.wi = d / jtx::sqrt(dist2);
+
+                const float cosTheta = jtx::absdot(triangleNormal(), sample.wi);
+                if (cosTheta == 0) return false;
+                sample.pdf      = dist2 / (cosTheta * area);
+                sample.radiance = scale * intensity;
+                return true;
+            }
             case INFINITE:
                 if (allowIncompletePDF) return false;
-                sample.wi = sampleUniformSphere(u);
-                sample.pdf = uniformSpherePDF();
-                sample.radiance = scale * intensity;
-                sample.p = ctx.p + sample.wi + 2 * sceneRadius;
+                if (environment) {
+                    if (!environment->sample(u, sample.wi, sample.pdf)) return false;
+                    sample.radiance = scale * environment->lookup(sample.wi);
+                } else {
+                    sample.wi = sampleUniformSphere(u);
+                    sample.pdf = uniformSpherePDF();
+                    sample.radiance = scale * intensity;
+                }
+                sample.p = ctx.p + sample.wi * 2 * sceneRadius;
                 return true;
             default:
                 return false;
@@ -67,8 +108,33 @@ struct Light {
         switch (type) {
             case POINT:
                 return 1;
+            case TRIANGLE: {
+                // Solid angle pdf of the point wi hits, 0 if it misses the triangle
+                const Vec3 dir  = jtx::normalize(wi);
+                const Vec3 e1   = v1 - position;
+                const Vec3 e2   = v2 - position;
+                const Vec3 pvec = jtx::cross(dir, e2);
+                const float det = jtx::dot(e1, pvec);
+                if (det == 0) return 0;
+
+                const float invDet = 1 / det;
+                const Vec3 tvec    = ctx.p - position;
+                const float b1     = jtx::dot(tvec, pvec) * invDet;
+                if (b1 < 0 || b1 > 1) return 0;
+                const Vec3 qvec = jtx::cross(tvec, e1);
+                const float b2  = jtx::dot(dir, qvec) * invDet;
+                if (b2 < 0 || b1 + b2 > 1) return 0;
+                const float t = jtx::dot(e2, qvec) * invDet;
+                if (t <= 0) return 0;
+
+                const float cosTheta = jtx::absdot(triangleNormal(), dir);
+                const float area     = triangleArea();
+                if (cosTheta == 0 || area == 0) return 0;
+                return t * t / (cosTheta * area);
+            }
             case INFINITE:
                 if (allowIncompletePDF) return 0;
+                if (environment) return environment->pdf(wi);
                 return uniformSpherePDF();
             default:
                 return 0;
@@ -0,0 +1,308 @@
+#include "lightsampler.hpp"
+#include "../util/color.hpp"
+
+#include <algorithm>
+
+static float safeAcos(const float x) {
+    return std::acos(jtx::clamp(x, -1, 1));
+}
+
+// cos(max(0, theta_a - theta_b)) from the sines and cosines of both angles
+static float cosSubClamped(const float sinTheta_a, const float cosTheta_a, const float sinTheta_b, const float cosTheta_b) {
+    if (cosTheta_a > cosTheta_b) return 1;
+    return cosTheta_a * cosTheta_b + sinTheta_a * sinTheta_b;
+}
+
+// sin(max(0, theta_a - theta_b))
+static float sinSubClamped(const float sinTheta_a, const float cosTheta_a, const float sinTheta_b, const float cosTheta_b) {
+    if (cosTheta_a > cosTheta_b) return 0;
+    return sinTheta_a * cosTheta_b - cosTheta_a * sinTheta_b;
+}
+
+// Rodrigues' rotation of v by theta around the unit axis k
+static Vec3 rotate(const Vec3 &v, const Vec3 &k, const float theta) {
+    const float c = std::cos(theta);
+    const float s = std::sin(theta);
+    return v * c + jtx::cross(k, v) * s + k * jtx::dot(k, v) * (1 - c);
+}
+
+float LightBounds::importance(const Vec3 &p, const Vec3 &n) const {
+    // Clamp the distance to the center so points inside the bounds don't blow up
+    const Vec3 pc           = 0.5f * bounds.pmin + 0.5f * bounds.pmax;
+    const float centerDist2 = jtx::distanceSqr(p, pc);
+    const float d2          = jtx::max(centerDist2, bounds.diagonal().len() / 2);
+    if (d2 == 0) return 0;
+
+    // Angle between the emission axis and the direction to p
+    const Vec3 wi    = centerDist2 > 0 ? (p - pc) / jtx::sqrt(centerDist2) : w;
+    float cosTheta_w = jtx::dot(w, wi);
+    if (twoSided) cosTheta_w = jtx::abs(cosTheta_w);
+    const float sinTheta_w = jtx::safeSqrt(1 - cosTheta_w * cosTheta_w);
+
+    // Half angle of the cone from p that contains the bounds, everything if p is inside them
+    const float radius = bounds.diagonal().len() / 2;
+    float cosTheta_b   = -1;
+    if (centerDist2 > radius * radius) {
+        cosTheta_b = jtx::safeSqrt(1 - radius * radius / centerDist2);
+    }
+    const float sinTheta_b = jtx::safeSqrt(1 - cosTheta_b * cosTheta_b);
+
+    // Smallest angle between the emission cone and any direction towards p
+    const float sinTheta_o = jtx::safeSqrt(1 - cosTheta_o * cosTheta_o);
+    const float cosTheta_x = cosSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+    const float sinTheta_x = sinSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+    const float cosTheta_p = cosSubClamped(sinTheta_x, cosTheta_x, sinTheta_b, cosTheta_b);
+    if (cosTheta_p <= cosTheta_e) return 0;
+
+    float result = phi * cosTheta_p / d2;
+
+    // Cosine at the receiving surface, bounded the same way
+    if (n) {
+        const float cosTheta_i  = jtx::absdot(wi, n);
+        const float sinTheta_i  = jtx::safeSqrt(1 - cosTheta_i * cosTheta_i);
+        const float cosThetap_i = cosSubClamped(sinTheta_i, cosTheta_i, sinTheta_b, cosTheta_b);
+        result *= cosThetap_i;
+    }
+
+    return jtx::max(result, 0.0f);
+}
+
+LightBounds unionBounds(const LightBounds &a, const LightBounds &b) {
+    if (a.phi == 0) return b;
+    if (b.phi == 0) return a;
+
+    // Smallest cone containing both emission cones
+    Vec3 w           = a.w;
+    float cosTheta_o = -1;
+
+    const float theta_a = safeAcos(a.cosTheta_o);
+    const float theta_b = safeAcos(b.cosTheta_o);
+    const float theta_d = safeAcos(jtx::dot(a.w, b.w));
+    if (jtx::min(theta_d + theta_b, PI) <= theta_a) {
+        cosTheta_o = a.cosTheta_o;
+    } else if (jtx::min(theta_d + theta_a, PI) <= theta_b) {
+        w          = b.w;
+        cosTheta_o = b.cosTheta_o;
+    } else {
+        const float theta_o = (theta_a + theta_d + theta_b) / 2;
+        const Vec3 wr       = jtx::cross(a.w, b.w);
+        if (theta_o < PI && wr.lenSqr() > 0) {
+            w          = rotate(a.w, jtx::normalize(wr), theta_o - theta_a);
+            cosTheta_o = std::cos(theta_o);
+        }
+    }
+
+    LightBounds result;
+    result.bounds     = AABB(a.bounds, b.bounds);
+    result.w          = w;
+    result.phi        = a.phi + b.phi;
+    result.cosTheta_o = cosTheta_o;
+    result.cosTheta_e = jtx::min(a.cosTheta_e, b.cosTheta_e);
+    result.twoSided   = a.twoSided || b.twoSided;
+    return result;
+}
+
+/**
+ * @return false for lights that cannot be bounded (infinite lights) or do not emit
+ */
+static bool lightBounds(const Light &light, LightBounds &lb) {
+    switch (light.type) {
+        case Light::POINT:
+            lb.bounds     = AABB(light.position, light.position);
+            lb.w          = {0, 0, 1};
+            lb.phi        = 4 * PI * light.scale * maxComponent(light.intensity);
+            lb.cosTheta_o = -1;
+            lb.cosTheta_e = 0;
+            lb.twoSided   = false;
+            return lb.phi > 0;
+        case Light::TRIANGLE:
+            lb.bounds     = AABB(light.position, light.v1).expand(light.v2);
+            lb.w          = light.triangleNormal();
+            lb.phi        = 2 * PI * light.scale * maxComponent(light.intensity) * light.triangleArea();
+            lb.cosTheta_o = 1;
+            lb.cosTheta_e = 0;
+            lb.twoSided   = true;
+            return lb.phi > 0;
+        default:
+            return false;
+    }
+}
+
+// Surface area orientation heuristic, cost of a node with these bounds
+static float evaluateCost(const LightBounds &b, const AABB &parentBounds, const int axis) {
+    const float theta_o    = safeAcos(b.cosTheta_o);
+    const float theta_e    = safeAcos(b.cosTheta_e);
+    const float theta_w    = jtx::min(theta_o + theta_e, PI);
+    const float sinTheta_o = jtx::safeSqrt(1 - b.cosTheta_o * b.cosTheta_o);
+    const float M_omega    = 2 * PI * (1 - b.cosTheta_o) +
+                             PI / 2 * (2 * theta_w * sinTheta_o - std::cos(theta_o - 2 * theta_w) - 2 * theta_o * sinTheta_o + b.cosTheta_o);
+
+    // Penalize thin slabs along the split axis
+    const Vec3 d   = parentBounds.diagonal();
+    const float Kr = d[axis] > 0 ? jtx::max(d.x, jtx::max(d.y, d.z)) / d[axis] : 1;
+    return b.phi * M_omega * Kr * b.bounds.surfaceArea();
+}
+
+void LightSampler::build(const std::vector<Light> &lights) {
+    lights_ = lights;
+    infiniteLights_.clear();
+    nodes_.clear();
+    bitTrails_.assign(lights_.size(), NOT_IN_BVH);
+
+    std::vector<std::pair<int, LightBounds>> bvhLights;
+    for (int i = 0; i < static_cast<int>(lights_.size()); ++i) {
+        LightBounds lb;
+        if (lights_[i].type == Light::INFINITE) {
+            infiniteLights_.push_back(i);
+        } else if (lightBounds(lights_[i], lb)) {
+            bvhLights.emplace_back(i, lb);
+        }
+    }
+
+    if (!bvhLights.empty()) {
+        nodes_.reserve(2 * bvhLights.size() - 1);
+        buildBVH(bvhLights, 0, static_cast<int>(bvhLights.size()), 0, 0);
+    }
+}
+
+int LightSampler::buildBVH(std::vector<std::pair<int, LightBounds>> &bvhLights, const int start, const int end, const uint64_t bitTrail, const int depth) {
+    if (end - start == 1) {
+        const int nodeIndex = static_cast<int>(nodes_.size());
+        nodes_.push_back({bvhLights[start].second, bvhLights[start].first, true});
+        bitTrails_[bvhLights[start].first] = bitTrail;
+        return nodeIndex;
+    }
+
+    AABB bounds, centroidBounds;
+    for (int i = start; i < end; ++i) {
+        const AABB &lb = bvhLights[i].second.bounds;
+        bounds.expand(lb);
+        centroidBounds.expand(0.5f * lb.pmin + 0.5f * lb.pmax);
+    }
+
+    // Bucketed split with the lowest cost, as in the SAH build of the scene BVH
+    constexpr int NUM_BUCKETS = 12;
+    float minCost             = INF;
+    int minBucket             = -1;
+    int minAxis               = -1;
+    for (int axis = 0; axis < 3; ++axis) {
+        const float cMin = centroidBounds.pmin[axis];
+        const float cMax = centroidBounds.pmax[axis];
+        if (cMax == cMin) continue;
+
+        LightBounds buckets[NUM_BUCKETS];
+        for (int i = start; i < end; ++i) {
+            const LightBounds &lb = bvhLights[i].second;
+            const float centroid  = 0.5f * lb.bounds.pmin[axis] + 0.5f * lb.bounds.pmax[axis];
+            const int b           = jtx::min(static_cast<int>(NUM_BUCKETS * (centroid - cMin) / (cMax - cMin)), NUM_BUCKETS - 1);
+            buckets[b]            = unionBounds(buckets[b], lb);
+        }
+
+        for (int split = 0; split < NUM_BUCKETS - 1; ++split) {
+            LightBounds b0, b1;
+            for (int i = 0; i <= split; ++i) b0 = unionBounds(b0, buckets[i]);
+            for (int i = split + 1; i < NUM_BUCKETS; ++i) b1 = unionBounds(b1, buckets[i]);
+
+            const float cost = evaluateCost(b0, bounds, axis) + evaluateCost(b1, bounds, axis);
+            if (cost > 0 && cost < minCost) {
+                minCost   = cost;
+                minBucket = split;
+                minAxis   = axis;
+            }
+        }
+    }
+
+    int mid;
+    if (minAxis == -1) {
+        mid = (start + end) / 2;
+    } else {
+        const float cMin = centroidBounds.pmin[minAxis];
+        const float cMax = centroidBounds.pmax[minAxis];
+        const auto it    = std::partition(bvhLights.begin() + start, bvhLights.begin() + end, [&](const auto &l) {
+            const float centroid = 0.5f * l.second.bounds.pmin[minAxis] + 0.5f * l.second.bounds.pmax[minAxis];
+            const int b          = jtx::min(static_cast<int>(NUM_BUCKETS * (centroid - cMin) / (cMax - cMin)), NUM_BUCKETS - 1);
+            return b <= minBucket;
+        });
+        mid = static_cast<int>(it - bvhLights.begin());
+        if (mid == start || mid == end) mid = (start + end) / 2;
+    }
+
+    // The bit trail only has room for 64 levels, halving from here on stays within that
+    if (depth >= 32) mid = (start + end) / 2;
+
+    const int nodeIndex = static_cast<int>(nodes_.size());
+    nodes_.push_back({});
+    const int child0 = buildBVH(bvhLights, start, mid, bitTrail, depth + 1);
+    const int child1 = buildBVH(bvhLights, mid, end, bitTrail | (1ull << depth), depth + 1);
+
+    nodes_[nodeIndex] = {unionBounds(nodes_[child0].lightBounds, nodes_[child1].lightBounds), child1, false};
+    return nodeIndex;
+}
+
+bool LightSampler::sample(const LightSampleContext &ctx, float u, SampledLight &sampled) const {
+    // Infinite lights are picked uniformly, with the BVH as one more option
+    const float pInfinite = infiniteProbability();
+    if (u < pInfinite) {
+        const int numInfinite = static_cast<int>(infiniteLights_.size());
+        const int index       = jtx::min<int>(u / pInfinite * numInfinite, numInfinite - 1);
+        sampled               = {&lights_[infiniteLights_[index]], infiniteLights_[index], pInfinite / numInfinite};
+        return true;
+    }
+
+    if (nodes_.empty()) return false;
+
+    // Rescale u so it can pick the children on the way down
+    u         = jtx::min((u - pInfinite) / (1 - pInfinite), 0x1.fffffep-1f);
+    float pmf = 1 - pInfinite;
+    int node  = 0;
+    while (true) {
+        const LightBVHNode &n = nodes_[node];
+        if (n.isLeaf) {
+            // A single light at the root is never tested on the way down
+            if (node > 0 || n.lightBounds.importance(ctx.p, ctx.n) > 0) {
+                sampled = {&lights_[n.childOrLightIndex], n.childOrLightIndex, pmf};
+                return true;
+            }
+            return false;
+        }
+
+        const float ci0 = nodes_[node + 1].lightBounds.importance(ctx.p, ctx.n);
+        const float ci1 = nodes_[n.childOrLightIndex].lightBounds.importance(ctx.p, ctx.n);
+        if (ci0 == 0 && ci1 == 0) return false;
+
+        const float p0 = ci0 / (ci0 + ci1);
+        if (u < p0) {
+            u = jtx::min(u / p0, 0x1.fffffep-1f);
+            pmf *= p0;
+            node = node + 1;
+        } else {
+            u = jtx::min((u - p0) / (1 - p0), 0x1.fffffep-1f);
+            pmf *= 1 - p0;
+            node = n.childOrLightIndex;
+        }
+    }
+}
+
+float LightSampler::pmf(const LightSampleContext &ctx, const int index) const {
+    if (lights_[index].type == Light::INFINITE) {
+        return 1.0f / static_cast<float>(infiniteLights_.size() + (nodes_.empty() ? 0 : 1));
+    }
+
+    uint64_t bitTrail = bitTrails_[index];
+    if (bitTrail == NOT_IN_BVH) return 0;
+
+    // Follow the path sample() takes to the light's leaf
+    float pmf = 1 - infiniteProbability();
+    int node  = 0;
+    while (!nodes_[node].isLeaf) {
+        const LightBVHNode &n = nodes_[node];
+        const float ci0       = nodes_[node + 1].lightBounds.importance(ctx.p, ctx.n);
+        const float ci1       = nodes_[n.childOrLightIndex].lightBounds.importance(ctx.p, ctx.n);
+        if (ci0 == 0 && ci1 == 0) return 0;
+
+        pmf *= (bitTrail & 1 ? ci1 : ci0) / (ci0 + ci1);
+        node = bitTrail & 1 ? n.childOrLightIndex : node + 1;
+        bitTrail >>= 1;
+    }
+    return pmf;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "../util/aabb.hpp"
+#include "lights.hpp"
+
+#include <vector>
+
+// Follows PBRTv4's BVHLightSampler
+// https://pbr-book.org/4ed/Light_Sources/Light_Sampling#BVHLightSampling
+
+/**
+ * Spatial and directional bounds of the emission of one or more lights
+ * Emission leaves within cosTheta_o of w, and falls off to zero cosTheta_e beyond that
+ */
+struct LightBounds {
+    AABB bounds;
+    Vec3 w;
+    // Total emitted power
+    float phi        = 0;
+    float cosTheta_o = 1;
+    float cosTheta_e = 1;
+    bool twoSided    = false;
+
+    /**
+     * Conservative estimate of the light arriving at p, on a surface with normal n
+     * n can be zero for points in media or on transmissive surfaces
+     */
+    [[nodiscard]] float importance(const Vec3 &p, const Vec3 &n) const;
+};
+
+LightBounds unionBounds(const LightBounds &a, const LightBounds &b);
+
+struct SampledLight {
+    const Light *light;
+    // Index passed to LightSampler::pmf
+    int index;
+    float pmf;
+};
+
+struct LightBVHNode {
+    LightBounds lightBounds;
+    // Second child for interior nodes, the first one directly follows its parent
+    int childOrLightIndex;
+    bool isLeaf;
+};
+
+/**
+ * Picks a light for next event estimation, proportional to how much it likely contributes at a point
+ * Bounded lights (point and area lights) are stored in a BVH whose nodes are weighed by power, distance
+ * and orientation. Infinite lights cannot be bounded and are picked uniformly with one extra slot for the BVH.
+ */
+class LightSampler {
+public:
+    /**
+     * Builds the BVH over all lights, the sampler keeps its own copy of them
+     * Lights are indexed in the given order
+     */
+    void build(const std::vector<Light> &lights);
+
+    bool sample(const LightSampleContext &ctx, float u, SampledLight &sampled) const;
+
+    /**
+     * Probability that sample() picks light index at ctx, for MIS
+     */
+    [[nodiscard]] float pmf(const LightSampleContext &ctx, int index) const;
+
+    [[nodiscard]] const Light &light(const int index) const {
+        return lights_[index];
+    }
+
+    [[nodiscard]] int numLights() const {
+        return static_cast<int>(lights_.size());
+    }
+
+private:
+    std::vector<Light> lights_;
+    std::vector<int> infiniteLights_;
+    std::vector<LightBVHNode> nodes_;
+    // Path from the root to each light's leaf, bit i picks the child at depth i
+    // Lights not in the BVH are marked with NOT_IN_BVH
+    std::vector<uint64_t> bitTrails_;
+
+    static constexpr uint64_t NOT_IN_BVH = ~0ull;
+
+    [[nodiscard]] float infiniteProbability() const {
+        const int numInfinite = static_cast<int>(infiniteLights_.size());
+        return static_cast<float>(numInfinite) / static_cast<float>(numInfinite + (nodes_.empty() ? 0 : 1));
+    }
+
+    int buildBVH(std::vector<std::pair<int, LightBounds>> &bvhLights, int start, int end, uint64_t bitTrail, int depth);
+};
@@ -15,6 +15,8 @@ constexpr int MAX_DEPTH      = 50;
 
 int main(int argc, char *argv[]) {
     Scene scene = createShaderBallScene();
+    // Optional equirectangular image (.hdr, .exr, ...) that replaces the constant background
+    if (argc > 1) scene.loadEnvironmentMap(argv[1]);
     scene.buildBVH();
 
 #ifndef DISABLE_UI
@@ -79,6 +81,17 @@ int main(int argc, char *argv[]) {
         std::string path = "frame_" + std::to_string(frame) + ".png";
         camera.save(path.c_str());
         std::cout << "Saved frame: " << path << std::endl;
+
+        const auto &stats = camera.renderStats();
+        std::cout << "Render time: " << stats.renderMs << " ms, " << stats.averageSpp << " spp, " << stats.averagePathLength << " average path length, idle per thread:";
+        for (const double idleMs: stats.threadIdleMs) std::cout << " " << idleMs;
+        std::cout << " ms" << std::endl;
+
+        if (const TextureCache *cache = scene.textureCache()) {
+            const TextureCacheStats cacheStats = cache->stats();
+            std::cout << "Texture cache: " << 100 * cacheStats.hitRate() << "% hits, " << cacheStats.tileLoads << " tiles loaded, "
+                      << cacheStats.evictions << " evicted, " << cacheStats.bytesResident / (1 << 20) << " MB resident" << std::endl;
+        }
     }
 
     std::cout << "Finished rendering" << std::endl;
@@ -2,6 +2,8 @@
 
 #include "util/color.hpp"
 
+#include <cmath>
+
 struct Material {
     enum Type {
         DIFFUSE = 0,
@@ -26,13 +28,55 @@ struct Intersection {
     Vec2f uv;
     Vec3 tangent;
     Vec3 bitangent;
+    // Partial derivatives of the point in uv, zero where there is no uv parameterization
+    Vec3 dpdu, dpdv;
+    // Texture footprint of the hit across a pixel, only set for camera rays by computeDifferentials()
+    Float dudx = 0, dvdx = 0, dudy = 0, dvdy = 0;
 
     const Material *material;
     Float t;
     bool frontFace;
+    // Index of the area light that was hit in Scene::lightSampler(), -1 if the surface is not one
+    int light = -1;
 
     void setFaceNormal(const Ray &r, const Vec3 &n) {
         frontFace = jtx::dot(r.dir, n) < 0;
         normal    = frontFace ? n : -n;
     }
+
+    /**
+     * Estimates the uv footprint from where the offset rays hit the tangent plane at point
+     * Follows PBRT's SurfaceInteraction::ComputeDifferentials
+     */
+    void computeDifferentials(const RayDifferential &r) {
+        dudx = dvdx = dudy = dvdy = 0;
+        if (!r.hasDifferentials) return;
+
+        const Float d     = jtx::dot(normal, point);
+        const Float dxDot = jtx::dot(normal, r.rxDirection);
+        const Float dyDot = jtx::dot(normal, r.ryDirection);
+        if (dxDot == 0 || dyDot == 0) return;
+        const Vec3 px   = r.rxOrigin + (d - jtx::dot(normal, r.rxOrigin)) / dxDot * r.rxDirection;
+        const Vec3 py   = r.ryOrigin + (d - jtx::dot(normal, r.ryOrigin)) / dyDot * r.ryDirection;
+        const Vec3 dpdx = px - point;
+        const Vec3 dpdy = py - point;
+
+        // Least squares solution of dpdx = dpdu * dudx + dpdv * dvdx, same for y
+        const Float ata00 = jtx::dot(dpdu, dpdu);
+        const Float ata01 = jtx::dot(dpdu, dpdv);
+        const Float ata11 = jtx::dot(dpdv, dpdv);
+        const Float det   = ata00 * ata11 - ata01 * ata01;
+        const Float invDet = 1 / det;
+        if (!std::isfinite(invDet)) return;
+
+        const Float atb0x = jtx::dot(dpdu, dpdx), atb1x = jtx::dot(dpdv, dpdx);
+        const Float atb0y = jtx::dot(dpdu, dpdy), atb1y = jtx::dot(dpdv, dpdy);
+
+        // Clamp grazing angles, the filters fall back to the coarsest level anyway
+        constexpr Float MAX_DERIVATIVE = 1e8f;
+        dudx = jtx::clamp((ata11 * atb0x - ata01 * atb1x) * invDet, -MAX_DERIVATIVE, MAX_DERIVATIVE);
+        dvdx = jtx::clamp((ata00 * atb1x - ata01 * atb0x) * invDet, -MAX_DERIVATIVE, MAX_DERIVATIVE);
+        dudy = jtx::clamp((ata11 * atb0y - ata01 * atb1y) * invDet, -MAX_DERIVATIVE, MAX_DERIVATIVE);
+        dvdy = jtx::clamp((ata00 * atb1y - ata01 * atb0y) * invDet, -MAX_DERIVATIVE, MAX_DERIVATIVE);
+    }
 };
@@ -4,6 +4,7 @@
 #include "material.hpp"
 #include "rt.hpp"
 #include "util/aabb.hpp"
+#include "util/affine.hpp"
 
 #include <complex>
 
@@ -20,10 +21,15 @@ struct Mesh {
     Vec2f *uvs;
     Material *material;
 
+    // False when the arrays point into memory owned elsewhere, e.g. a mapped scene cache
+    bool ownsData = true;
+
     Transform scale;
     Transform rX, rY, rZ;
     Transform translate;
 
+    // Applied by every instance of this mesh before the instance transform
+    // Geometry below stays in object space
     Transform transform;
 
     void recalculateTransform() {
@@ -71,9 +77,9 @@ struct Mesh {
     void getVertices(const int index, Vec3 &v0, Vec3 &v1, Vec3 &v2) const {
         const Vec3i i = indices[index];
 
-        v0 = transform.applyToPoint(vertices[i[0]]);
-        v1 = transform.applyToPoint(vertices[i[1]]);
-        v2 = transform.applyToPoint(vertices[i[2]]);
+        v0 = vertices[i[0]];
+        v1 = vertices[i[1]];
+        v2 = vertices[i[2]];
     }
 
     AABB tBounds(const int index) const {
@@ -91,9 +97,9 @@ struct Mesh {
 
     void getNormals(const int index, Vec3 &n0, Vec3 &n1, Vec3 &n2) const {
         const Vec3i i = indices[index];
-        n0            = transform.applyToNormal(normals[i[0]]);
-        n1            = transform.applyToNormal(normals[i[1]]);
-        n2            = transform.applyToNormal(normals[i[2]]);
+        n0            = normals[i[0]];
+        n1            = normals[i[1]];
+        n2            = normals[i[2]];
     }
 
     void getUVs(const int index, Vec2f &uv0, Vec2f &uv1, Vec2f &uv2) const {
@@ -103,7 +109,11 @@ struct Mesh {
         uv2           = uvs[i[2]];
     }
 
-    bool tClosestHit(const Ray &r, const Interval t, Intersection &record, const int index, float &b1, float &b2) const {
+    /**
+     * Moller-Trumbore test against triangle index, without touching the hit record
+     * b1 and b2 are the barycentrics of v1 and v2
+     */
+    bool tHit(const Ray &r, const Interval &t, const int index, float &root, float &b1, float &b2) const {
         Vec3 v0, v1, v2;
         getVertices(index, v0, v1, v2);
         const auto v0v1 = v1 - v0;
@@ -123,9 +133,22 @@ struct Mesh {
         b2               = r.dir.dot(qvec) * invDet;
         if (b2 < 0 || b1 + b2 > 1) return false;
 
-        const float root = v0v2.dot(qvec) * invDet;
-        if (!t.surrounds(root)) return false;
+        root = v0v2.dot(qvec) * invDet;
+        return t.surrounds(root);
+    }
+
+    bool tClosestHit(const Ray &r, const Interval t, Intersection &record, const int index, float &b1, float &b2) const {
+        float root;
+        if (!tHit(r, t, index, root, b1, b2)) return false;
 
+        tSetIntersection(r, index, root, b1, b2, record);
+        return true;
+    }
+
+    /**
+     * Fills in the hit record of triangle index from its hit distance and barycentrics
+     */
+    void tSetIntersection(const Ray &r, const int index, const float root, const float b1, const float b2, Intersection &record) const {
         record.t        = root;
         record.point    = r.at(root);
         record.material = material;
@@ -144,6 +167,21 @@ struct Mesh {
         getUVs(index, uv0, uv1, uv2);
         record.uv = uv0 * b0 + uv1 * b1 + uv2 * b2;
 
+        // Position derivatives in uv, for texture footprints
+        // https://pbr-book.org/4ed/Shapes/Triangle_Meshes#fragment-Computetrianglepartialderivatives-0
+        Vec3 p0, p1, p2;
+        getVertices(index, p0, p1, p2);
+        const Vec2f duv02 = uv0 - uv2, duv12 = uv1 - uv2;
+        const Vec3 dp02 = p0 - p2, dp12 = p1 - p2;
+        const float determinant = duv02.x * duv12.y - duv02.y * duv12.x;
+        if (determinant == 0) {
+            record.dpdu = record.dpdv = {};
+        } else {
+            const float invDet = 1 / determinant;
+            record.dpdu = (duv12.y * dp02 - duv02.y * dp12) * invDet;
+            record.dpdv = (duv02.x * dp12 - duv12.x * dp02) * invDet;
+        }
+
         // Tangent & bitangent
         // TODO: fix this
         // Taken from:
@@ -161,37 +199,15 @@ struct Mesh {
         //
         // record.tangent   = jtx::normalize((duv2.y * dp1 - duv1.y * dp2) * duvInvDet);
         // record.bitangent = jtx::normalize((duv1.x * dp2 - duv2.x * dp1) * duvInvDet);
-
-        return true;
     }
 
     bool tAnyHit(const Ray &r, const Interval t, const int index) const {
-        Vec3 v0, v1, v2;
-        getVertices(index, v0, v1, v2);
-        const auto v0v1 = v1 - v0;
-        const auto v0v2 = v2 - v0;
-        const auto pvec = jtx::cross(r.dir, v0v2);
-        const auto det  = v0v1.dot(pvec);
-
-        if (fabs(det) < 1e-8) return false;
-
-        const float invDet = 1 / det;
-        const auto tvec    = r.origin - v0;
-
-        const auto u = tvec.dot(pvec) * invDet;
-        if (u < 0 || u > 1) return false;
-
-        const auto qvec = tvec.cross(v0v1);
-        const auto v    = r.dir.dot(qvec) * invDet;
-        if (v < 0 || u + v > 1) return false;
-
-        const float root = v0v2.dot(qvec) * invDet;
-        if (!t.surrounds(root)) return false;
-
-        return true;
+        float root, b1, b2;
+        return tHit(r, t, index, root, b1, b2);
     }
 
     void destroy() const {
+        if (!ownsData) return;
         if (indices) delete[] indices;
         if (vertices) delete[] vertices;
         if (normals) delete[] normals;
@@ -202,4 +218,43 @@ struct Mesh {
 struct Triangle {
     int index;
     int meshIndex;
-};
\ No newline at end of file
+};
+
+/**
+ * Triangle stored as the affine map into its unit triangle space (Baldwin & Weber)
+ * v0 goes to the origin, the edges to the x and y axes and the normal to z,
+ * so a hit is a plane test along z followed by two barycentric checks
+ */
+struct PrecomputedTriangle {
+    Affine toUnit;
+
+    static PrecomputedTriangle fromVertices(const Vec3 &v0, const Vec3 &v1, const Vec3 &v2) {
+        const Vec3 e1 = v1 - v0;
+        const Vec3 e2 = v2 - v0;
+        const Vec3 n  = jtx::cross(e1, e2);
+
+        // Degenerate triangles get a zero matrix, which never passes the dz test below
+        if (n.lenSqr() == 0) return {{{0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}}};
+        return {Affine::fromColumns(e1, e2, n, v0).inverse()};
+    }
+
+    /**
+     * Barycentrics follow Mesh::tClosestHit, b1 and b2 weigh v1 and v2
+     */
+    bool hit(const Ray &r, const Interval &t, float &root, float &b1, float &b2) const {
+        const float dz = jtx::dot(toUnit.r2, r.dir);
+        if (dz == 0) return false;
+
+        const float oz = jtx::dot(toUnit.r2, r.origin) + toUnit.t.z;
+        root           = -oz / dz;
+        if (!t.surrounds(root)) return false;
+
+        b1 = jtx::dot(toUnit.r0, r.origin) + toUnit.t.x + root * jtx::dot(toUnit.r0, r.dir);
+        if (b1 < 0 || b1 > 1) return false;
+
+        b2 = jtx::dot(toUnit.r1, r.origin) + toUnit.t.y + root * jtx::dot(toUnit.r1, r.dir);
+        if (b2 < 0 || b1 + b2 > 1) return false;
+
+        return true;
+    }
+};
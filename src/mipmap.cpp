@@ -0,0 +1,205 @@
+#include "mipmap.hpp"
+#include "texturecache.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+// Gaussian falloff of the EWA filter, indexed by squared radius within the ellipse
+static constexpr int EWA_LUT_SIZE = 128;
+static const std::array<float, EWA_LUT_SIZE> EWA_WEIGHTS = [] {
+    constexpr float alpha = 2;
+    std::array<float, EWA_LUT_SIZE> weights{};
+    for (int i = 0; i < EWA_LUT_SIZE; ++i) {
+        const float r2 = static_cast<float>(i) / static_cast<float>(EWA_LUT_SIZE - 1);
+        weights[i]     = std::exp(-alpha * r2) - std::exp(-alpha);
+    }
+    return weights;
+}();
+
+MIPMap::MIPMap(const TextureImage &image, const Filter filter, const size_t compressAbove)
+    : filter_(filter) {
+    if (image.width() <= 0 || image.height() <= 0) return;
+
+    const TexelFormat format = image.format();
+    const bool compress      = format == TexelFormat::SRGB8 && compressAbove > 0 &&
+                          static_cast<size_t>(image.width()) * image.height() > compressAbove;
+
+    // Levels are filtered in full precision and only then stored in the image's format
+    int width  = image.width();
+    int height = image.height();
+    std::vector<Vec3> prev(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) prev[y * width + x] = image.texels().get(x, y);
+    }
+
+    Level base;
+    base.width  = width;
+    base.height = height;
+    base.texels = compress ? TexelBuffer::compressBC1(image.texels()) : image.texels();
+    pyramid_.push_back(std::move(base));
+
+    // Box filter down to 1x1, odd sizes fold their last row or column into the previous texel
+    while (width > 1 || height > 1) {
+        Level next;
+        next.width  = std::max(1, width / 2);
+        next.height = std::max(1, height / 2);
+        std::vector<Vec3> texels(static_cast<size_t>(next.width) * next.height);
+
+        for (int y = 0; y < next.height; ++y) {
+            const int y0 = y * height / next.height;
+            const int y1 = (y + 1) * height / next.height;
+            for (int x = 0; x < next.width; ++x) {
+                const int x0 = x * width / next.width;
+                const int x1 = (x + 1) * width / next.width;
+
+                Vec3 sum;
+                for (int sy = y0; sy < y1; ++sy) {
+                    for (int sx = x0; sx < x1; ++sx) {
+                        sum += prev[sy * width + sx];
+                    }
+                }
+                texels[y * next.width + x] = sum / static_cast<float>((x1 - x0) * (y1 - y0));
+            }
+        }
+
+        next.texels = TexelBuffer(format, next.width, next.height);
+        for (int y = 0; y < next.height; ++y) {
+            for (int x = 0; x < next.width; ++x) next.texels.set(x, y, texels[y * next.width + x]);
+        }
+        if (compress) next.texels = TexelBuffer::compressBC1(next.texels);
+
+        width  = next.width;
+        height = next.height;
+        prev   = std::move(texels);
+        pyramid_.push_back(std::move(next));
+    }
+}
+
+MIPMap::MIPMap(const TextureCache &cache, const int texture, const Filter filter)
+    : filter_(filter),
+      cache_(&cache),
+      texture_(texture) {
+    pyramid_.resize(cache.levels(texture));
+    for (int level = 0; level < levels(); ++level) {
+        pyramid_[level].width  = cache.width(texture, level);
+        pyramid_[level].height = cache.height(texture, level);
+    }
+}
+
+Vec3 MIPMap::texel(const int level, int x, int y) const {
+    const Level &l = pyramid_[level];
+    x %= l.width;
+    y %= l.height;
+    if (x < 0) x += l.width;
+    if (y < 0) y += l.height;
+    if (cache_) return cache_->texel(texture_, level, x, y);
+    return l.texels.get(x, y);
+}
+
+Vec3 MIPMap::filter(const Vec2f &st, Vec2f dst0, Vec2f dst1) const {
+    if (pyramid_.empty()) return {};
+
+    if (filter_ == BILINEAR) return bilerp(0, st);
+
+    if (filter_ == TRILINEAR) {
+        const float width = 2 * std::max({std::abs(dst0.x), std::abs(dst0.y), std::abs(dst1.x), std::abs(dst1.y)});
+        const float level = levelOf(width);
+        if (level <= 0) return bilerp(0, st);
+        if (level >= static_cast<float>(levels() - 1)) return texel(levels() - 1, 0, 0);
+
+        const int l0  = static_cast<int>(level);
+        const float d = level - static_cast<float>(l0);
+        return (1 - d) * bilerp(l0, st) + d * bilerp(l0 + 1, st);
+    }
+
+    // EWA, dst0 becomes the major axis
+    if (dst0.x * dst0.x + dst0.y * dst0.y < dst1.x * dst1.x + dst1.y * dst1.y) std::swap(dst0, dst1);
+    const float longer = std::sqrt(dst0.x * dst0.x + dst0.y * dst0.y);
+    float shorter      = std::sqrt(dst1.x * dst1.x + dst1.y * dst1.y);
+
+    // Very eccentric ellipses would cover a lot of texels, widen the minor axis and blur a bit instead
+    if (shorter > 0 && shorter * MAX_ANISOTROPY < longer) {
+        const float scale = longer / (shorter * MAX_ANISOTROPY);
+        dst1 = dst1 * scale;
+        shorter *= scale;
+    }
+    if (shorter == 0) return bilerp(0, st);
+
+    // Pick levels by the minor axis, so the ellipse spans a few texels there
+    const float level = std::max(0.0f, levelOf(shorter));
+    const int l0      = static_cast<int>(level);
+    const float d     = level - static_cast<float>(l0);
+    if (d == 0) return ewa(l0, st, dst0, dst1);
+    return (1 - d) * ewa(l0, st, dst0, dst1) + d * ewa(l0 + 1, st, dst0, dst1);
+}
+
+float MIPMap::levelOf(const float width) const {
+    const float resolution = static_cast<float>(std::max(pyramid_[0].width, pyramid_[0].height));
+    return std::log2(std::max(width * resolution, 1e-8f));
+}
+
+Vec3 MIPMap::bilerp(const int level, const Vec2f &st) const {
+    const Level &l = pyramid_[level];
+    // Texel centers are at half integers
+    const float x  = st.x * static_cast<float>(l.width) - 0.5f;
+    const float y  = st.y * static_cast<float>(l.height) - 0.5f;
+    const float fx = std::floor(x);
+    const float fy = std::floor(y);
+    const float dx = x - fx;
+    const float dy = y - fy;
+    const int x0   = static_cast<int>(fx);
+    const int y0   = static_cast<int>(fy);
+
+    return (1 - dx) * (1 - dy) * texel(level, x0, y0) + dx * (1 - dy) * texel(level, x0 + 1, y0) +
+           (1 - dx) * dy * texel(level, x0, y0 + 1) + dx * dy * texel(level, x0 + 1, y0 + 1);
+}
+
+Vec3 MIPMap::ewa(const int level, Vec2f st, Vec2f dst0, Vec2f dst1) const {
+    if (level >= levels()) return texel(levels() - 1, 0, 0);
+
+    // Work in texel units of this level
+    const Level &l    = pyramid_[level];
+    const float width = static_cast<float>(l.width), height = static_cast<float>(l.height);
+    st.x              = st.x * width - 0.5f;
+    st.y              = st.y * height - 0.5f;
+    dst0.x *= width;
+    dst0.y *= height;
+    dst1.x *= width;
+    dst1.y *= height;
+
+    // Implicit ellipse A s^2 + B s t + C t^2 = 1, widened by a texel so it never falls between them
+    float A = dst0.y * dst0.y + dst1.y * dst1.y + 1;
+    float B = -2 * (dst0.x * dst0.y + dst1.x * dst1.y);
+    float C = dst0.x * dst0.x + dst1.x * dst1.x + 1;
+    const float invF = 1 / (A * C - B * B * 0.25f);
+    A *= invF;
+    B *= invF;
+    C *= invF;
+
+    // Bounding box of the ellipse
+    const float det    = -B * B + 4 * A * C;
+    const float invDet = 1 / det;
+    const float uSqrt  = std::sqrt(std::max(det * C, 0.0f));
+    const float vSqrt  = std::sqrt(std::max(A * det, 0.0f));
+    const int s0       = static_cast<int>(std::ceil(st.x - 2 * invDet * uSqrt));
+    const int s1       = static_cast<int>(std::floor(st.x + 2 * invDet * uSqrt));
+    const int t0       = static_cast<int>(std::ceil(st.y - 2 * invDet * vSqrt));
+    const int t1       = static_cast<int>(std::floor(st.y + 2 * invDet * vSqrt));
+
+    Vec3 sum;
+    float sumWeights = 0;
+    for (int it = t0; it <= t1; ++it) {
+        const float tt = static_cast<float>(it) - st.y;
+        for (int is = s0; is <= s1; ++is) {
+            const float ss = static_cast<float>(is) - st.x;
+            const float r2 = A * ss * ss + B * ss * tt + C * tt * tt;
+            if (r2 < 1) {
+                const float weight = EWA_WEIGHTS[std::min(static_cast<int>(r2 * EWA_LUT_SIZE), EWA_LUT_SIZE - 1)];
+                sum += weight * texel(level, is, it);
+                sumWeights += weight;
+            }
+        }
+    }
+    return sumWeights > 0 ? sum / sumWeights : bilerp(level, {(st.x + 0.5f) / width, (st.y + 0.5f) / height});
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "image.hpp"
+
+#include <vector>
+
+class TextureCache;
+
+// Follows PBRTv4's MIPMap
+// https://pbr-book.org/4ed/Textures_and_Materials/Image_Texture_Evaluation#MIPMapping
+
+/**
+ * Image pyramid of a texture, each level half the resolution of the previous one down to a single texel
+ * Lookups take the uv footprint of the hit (see Intersection::computeDifferentials) and read from the
+ * levels whose texels are about as large as the footprint, so minified textures neither alias nor touch
+ * more than a few cache lines of the full resolution image.
+ * Texture coordinates wrap around, and v = 0 is the first row like in TextureImage::getTexel.
+ * The levels are either held in memory, or streamed tile by tile from a TextureCache.
+ */
+class MIPMap {
+public:
+    enum Filter {
+        // Bilinear on the finest level, ignores the footprint
+        BILINEAR = 0,
+        // Blends bilinear lookups on the two levels around the footprint width
+        TRILINEAR = 1,
+        // Gaussian weighted average over the elliptical footprint, keeps anisotropic footprints sharp
+        EWA = 2
+    };
+
+    MIPMap() = default;
+
+    /**
+     * The levels keep the texel format of the image
+     * @param compressAbove 8 bit images with more texels than this are block compressed (BC1), 0 never compresses
+     */
+    explicit MIPMap(const TextureImage &image, Filter filter = TRILINEAR, size_t compressAbove = 0);
+
+    /**
+     * Reads the levels of a texture added to cache, which has to outlive the MIP map
+     */
+    MIPMap(const TextureCache &cache, int texture, Filter filter = TRILINEAR);
+
+    /**
+     * @param dst0 change of st across a pixel in x, (dudx, dvdx)
+     * @param dst1 change of st across a pixel in y, (dudy, dvdy)
+     */
+    [[nodiscard]] Vec3 filter(const Vec2f &st, Vec2f dst0, Vec2f dst1) const;
+
+    [[nodiscard]] int levels() const {
+        return static_cast<int>(pyramid_.size());
+    }
+
+    [[nodiscard]] int width(const int level) const {
+        return pyramid_[level].width;
+    }
+
+    [[nodiscard]] int height(const int level) const {
+        return pyramid_[level].height;
+    }
+
+    /**
+     * Unfiltered texel, x and y wrap around
+     */
+    [[nodiscard]] Vec3 texel(int level, int x, int y) const;
+
+    /**
+     * Stored texels of a level, empty when streamed from a TextureCache
+     */
+    [[nodiscard]] const TexelBuffer &texels(const int level) const {
+        return pyramid_[level].texels;
+    }
+
+private:
+    struct Level {
+        int width  = 0;
+        int height = 0;
+        // Empty when streamed from cache_
+        TexelBuffer texels;
+    };
+
+    // Level 0 is the full resolution image
+    std::vector<Level> pyramid_;
+    Filter filter_ = TRILINEAR;
+
+    const TextureCache *cache_ = nullptr;
+    int texture_               = -1;
+
+    // EWA footprints are shortened to at most this ratio between their axes, bounding the texels read
+    static constexpr float MAX_ANISOTROPY = 8;
+
+    // Continuous level whose texels are width wide in st
+    [[nodiscard]] float levelOf(float width) const;
+
+    [[nodiscard]] Vec3 bilerp(int level, const Vec2f &st) const;
+    [[nodiscard]] Vec3 ewa(int level, Vec2f st, Vec2f dst0, Vec2f dst1) const;
+};
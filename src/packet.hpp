@@ -0,0 +1,146 @@
+#pragma once
+
+#include "rt.hpp"
+#include "util/aabb.hpp"
+
+#include <bit>
+#include <cstdint>
+
+/**
+ * Batch of N rays stored as SoA, for tracing coherent rays (e.g. a block of primary rays) together
+ * Lanes outside the active mask are ignored, tMax is shrunk in place as hits are found
+ */
+template<int N>
+struct RayPacket {
+    static_assert(N <= 32, "Lane masks are 32 bit");
+
+    // Zeroed so inactive lanes still hold defined values for the full-width loops
+    float ox[N]{}, oy[N]{}, oz[N]{};
+    float dx[N]{}, dy[N]{}, dz[N]{};
+    float time[N]{};
+    float tMin[N]{}, tMax[N]{};
+    uint32_t active = 0;
+
+    void set(const int lane, const Ray &r, const Interval &t) {
+        ox[lane]   = r.origin.x;
+        oy[lane]   = r.origin.y;
+        oz[lane]   = r.origin.z;
+        dx[lane]   = r.dir.x;
+        dy[lane]   = r.dir.y;
+        dz[lane]   = r.dir.z;
+        time[lane] = r.time;
+        tMin[lane] = t.min;
+        tMax[lane] = t.max;
+        active |= 1u << lane;
+    }
+
+    [[nodiscard]] Ray ray(const int lane) const {
+        return {Vec3(ox[lane], oy[lane], oz[lane]), Vec3(dx[lane], dy[lane], dz[lane]), time[lane]};
+    }
+
+    [[nodiscard]] Interval interval(const int lane) const {
+        return {tMin[lane], tMax[lane]};
+    }
+
+    /**
+     * Packets only pay off when all rays cross the BVH in the same order
+     * This requires matching direction signs on every axis, otherwise callers trace lanes one at a time
+     */
+    [[nodiscard]] bool coherent() const {
+        if (!active) return false;
+        const int first = std::countr_zero(active);
+        const bool nx = dx[first] < 0, ny = dy[first] < 0, nz = dz[first] < 0;
+
+        for (uint32_t mask = active; mask; mask &= mask - 1) {
+            const int i = std::countr_zero(mask);
+            // Zero components make the interval bounds below undefined
+            if (dx[i] == 0 || dy[i] == 0 || dz[i] == 0) return false;
+            if ((dx[i] < 0) != nx || (dy[i] < 0) != ny || (dz[i] < 0) != nz) return false;
+        }
+        return true;
+    }
+};
+
+using RayPacket4  = RayPacket<4>;
+using RayPacket8  = RayPacket<8>;
+using RayPacket16 = RayPacket<16>;
+
+/**
+ * Per-traversal data for a coherent packet
+ * Holds the reciprocal directions and the interval hull of origins and reciprocals over the active lanes
+ */
+template<int N>
+struct TraversalPacket {
+    float ix[N], iy[N], iz[N];
+    int dirIsNeg[3];
+
+    Vec3 oLo, oHi;
+    Vec3 iLo, iHi;
+
+    explicit TraversalPacket(const RayPacket<N> &p) {
+        oLo = iLo = Vec3(INF, INF, INF);
+        oHi = iHi = Vec3(-INF, -INF, -INF);
+        for (int i = 0; i < N; ++i) {
+            ix[i] = 1 / p.dx[i];
+            iy[i] = 1 / p.dy[i];
+            iz[i] = 1 / p.dz[i];
+        }
+        for (uint32_t mask = p.active; mask; mask &= mask - 1) {
+            const int i = std::countr_zero(mask);
+            oLo         = jtx::min(oLo, Vec3(p.ox[i], p.oy[i], p.oz[i]));
+            oHi         = jtx::max(oHi, Vec3(p.ox[i], p.oy[i], p.oz[i]));
+            iLo         = jtx::min(iLo, Vec3(ix[i], iy[i], iz[i]));
+            iHi         = jtx::max(iHi, Vec3(ix[i], iy[i], iz[i]));
+        }
+        // Packet is coherent, so any lane gives the shared signs
+        const int first = std::countr_zero(p.active);
+        dirIsNeg[0]     = p.dx[first] < 0;
+        dirIsNeg[1]     = p.dy[first] < 0;
+        dirIsNeg[2]     = p.dz[first] < 0;
+    }
+
+    /**
+     * Interval arithmetic bound over the whole packet
+     * Returns false only if no active ray can hit the box within [tMin, tMax]
+     */
+    [[nodiscard]] bool mayHit(const AABB &b, const float tMin, const float tMax) const {
+        float t0 = tMin, t1 = tMax;
+        for (int a = 0; a < 3; ++a) {
+            const float n = dirIsNeg[a] ? b.pmax[a] : b.pmin[a];
+            const float f = dirIsNeg[a] ? b.pmin[a] : b.pmax[a];
+
+            // (plane - [oLo, oHi]) * [iLo, iHi], taking the loosest end
+            const float n0 = (n - oHi[a]) * iLo[a], n1 = (n - oHi[a]) * iHi[a];
+            const float n2 = (n - oLo[a]) * iLo[a], n3 = (n - oLo[a]) * iHi[a];
+            const float f0 = (f - oHi[a]) * iLo[a], f1 = (f - oHi[a]) * iHi[a];
+            const float f2 = (f - oLo[a]) * iLo[a], f3 = (f - oLo[a]) * iHi[a];
+
+            t0 = jtx::max(t0, jtx::min(jtx::min(n0, n1), jtx::min(n2, n3)));
+            t1 = jtx::min(t1, jtx::max(jtx::max(f0, f1), jtx::max(f2, f3)));
+        }
+        return t0 <= t1;
+    }
+
+    /**
+     * Exact slab test for every lane in mask
+     * @return lanes of mask that hit the box
+     */
+    [[nodiscard]] uint32_t hit(const AABB &b, const RayPacket<N> &p, const uint32_t mask) const {
+        const float nx = dirIsNeg[0] ? b.pmax.x : b.pmin.x, fx = dirIsNeg[0] ? b.pmin.x : b.pmax.x;
+        const float ny = dirIsNeg[1] ? b.pmax.y : b.pmin.y, fy = dirIsNeg[1] ? b.pmin.y : b.pmax.y;
+        const float nz = dirIsNeg[2] ? b.pmax.z : b.pmin.z, fz = dirIsNeg[2] ? b.pmin.z : b.pmax.z;
+
+        // Written over all lanes so the compiler can vectorize it
+        uint32_t result = 0;
+        for (int i = 0; i < N; ++i) {
+            const float t0 = jtx::max(jtx::max((nx - p.ox[i]) * ix[i], (ny - p.oy[i]) * iy[i]),
+                                      jtx::max((nz - p.oz[i]) * iz[i], p.tMin[i]));
+            float t1       = jtx::min(jtx::min((fx - p.ox[i]) * ix[i], (fy - p.oy[i]) * iy[i]), (fz - p.oz[i]) * iz[i]);
+#ifdef ROBUST_TRAVERSAL
+            t1 *= SLAB_FAR_SCALE;
+#endif
+            result |= static_cast<uint32_t>(t0 <= jtx::min(t1, p.tMax[i])) << i;
+        }
+        return result & mask;
+    }
+};
@@ -7,6 +7,7 @@ struct Primitive {
     enum Type {
         SPHERE = 0,
         TRIANGLE = 1,
+        INSTANCE = 2,
     };
 
     Type type;
@@ -36,7 +37,10 @@ public:
         const auto r = Vec3(radius, radius, radius);
     }
 
-    bool closestHit(const Ray &r, const Interval t, Intersection &record) const {
+    /**
+     * Finds the closest root inside t without touching the hit record
+     */
+    bool hit(const Ray &r, const Interval &t, Float &root) const {
         const auto currentCenter = center_.at(r.time);
         const Vec3 oc            = currentCenter - r.origin;
         const Float a            = r.dir.lenSqr();
@@ -49,44 +53,34 @@ public:
         }
 
         const auto sqrtd = jtx::sqrt(discriminant);
-        auto root        = (h - sqrtd) / a;
+        root             = (h - sqrtd) / a;
         if (!t.surrounds(root)) {
             root = (h + sqrtd) / a;
             if (!t.surrounds(root)) {
                 return false;
             }
         }
+        return true;
+    }
 
+    void setIntersection(const Ray &r, const Float root, Intersection &record) const {
         record.t     = root;
         record.point = r.at(root);
-        const auto n = (record.point - currentCenter) / radius_;
+        const auto n = (record.point - center_.at(r.time)) / radius_;
         record.setFaceNormal(r, n);
         record.material = material_;
+    }
 
+    bool closestHit(const Ray &r, const Interval t, Intersection &record) const {
+        Float root;
+        if (!hit(r, t, root)) return false;
+        setIntersection(r, root, record);
         return true;
     }
 
     bool anyHit(const Ray &r, const Interval t) const {
-        const auto currentCenter = center_.at(r.time);
-        const Vec3 oc            = currentCenter - r.origin;
-        const Float a            = r.dir.lenSqr();
-        const Float h            = jtx::dot(r.dir, oc);
-        const Float c            = oc.lenSqr() - radius_ * radius_;
-
-        const Float discriminant = h * h - a * c;
-        if (discriminant < 0) {
-            return false;
-        }
-
-        const auto sqrtd = jtx::sqrt(discriminant);
-        auto root        = (h - sqrtd) / a;
-        if (!t.surrounds(root)) {
-            root = (h + sqrtd) / a;
-            if (!t.surrounds(root)) {
-                return false;
-            }
-        }
-        return true;
+        Float root;
+        return hit(r, t, root);
     }
 
     AABB bounds() const {
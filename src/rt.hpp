@@ -39,6 +39,31 @@ template<typename T>
 using span = std::span<T>;
 #endif
 
+/**
+ * Ray with offset rays through the neighbouring pixels in x and y, used to size texture footprints
+ * Converting from a plain Ray leaves hasDifferentials unset, which is what bounce rays get
+ */
+struct RayDifferential : Ray {
+    Vec3 rxOrigin, ryOrigin;
+    Vec3 rxDirection, ryDirection;
+    bool hasDifferentials = false;
+
+    RayDifferential() = default;
+
+    RayDifferential(const Ray &r)
+        : Ray(r) {}
+
+    /**
+     * Scales the offsets, e.g. to the spacing between samples rather than pixels
+     */
+    void scaleDifferentials(const Float s) {
+        rxOrigin    = origin + (rxOrigin - origin) * s;
+        ryOrigin    = origin + (ryOrigin - origin) * s;
+        rxDirection = dir + (rxDirection - dir) * s;
+        ryDirection = dir + (ryDirection - dir) * s;
+    }
+};
+
 inline Float radians(const Float degrees) {
     return degrees * PI / static_cast<float>(180.0);
 }
\ No newline at end of file
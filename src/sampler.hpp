@@ -0,0 +1,177 @@
+#pragma once
+
+#include "rt.hpp"
+#include "util/lowdiscrepancy.hpp"
+#include "util/rand.hpp"
+
+#include <bit>
+
+/**
+ * Source of the sample values for one pixel sample
+ * startPixelSample() selects the pixel and sample index, then every get1D()/get2D() call consumes the next
+ * dimension(s). As long as a path draws its dimensions in the same order, low discrepancy samplers keep
+ * the samples of each dimension well distributed over the pixel's samples.
+ */
+class Sampler {
+public:
+    enum Type {
+        INDEPENDENT = 0,
+        STRATIFIED  = 1,
+        SOBOL       = 2,
+        ZSOBOL      = 3
+    };
+
+    Sampler() = default;
+
+    /**
+     * @param width, height image resolution, ZSOBOL orders its samples along a Morton curve over the image
+     */
+    Sampler(const Type type, const int xPixelSamples, const int yPixelSamples, const int width, const int height, const uint32_t seed = 0)
+        : type_(type),
+          xPixelSamples_(xPixelSamples),
+          yPixelSamples_(yPixelSamples),
+          seed_(seed) {
+        // ZSobol works on power of 2 sample counts, other counts round up and lose some stratification
+        const auto spp        = static_cast<uint32_t>(jtx::max(samplesPerPixel(), 1));
+        log2SamplesPerPixel_  = std::bit_width(std::bit_ceil(spp)) - 1;
+        const auto resolution = std::bit_ceil(static_cast<uint32_t>(jtx::max(jtx::max(width, height), 1)));
+        const int log4Samples = (log2SamplesPerPixel_ + 1) / 2;
+        numBase4Digits_       = std::bit_width(resolution) - 1 + log4Samples;
+    }
+
+    [[nodiscard]] Type type() const {
+        return type_;
+    }
+
+    [[nodiscard]] int samplesPerPixel() const {
+        return xPixelSamples_ * yPixelSamples_;
+    }
+
+    void startPixelSample(const Vec2i &pixel, const int sampleIndex, const int dimension = 0) {
+        pixel_       = pixel;
+        sampleIndex_ = sampleIndex;
+        dimension_   = dimension;
+
+        switch (type_) {
+            case INDEPENDENT:
+            case STRATIFIED:
+                // Seeds with FNV1-a
+                // PCG via RXS-M-XS
+                rng_ = RNG(fnv1a_4(pixel.y, pixel.x, sampleIndex + 1, seed_));
+                break;
+            case ZSOBOL:
+                mortonIndex_ = (encodeMorton2(pixel.x, pixel.y) << log2SamplesPerPixel_) | static_cast<uint64_t>(sampleIndex);
+                break;
+            default:
+                break;
+        }
+    }
+
+    float get1D() {
+        switch (type_) {
+            case STRATIFIED: {
+                const int spp     = samplesPerPixel();
+                const int stratum = permutationElement(sampleIndex_, spp, hash(pixel_, dimension_, seed_));
+                dimension_++;
+                return (static_cast<float>(stratum) + rng_.sample<float>()) / static_cast<float>(spp);
+            }
+            case SOBOL: {
+                const uint64_t h = hash(pixel_, dimension_, seed_);
+                const int index  = permutationElement(sampleIndex_, samplesPerPixel(), h);
+                dimension_++;
+                return sobolSample(index, 0, h >> 32);
+            }
+            case ZSOBOL: {
+                const uint64_t index = zSobolIndex();
+                dimension_++;
+                return sobolSample(index, 0, hash(dimension_, seed_));
+            }
+            default:
+                dimension_++;
+                return rng_.sample<float>();
+        }
+    }
+
+    Vec2f get2D() {
+        switch (type_) {
+            case STRATIFIED: {
+                const int stratum = permutationElement(sampleIndex_, samplesPerPixel(), hash(pixel_, dimension_, seed_));
+                dimension_ += 2;
+                const int x    = stratum % xPixelSamples_;
+                const int y    = stratum / xPixelSamples_;
+                const float dx = rng_.sample<float>();
+                const float dy = rng_.sample<float>();
+                return {(x + dx) / xPixelSamples_, (y + dy) / yPixelSamples_};
+            }
+            case SOBOL: {
+                const uint64_t h = hash(pixel_, dimension_, seed_);
+                const int index  = permutationElement(sampleIndex_, samplesPerPixel(), h);
+                dimension_ += 2;
+                return {sobolSample(index, 0, static_cast<uint32_t>(h)), sobolSample(index, 1, h >> 32)};
+            }
+            case ZSOBOL: {
+                const uint64_t index = zSobolIndex();
+                dimension_ += 2;
+                const uint64_t h = hash(dimension_, seed_);
+                return {sobolSample(index, 0, static_cast<uint32_t>(h)), sobolSample(index, 1, h >> 32)};
+            }
+            default:
+                dimension_ += 2;
+                return rng_.sample<Vec2f>();
+        }
+    }
+
+    /**
+     * Position within the pixel, drawn first so all samplers stratify it
+     */
+    Vec2f getPixel2D() {
+        return get2D();
+    }
+
+private:
+    Type type_         = INDEPENDENT;
+    int xPixelSamples_ = 1;
+    int yPixelSamples_ = 1;
+    uint32_t seed_     = 0;
+
+    // ZSobol
+    int log2SamplesPerPixel_ = 0;
+    int numBase4Digits_      = 0;
+    uint64_t mortonIndex_    = 0;
+
+    Vec2i pixel_     = {0, 0};
+    int sampleIndex_ = 0;
+    int dimension_   = 0;
+    RNG rng_;
+
+    /**
+     * Sobol index of the current sample for ZSobol (Ahmed and Wonka, "Screen-Space Blue-Noise Diffusion of
+     * Monte Carlo Sampling Error via Hierarchical Ordering of Pixels")
+     * The base 4 digits of the Morton index are randomly permuted per dimension, so consecutive pixels
+     * take well distributed, disjoint parts of one Sobol sequence.
+     */
+    [[nodiscard]] uint64_t zSobolIndex() const {
+        static constexpr uint8_t PERMUTATIONS[24][4] = {
+                {0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 1, 3}, {0, 2, 3, 1}, {0, 3, 1, 2}, {0, 3, 2, 1},
+                {1, 0, 2, 3}, {1, 0, 3, 2}, {1, 2, 0, 3}, {1, 2, 3, 0}, {1, 3, 0, 2}, {1, 3, 2, 0},
+                {2, 0, 1, 3}, {2, 0, 3, 1}, {2, 1, 0, 3}, {2, 1, 3, 0}, {2, 3, 0, 1}, {2, 3, 1, 0},
+                {3, 0, 1, 2}, {3, 0, 2, 1}, {3, 1, 0, 2}, {3, 1, 2, 0}, {3, 2, 0, 1}, {3, 2, 1, 0}};
+
+        uint64_t index = 0;
+        // With an odd power of 2 samples per pixel, the last digit is base 2
+        const bool base2Digit = log2SamplesPerPixel_ & 1;
+        const int lastDigit   = base2Digit ? 1 : 0;
+        for (int i = numBase4Digits_ - 1; i >= lastDigit; --i) {
+            const int digitShift        = 2 * i - (base2Digit ? 1 : 0);
+            const uint64_t higherDigits = mortonIndex_ >> (digitShift + 2);
+            const int p                 = static_cast<int>((mixBits(higherDigits ^ (0x55555555u * dimension_)) >> 24) % 24);
+            const int digit             = PERMUTATIONS[p][(mortonIndex_ >> digitShift) & 3];
+            index |= static_cast<uint64_t>(digit) << digitShift;
+        }
+        if (base2Digit) {
+            const int digit = static_cast<int>(mortonIndex_ & 1);
+            index |= digit ^ (mixBits((mortonIndex_ >> 1) ^ (0x55555555u * dimension_)) & 1);
+        }
+        return index;
+    }
+};
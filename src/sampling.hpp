@@ -9,7 +9,7 @@ constexpr float INV_4_PI = 1.0f / (4.0f * PI);
 
 inline Vec3 sampleUniformSphere(Vec2f u) {
     // $z = 1 - 2\xi_1$
-    const float z = 1 - 2 * u[1];
+    const float z = 1 - 2 * u[0];
     // $\sqrt{1 - z^2}$
     const float a = jtx::safeSqrt(1 - z * z);
     // $2\pi\xi_2$
@@ -45,6 +45,22 @@ inline Vec2f sampleUniformDiskConcentric(const Vec2f &u) {
     return {r * jtx::cos(theta), r * jtx::sin(theta)};
 }
 
+/**
+ * Uniformly samples barycentrics over a triangle, without the square root of the classic warp
+ * Heitz, "A Low-Distortion Map Between Triangle and Square"
+ */
+inline Vec3 sampleUniformTriangle(const Vec2f &u) {
+    float b0, b1;
+    if (u.x < u.y) {
+        b0 = u.x / 2;
+        b1 = u.y - b0;
+    } else {
+        b1 = u.y / 2;
+        b0 = u.x - b1;
+    }
+    return {b0, b1, 1 - b0 - b1};
+}
+
 inline Vec3 sampleUniformHemisphere(Vec2f u) {
     const float sinTheta = jtx::safeSqrt(1 - u.x * u.x);
     const float phi = 2 * PI * u.y;
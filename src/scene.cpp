@@ -1,105 +1,302 @@
 #include "scene.hpp"
+#include "gltf.hpp"
 #include "mesh.hpp"
+#include "util/threadpool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
 #include <unordered_map>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
 static constexpr int SCENE_MATERIAL_LIMIT = 64;
+// Smaller BLASes build faster than their file is found and read
+static constexpr int BLAS_CACHE_MIN_TRIANGLES = 4096;
+// Vertices or faces converted per task when loading meshes
+static constexpr size_t MESH_IMPORT_CHUNK = 1 << 16;
 
 bool Scene::closestHit(const Ray &r, Interval t, Intersection &record) const {
-    const auto invDir     = 1 / r.dir;
-    const int dirIsNeg[3] = {static_cast<int>(invDir.x < 0), static_cast<int>(invDir.y < 0), static_cast<int>(invDir.z < 0)};
-
-    int toVisitOffset    = 0;
-    int currentNodeIndex = 0;
-    int stack[64];
-    bool hitAnything = false;
-
-    while (true) {
-        const LinearBVHNode *node = &nodes_[currentNodeIndex];
-        // 1. Check the ray intersects the current node
-        //    If it doesn't, pop the stack and continue
-        if (node->bbox.hit(r.origin, r.dir, t)) {
-            // 2. If we are at a leaf node, loop through all primitives
-            //    Otherwise, push the children onto the stack
-            if (node->numPrimitives > 0) {
-                // Leaf node
-                for (int i = 0; i < node->numPrimitives; ++i) {
-                    if (closestHitPrimitive(primitives_[node->primitivesOffset + i], r, t, record)) {
-                        hitAnything = true;
-                        t.max       = record.t;
+    PrimitiveHit hit;
+    const bool hitAnything = tlas_.closestHit(r, t, [&](const int offset, Interval &tHit) {
+        PrimitiveHit candidate;
+        if (closestHitPrimitive(tlas_.primitives[offset], r, tHit, candidate)) {
+            candidate.primitive = offset;
+            hit                 = candidate;
+            tHit.max            = candidate.t;
+            return true;
+        }
+        return false;
+    });
+    if (!hitAnything) return false;
+
+    setIntersection(r, hit, record);
+    return true;
+}
+
+bool Scene::anyHit(const Ray &r, Interval t) const {
+    return tlas_.anyHit(r, t, [&](const int offset, const Interval &tHit) {
+        return anyHitPrimitive(tlas_.primitives[offset], r, tHit);
+    });
+}
+
+// The direction is not renormalized, so t means the same distance in both spaces
+static Ray toObjectSpace(const Instance &instance, const Ray &r) {
+    return {instance.worldToObject.applyToPoint(r.origin), instance.worldToObject.applyToVector(r.dir), r.time};
+}
+
+bool Scene::closestHitInstance(const Instance &instance, const Ray &r, Interval t, PrimitiveHit &hit) const {
+    const Ray objRay = toObjectSpace(instance, r);
+    const BLAS &blas = blas_[instance.meshIndex];
+#ifndef PRECOMPUTE_TRIANGLES
+    const Mesh &mesh = meshes[instance.meshIndex];
+#endif
+
+    return blas.bvh.closestHit(objRay, t, [&](const int offset, Interval &tHit) {
+        float root, b1, b2;
+#ifdef PRECOMPUTE_TRIANGLES
+        if (!blas.triangles[offset].hit(objRay, tHit, root, b1, b2)) return false;
+#else
+        if (!mesh.tHit(objRay, tHit, static_cast<int>(blas.bvh.primitives[offset].index), root, b1, b2)) return false;
+#endif
+        hit.t            = root;
+        hit.b1           = b1;
+        hit.b2           = b2;
+        hit.subPrimitive = offset;
+        tHit.max         = root;
+        return true;
+    });
+}
+
+void Scene::setIntersection(const Ray &r, const PrimitiveHit &hit, Intersection &record) const {
+    const Primitive &primitive = tlas_.primitives[hit.primitive];
+    // Footprints are only known for camera rays, see Intersection::computeDifferentials
+    record.dudx = record.dvdx = record.dudy = record.dvdy = 0;
+    switch (primitive.type) {
+        case Primitive::SPHERE: {
+            spheres[primitive.index].setIntersection(r, hit.t, record);
+            record.dpdu  = record.dpdv = {};
+            record.light = -1;
+            break;
+        }
+        case Primitive::INSTANCE: {
+            const Instance &instance = instances[primitive.index];
+            const Ray objRay         = toObjectSpace(instance, r);
+            const int triangle       = static_cast<int>(blas_[instance.meshIndex].bvh.primitives[hit.subPrimitive].index);
+            meshes[instance.meshIndex].tSetIntersection(objRay, triangle, hit.t, hit.b1, hit.b2, record);
+
+            // Back to world space, normals use the inverse transpose
+            record.point  = r.at(record.t);
+            record.normal = jtx::normalize(instance.worldToObject.applyTransposeToVector(record.normal));
+            record.dpdu   = instance.objectToWorld.applyToVector(record.dpdu);
+            record.dpdv   = instance.objectToWorld.applyToVector(record.dpdv);
+            record.light  = instance.firstLight < 0 ? -1 : instance.firstLight + triangle;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+bool Scene::anyHitInstance(const Instance &instance, const Ray &r, Interval t) const {
+    const Ray objRay = toObjectSpace(instance, r);
+    const BLAS &blas = blas_[instance.meshIndex];
+
+    return blas.bvh.anyHit(objRay, t, [&](const int offset, const Interval &tHit) {
+#ifdef PRECOMPUTE_TRIANGLES
+        float root, b1, b2;
+        return blas.triangles[offset].hit(objRay, tHit, root, b1, b2);
+#else
+        return meshes[instance.meshIndex].tAnyHit(objRay, tHit, static_cast<int>(blas.bvh.primitives[offset].index));
+#endif
+    });
+}
+
+template<int N>
+uint32_t Scene::closestHit(const RayPacket<N> &packet, Intersection records[N]) const {
+    uint32_t hitLanes = 0;
+    if (!packet.coherent()) {
+        for (uint32_t lanes = packet.active; lanes; lanes &= lanes - 1) {
+            const int i = std::countr_zero(lanes);
+            if (closestHit(packet.ray(i), packet.interval(i), records[i])) hitLanes |= 1u << i;
+        }
+        return hitLanes;
+    }
+
+    RayPacket<N> rays = packet;
+    PrimitiveHit hits[N];
+    hitLanes = tlas_.closestHit(rays, [&](const int offset, const uint32_t lanes) {
+        const Primitive &primitive = tlas_.primitives[offset];
+        uint32_t result            = 0;
+        switch (primitive.type) {
+            case Primitive::SPHERE: {
+                for (uint32_t m = lanes; m; m &= m - 1) {
+                    const int i = std::countr_zero(m);
+                    float root;
+                    if (spheres[primitive.index].hit(rays.ray(i), rays.interval(i), root)) {
+                        hits[i]      = {root, 0, 0, offset, -1};
+                        rays.tMax[i] = root;
+                        result |= 1u << i;
                     }
                 }
-                if (toVisitOffset == 0) break;
-                currentNodeIndex = stack[--toVisitOffset];
-            } else {
-                // Interior node
-                if (dirIsNeg[node->axis]) {
-                    stack[toVisitOffset++] = currentNodeIndex + 1;
-                    currentNodeIndex       = node->secondChildOffset;
-                } else {
-                    stack[toVisitOffset++] = node->secondChildOffset;
-                    currentNodeIndex       = currentNodeIndex + 1;
+                break;
+            }
+            case Primitive::INSTANCE: {
+                result = closestHitInstance(instances[primitive.index], rays, lanes, hits);
+                for (uint32_t m = result; m; m &= m - 1) {
+                    hits[std::countr_zero(m)].primitive = offset;
                 }
+                break;
             }
-        } else {
-            if (toVisitOffset == 0) break;
-            currentNodeIndex = stack[--toVisitOffset];
+            default:
+                break;
+        }
+        return result;
+    });
+
+    for (uint32_t lanes = hitLanes; lanes; lanes &= lanes - 1) {
+        const int i = std::countr_zero(lanes);
+        setIntersection(packet.ray(i), hits[i], records[i]);
+    }
+    return hitLanes;
+}
+
+template<int N>
+uint32_t Scene::anyHit(const RayPacket<N> &packet) const {
+    if (!packet.coherent()) {
+        uint32_t occluded = 0;
+        for (uint32_t lanes = packet.active; lanes; lanes &= lanes - 1) {
+            const int i = std::countr_zero(lanes);
+            if (anyHit(packet.ray(i), packet.interval(i))) occluded |= 1u << i;
         }
+        return occluded;
     }
 
-    return hitAnything;
+    return tlas_.anyHit(packet, [&](const int offset, const uint32_t lanes) {
+        const Primitive &primitive = tlas_.primitives[offset];
+        if (primitive.type == Primitive::INSTANCE) {
+            return anyHitInstance(instances[primitive.index], packet, lanes);
+        }
+
+        uint32_t result = 0;
+        for (uint32_t m = lanes; m; m &= m - 1) {
+            const int i = std::countr_zero(m);
+            if (anyHitPrimitive(primitive, packet.ray(i), packet.interval(i))) result |= 1u << i;
+        }
+        return result;
+    });
 }
 
-bool Scene::anyHit(const Ray &r, Interval t) const {
-    const auto invDir     = 1 / r.dir;
-    const int dirIsNeg[3] = {static_cast<int>(invDir.x < 0), static_cast<int>(invDir.y < 0), static_cast<int>(invDir.z < 0)};
-
-    int toVisitOffset    = 0;
-    int currentNodeIndex = 0;
-    int stack[64];
-
-    while (true) {
-        const LinearBVHNode *node = &nodes_[currentNodeIndex];
-        if (node->bbox.hit(r.origin, r.dir, t)) {
-            if (node->numPrimitives > 0) {
-                for (int i = 0; i < node->numPrimitives; ++i) {
-                    if (anyHitPrimitive(primitives_[node->primitivesOffset + i], r, t)) {
-                        return true;
-                    }
-                }
-                if (toVisitOffset == 0) break;
-                currentNodeIndex = stack[--toVisitOffset];
-            } else {
-                // Interior node
-                if (dirIsNeg[node->axis]) {
-                    stack[toVisitOffset++] = currentNodeIndex + 1;
-                    currentNodeIndex       = node->secondChildOffset;
-                } else {
-                    stack[toVisitOffset++] = node->secondChildOffset;
-                    currentNodeIndex       = currentNodeIndex + 1;
-                }
+template<int N>
+static RayPacket<N> toObjectSpace(const Instance &instance, const RayPacket<N> &packet, const uint32_t lanes) {
+    RayPacket<N> objPacket = packet;
+    objPacket.active       = 0;
+    for (uint32_t m = lanes; m; m &= m - 1) {
+        const int i = std::countr_zero(m);
+        objPacket.set(i, toObjectSpace(instance, packet.ray(i)), packet.interval(i));
+    }
+    return objPacket;
+}
+
+template<int N>
+uint32_t Scene::closestHitInstance(const Instance &instance, RayPacket<N> &packet, const uint32_t lanes, PrimitiveHit hits[N]) const {
+    uint32_t result = 0;
+
+    // Rotations can flip direction signs, so coherence is checked again in object space
+    RayPacket<N> objPacket = toObjectSpace(instance, packet, lanes);
+    if (!objPacket.coherent()) {
+        for (uint32_t m = lanes; m; m &= m - 1) {
+            const int i = std::countr_zero(m);
+            if (closestHitInstance(instance, packet.ray(i), packet.interval(i), hits[i])) {
+                packet.tMax[i] = hits[i].t;
+                result |= 1u << i;
             }
-        } else {
-            if (toVisitOffset == 0) break;
-            currentNodeIndex = stack[--toVisitOffset];
         }
+        return result;
     }
 
-    return false;
+    const BLAS &blas = blas_[instance.meshIndex];
+#ifndef PRECOMPUTE_TRIANGLES
+    const Mesh &mesh = meshes[instance.meshIndex];
+#endif
+
+    result = blas.bvh.closestHit(objPacket, [&](const int offset, const uint32_t triangleLanes) {
+        uint32_t hitLanes = 0;
+        for (uint32_t m = triangleLanes; m; m &= m - 1) {
+            const int i = std::countr_zero(m);
+            float root, b1, b2;
+#ifdef PRECOMPUTE_TRIANGLES
+            if (!blas.triangles[offset].hit(objPacket.ray(i), objPacket.interval(i), root, b1, b2)) continue;
+#else
+            if (!mesh.tHit(objPacket.ray(i), objPacket.interval(i), static_cast<int>(blas.bvh.primitives[offset].index), root, b1, b2)) continue;
+#endif
+            hits[i]           = {root, b1, b2, 0, offset};
+            objPacket.tMax[i] = root;
+            hitLanes |= 1u << i;
+        }
+        return hitLanes;
+    });
+
+    for (uint32_t m = result; m; m &= m - 1) {
+        const int i    = std::countr_zero(m);
+        packet.tMax[i] = objPacket.tMax[i];
+    }
+    return result;
 }
 
-void Scene::loadMesh(const std::string &path) {
-    if (materials.capacity() < SCENE_MATERIAL_LIMIT) {
-        materials.reserve(SCENE_MATERIAL_LIMIT);
+template<int N>
+uint32_t Scene::anyHitInstance(const Instance &instance, const RayPacket<N> &packet, const uint32_t lanes) const {
+    const RayPacket<N> objPacket = toObjectSpace(instance, packet, lanes);
+    if (!objPacket.coherent()) {
+        uint32_t occluded = 0;
+        for (uint32_t m = lanes; m; m &= m - 1) {
+            const int i = std::countr_zero(m);
+            if (anyHitInstance(instance, packet.ray(i), packet.interval(i))) occluded |= 1u << i;
+        }
+        return occluded;
     }
 
+    const BLAS &blas = blas_[instance.meshIndex];
+    return blas.bvh.anyHit(objPacket, [&](const int offset, const uint32_t triangleLanes) {
+        uint32_t occluded = 0;
+        for (uint32_t m = triangleLanes; m; m &= m - 1) {
+            const int i = std::countr_zero(m);
+#ifdef PRECOMPUTE_TRIANGLES
+            float root, b1, b2;
+            if (blas.triangles[offset].hit(objPacket.ray(i), objPacket.interval(i), root, b1, b2)) occluded |= 1u << i;
+#else
+            const int triangle = static_cast<int>(blas.bvh.primitives[offset].index);
+            if (meshes[instance.meshIndex].tAnyHit(objPacket.ray(i), objPacket.interval(i), triangle)) occluded |= 1u << i;
+#endif
+        }
+        return occluded;
+    });
+}
+
+template uint32_t Scene::closestHit<4>(const RayPacket<4> &, Intersection[4]) const;
+template uint32_t Scene::closestHit<8>(const RayPacket<8> &, Intersection[8]) const;
+template uint32_t Scene::closestHit<16>(const RayPacket<16> &, Intersection[16]) const;
+template uint32_t Scene::anyHit<4>(const RayPacket<4> &) const;
+template uint32_t Scene::anyHit<8>(const RayPacket<8> &) const;
+template uint32_t Scene::anyHit<16>(const RayPacket<16> &) const;
+
+// Full path of a material's first diffuse texture
+static bool diffuseTexturePath(const aiMaterial *aiMat, const std::string &baseDir, std::string &texPath) {
+    if (aiMat->GetTextureCount(aiTextureType_DIFFUSE) == 0) return false;
+    aiString aiTexPath;
+    if (aiMat->GetTexture(aiTextureType_DIFFUSE, 0, &aiTexPath) != AI_SUCCESS) return false;
+    texPath = baseDir + aiTexPath.C_Str();
+    return true;
+}
+
+// Converts the meshes and materials of an assimp scene, no textures are loaded yet
+static bool importMesh(const std::string &path, MeshAsset &asset) {
     Assimp::Importer importer;
     const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
     if (!scene || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) || !scene->mRootNode) {
         std::cerr << "Assimp error: " << importer.GetErrorString() << std::endl;
-        return;
+        return false;
     }
 
     std::string baseDir;
@@ -124,34 +321,24 @@ void Scene::loadMesh(const std::string &path) {
             continue;
 
         int texId = -1;
-        if (aiMat->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
-            aiString texPath;
-            if (aiMat->GetTexture(aiTextureType_DIFFUSE, 0, &texPath) == AI_SUCCESS) {
-                std::string fullTexPath = baseDir + texPath.C_Str();
-                auto texIt = textureMap.find(fullTexPath);
-                if (texIt != textureMap.end()) {
-                    texId = texIt->second;
-                } else {
-                    TextureImage texture;
-                    if (texture.load(fullTexPath.c_str())) {
-                        std::cout << "Loaded texture: " << fullTexPath << std::endl;
-                        textures.push_back(std::move(texture));
-                        texId = textures.size() - 1;
-                        textureMap[fullTexPath] = texId;
-                    } else {
-                        std::cerr << "Failed to load texture: " << fullTexPath << std::endl;
-                    }
-                }
-            }
+        std::string texPath;
+        if (diffuseTexturePath(aiMat, baseDir, texPath)) {
+            auto [texIt, inserted] = textureMap.try_emplace(texPath, asset.texturePaths.size());
+            if (inserted) asset.texturePaths.push_back(texPath);
+            texId = static_cast<int>(texIt->second);
         }
 
         std::cout << "Loaded material: " << matName << std::endl;
-        materials.push_back({.texId = texId});
-        materialMap[matName] = materials.size() - 1;
+        asset.materials.push_back({.texId = texId});
+        materialMap[matName] = asset.materials.size() - 1;
     }
 
+    // Arrays are allocated here and filled by tasks of at most MESH_IMPORT_CHUNK vertices or faces,
+    // so the meshes of an asset convert side by side and large meshes are split up as well
+    std::vector<std::atomic<int>> nonTriangles(scene->mNumMeshes);
+    TaskGroup group;
     for (unsigned int m = 0; m < scene->mNumMeshes; m++) {
-        aiMesh* aiMeshPtr = scene->mMeshes[m];
+        const aiMesh* aiMeshPtr = scene->mMeshes[m];
 
         size_t numVerts = aiMeshPtr->mNumVertices;
         auto finalVerts = new Vec3[numVerts];
@@ -163,34 +350,42 @@ void Scene::loadMesh(const std::string &path) {
             finalUVs = new Vec2f[numVerts];
         }
 
-        for (size_t i = 0; i < numVerts; i++) {
-            aiVector3D v = aiMeshPtr->mVertices[i];
-            finalVerts[i] = Vec3(v.x, v.y, v.z);
+        for (size_t begin = 0; begin < numVerts; begin += MESH_IMPORT_CHUNK) {
+            const size_t end = std::min(begin + MESH_IMPORT_CHUNK, numVerts);
+            group.run([=] {
+                for (size_t i = begin; i < end; i++) {
+                    aiVector3D v = aiMeshPtr->mVertices[i];
+                    finalVerts[i] = Vec3(v.x, v.y, v.z);
 
-            if (aiMeshPtr->HasNormals()) {
-                aiVector3D n = aiMeshPtr->mNormals[i];
-                finalNormals[i] = Vec3(n.x, n.y, n.z);
-            } else {
-                finalNormals[i] = Vec3(0.0f, 1.0f, 0.0f);
-            }
+                    if (aiMeshPtr->HasNormals()) {
+                        aiVector3D n = aiMeshPtr->mNormals[i];
+                        finalNormals[i] = Vec3(n.x, n.y, n.z);
+                    } else {
+                        finalNormals[i] = Vec3(0.0f, 1.0f, 0.0f);
+                    }
 
-            if (hasUV) {
-                aiVector3D uv = aiMeshPtr->mTextureCoords[0][i];
-                finalUVs[i] = Vec2f(uv.x, uv.y);
-            } else if(finalUVs) {
-                finalUVs[i] = Vec2f(0.0f, 0.0f);
-            }
+                    if (hasUV) {
+                        aiVector3D uv = aiMeshPtr->mTextureCoords[0][i];
+                        finalUVs[i] = Vec2f(uv.x, uv.y);
+                    }
+                }
+            });
         }
 
         size_t numTriangles = aiMeshPtr->mNumFaces;
         auto* finalIndices = new Vec3i[numTriangles];
-        for (size_t i = 0; i < numTriangles; i++) {
-            aiFace face = aiMeshPtr->mFaces[i];
-            if (face.mNumIndices != 3) {
-                std::cerr << "Warning: mesh " << m << " has a face that isn't a triangle.\n";
-                continue;
-            }
-            finalIndices[i] = Vec3i(face.mIndices[0], face.mIndices[1], face.mIndices[2]);
+        for (size_t begin = 0; begin < numTriangles; begin += MESH_IMPORT_CHUNK) {
+            const size_t end = std::min(begin + MESH_IMPORT_CHUNK, numTriangles);
+            group.run([=, &nonTriangles] {
+                for (size_t i = begin; i < end; i++) {
+                    const aiFace &face = aiMeshPtr->mFaces[i];
+                    if (face.mNumIndices != 3) {
+                        nonTriangles[m].fetch_add(1, std::memory_order_relaxed);
+                        continue;
+                    }
+                    finalIndices[i] = Vec3i(face.mIndices[0], face.mIndices[1], face.mIndices[2]);
+                }
+            });
         }
 
         std::string mName = aiMeshPtr->mName.C_Str();
@@ -198,73 +393,323 @@ void Scene::loadMesh(const std::string &path) {
             mName = "mesh_" + std::to_string(m);
         }
 
-        Material* meshMaterial = nullptr;
+        int meshMaterial = -1;
         if (aiMeshPtr->mMaterialIndex < scene->mNumMaterials) {
             aiMaterial* mat = scene->mMaterials[aiMeshPtr->mMaterialIndex];
             aiString matName;
             mat->Get(AI_MATKEY_NAME, matName);
             auto it = materialMap.find(matName.C_Str());
             if (it != materialMap.end()) {
-                meshMaterial = &materials[it->second];
+                meshMaterial = static_cast<int>(it->second);
+            }
+        }
+        if (meshMaterial < 0) {
+            asset.materials.push_back({.type = Material::DIFFUSE, .albedo = Color(1, 0.3, 0.5), .texId = -1});
+            meshMaterial = static_cast<int>(asset.materials.size()) - 1;
+        }
+
+        asset.meshes.emplace_back(mName, finalIndices, numTriangles, finalVerts, numVerts, finalNormals, finalUVs, nullptr);
+        asset.meshMaterials.push_back(meshMaterial);
+    }
+    // The importer owns the source arrays, so the tasks have to finish before it goes out of scope
+    group.wait();
+
+    for (unsigned int m = 0; m < scene->mNumMeshes; m++) {
+        if (nonTriangles[m] > 0) {
+            std::cerr << "Warning: mesh " << m << " has " << nonTriangles[m] << " faces that aren't triangles.\n";
+        }
+    }
+    return true;
+}
+
+void Scene::loadMesh(const std::string &path) {
+    if (materials.capacity() < SCENE_MATERIAL_LIMIT) {
+        materials.reserve(SCENE_MATERIAL_LIMIT);
+    }
+
+    MeshAsset asset;
+    if (isGLTF(path)) {
+        // glTF buffers already hold the mesh arrays, a scene cache would only copy them
+        if (!importGLTF(path, asset)) return;
+        addAsset(asset);
+        return;
+    }
+
+    // Assets only go through assimp on their first load, after that the cache next to them is mapped
+    const std::string cachePath = path + ".scene";
+    if (readSceneCache(cachePath, path, asset)) {
+        std::cout << "Loaded scene cache: " << cachePath << std::endl;
+    } else {
+        if (!importMesh(path, asset)) return;
+        if (!writeSceneCache(cachePath, path, asset)) {
+            std::cerr << "Failed to write scene cache: " << cachePath << std::endl;
+        }
+    }
+    addAsset(asset);
+}
+
+void Scene::addAsset(const MeshAsset &asset) {
+    // Decode all diffuse textures on the thread pool, they dominate load times of textured scenes
+    // The triangle list is filled in alongside them
+    const std::vector<std::string> &texturePaths = asset.texturePaths;
+
+    // The full resolution images are only needed to build the MIP maps
+    // With a texture cache they are converted to tiled files instead, which are only opened here
+    std::vector<MIPMap> loadedTextures(texturePaths.size());
+    std::vector<std::string> tiledPaths(texturePaths.size());
+    std::vector<uint8_t> textureLoaded(texturePaths.size());
+    TaskGroup group;
+    for (size_t t = 0; t < texturePaths.size(); ++t) {
+        group.run([&, t] {
+            // Embedded textures have no file to tile, so they are always held in memory
+            const bool embedded = t < asset.textureData.size() && !asset.textureData[t].empty();
+            if (textureCache_ && !embedded) {
+                textureLoaded[t] = TextureCache::convert(texturePaths[t], tiledPaths[t], compressTexturesAbove);
+                return;
             }
+            TextureImage image;
+            textureLoaded[t] = embedded ? image.load(asset.textureData[t].data(), asset.textureData[t].size())
+                                        : image.load(texturePaths[t].c_str());
+            if (textureLoaded[t]) loadedTextures[t] = MIPMap(image, MIPMap::TRILINEAR, compressTexturesAbove);
+        });
+    }
+    meshStorage_.insert(meshStorage_.end(), asset.storage.begin(), asset.storage.end());
+
+    // Texture indices are filled in once the textures are in
+    // Meshes point into materials, so room for assets with more than SCENE_MATERIAL_LIMIT is only made while it is empty
+    if (materials.empty()) materials.reserve(std::max<size_t>(SCENE_MATERIAL_LIMIT, asset.materials.size()));
+    const size_t firstMaterial = materials.size();
+    for (const Material &material: asset.materials) materials.push_back(material);
+
+    size_t numTriangles = 0;
+    for (const Mesh &mesh: asset.meshes) numTriangles += mesh.numIndices;
+    size_t firstTriangle = triangles.size();
+    triangles.resize(firstTriangle + numTriangles);
+    const int firstMesh = static_cast<int>(meshes.size());
+
+    for (size_t m = 0; m < asset.meshes.size(); ++m) {
+        meshes.push_back(asset.meshes[m]);
+        meshes.back().material = &materials[firstMaterial + asset.meshMaterials[m]];
+
+        const int meshIndex  = static_cast<int>(meshes.size()) - 1;
+        const int numIndices = meshes.back().numIndices;
+        for (int begin = 0; begin < numIndices; begin += static_cast<int>(MESH_IMPORT_CHUNK)) {
+            const int end = std::min(begin + static_cast<int>(MESH_IMPORT_CHUNK), numIndices);
+            group.run([this, firstTriangle, meshIndex, begin, end] {
+                for (int t = begin; t < end; t++) {
+                    triangles[firstTriangle + t] = Triangle{.index = t, .meshIndex = meshIndex};
+                }
+            });
         }
-        if (!meshMaterial) {
-            materials.push_back({.type = Material::DIFFUSE, .albedo = Color(1, 0.3, 0.5), .texId = -1});
-            meshMaterial = &materials.back();
+        firstTriangle += numIndices;
+        if (asset.instances.empty()) addInstance(meshIndex);
+
+        std::cout << "Loaded mesh: " << meshes.back().name << std::endl;
+    }
+    for (const MeshPlacement &placement: asset.instances) {
+        instances[addInstance(firstMesh + placement.mesh)].placement = placement.transform;
+    }
+    group.wait();
+
+    if (textureCache_) {
+        for (size_t t = 0; t < texturePaths.size(); ++t) {
+            if (!textureLoaded[t] || tiledPaths[t].empty()) continue;
+            const int texture = textureCache_->addTexture(tiledPaths[t]);
+            textureLoaded[t]  = texture >= 0;
+            if (textureLoaded[t]) loadedTextures[t] = MIPMap(*textureCache_, texture);
         }
+    }
 
-        meshes.emplace_back(mName, finalIndices, numTriangles, finalVerts, numVerts, finalNormals, finalUVs, meshMaterial);
+    // Scene texture of each asset texture, -1 if it failed to load
+    std::vector<int> textureIds(texturePaths.size(), -1);
+    for (size_t t = 0; t < texturePaths.size(); ++t) {
+        if (textureLoaded[t]) {
+            std::cout << "Loaded texture: " << texturePaths[t] << std::endl;
+            textures.push_back(std::move(loadedTextures[t]));
+            textureIds[t] = static_cast<int>(textures.size()) - 1;
+        } else {
+            std::cerr << "Failed to load texture: " << texturePaths[t] << std::endl;
+        }
+    }
 
-        int meshIndex = static_cast<int>(meshes.size()) - 1;
-        for (size_t t = 0; t < numTriangles; t++) {
-            Triangle tri;
-            tri.index = static_cast<int>(t);
-            tri.meshIndex = meshIndex;
-            triangles.push_back(tri);
+    for (size_t i = firstMaterial; i < materials.size(); ++i) {
+        if (materials[i].texId >= 0) materials[i].texId = textureIds[materials[i].texId];
+    }
+}
+
+int Scene::addInstance(const int meshIndex, const Transform &transform) {
+    Instance instance;
+    instance.meshIndex = meshIndex;
+    instance.transform = transform;
+    instances.push_back(instance);
+    return static_cast<int>(instances.size()) - 1;
+}
+
+void Scene::updateInstances() {
+    for (auto &instance: instances) {
+        const Mesh &mesh       = meshes[instance.meshIndex];
+        instance.objectToWorld = instance.placement * Affine::fromTransform(instance.transform * mesh.transform);
+        instance.worldToObject = instance.objectToWorld.inverse();
+        instance.bounds        = instance.objectToWorld.applyToBounds(blas_[instance.meshIndex].bvh.bounds());
+    }
+}
+
+uint64_t Scene::blasKey(const Mesh &mesh) const {
+    uint64_t key = hash(static_cast<int>(bvhBuildMethod_), maxPrimsInNode_);
+    key          = hashBuffer(mesh.indices, static_cast<size_t>(mesh.numIndices) * sizeof(Vec3i), key);
+    return hashBuffer(mesh.vertices, static_cast<size_t>(mesh.numVertices) * sizeof(Vec3), key);
+}
+
+void Scene::buildBLAS(const int meshIndex) {
+    const Mesh &mesh = meshes[meshIndex];
+    BLAS &blas       = blas_[meshIndex];
+
+    // Mesh geometry never changes after loading, so large BLASes are kept on disk under a hash of what they were built from
+    const bool cached = !bvhCacheDir.empty() && mesh.numIndices >= BLAS_CACHE_MIN_TRIANGLES;
+    uint64_t key      = 0;
+    std::string cachePath;
+    if (cached) {
+        key = blasKey(mesh);
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bvh", static_cast<unsigned long long>(key));
+        cachePath = bvhCacheDir + "/" + name;
+    }
+
+    if (!cached || !blas.bvh.load(cachePath, key, mesh.numIndices)) {
+        blas.bvh.primitives.resize(mesh.numIndices);
+        for (int i = 0; i < mesh.numIndices; ++i) {
+            blas.bvh.primitives[i] = Primitive{Primitive::TRIANGLE, static_cast<size_t>(i), mesh.tBounds(i)};
         }
 
-        std::cout << "Loaded mesh: " << mName << std::endl;
+        blas.bvh.build(bvhBuildMethod_, maxPrimsInNode_);
+
+        if (cached) {
+            std::error_code error;
+            std::filesystem::create_directories(bvhCacheDir, error);
+            if (!blas.bvh.save(cachePath, key)) std::cerr << "Failed to write BVH cache: " << cachePath << std::endl;
+        }
     }
+
+#ifdef PRECOMPUTE_TRIANGLES
+    // Mesh transforms are applied per instance, so this only changes when the BLAS is rebuilt
+    blas.triangles.resize(blas.bvh.primitives.size());
+    for (size_t i = 0; i < blas.triangles.size(); ++i) {
+        Vec3 v0, v1, v2;
+        mesh.getVertices(static_cast<int>(blas.bvh.primitives[i].index), v0, v1, v2);
+        blas.triangles[i] = PrecomputedTriangle::fromVertices(v0, v1, v2);
+    }
+#endif
 }
 
-void Scene::buildBVH(const int maxPrimsInNode) {
+void Scene::buildBVH(const BVHBuildMethod method, const int maxPrimsInNode) {
+    bvhBuildMethod_ = method;
     maxPrimsInNode_ = maxPrimsInNode;
-    primitives_.resize(numPrimitives());
-    // std::vector<Primitive> primitives(scene.numPrimitives());
 
-    // BVH Primitives is our working span of primitives
-    // This will start out as all of them
-    std::vector<Primitive> bvhPrimitives(primitives_.size());
+    blas_.resize(meshes.size());
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        buildBLAS(static_cast<int>(i));
+    }
+
+    bvhBuilt_ = true;
+    rebuildTLAS();
+}
+
+void Scene::rebuildTLAS() {
+    if (!bvhBuilt_) return;
+
+    updateInstances();
+
+    tlas_.primitives.resize(spheres.size() + instances.size());
     for (size_t i = 0; i < spheres.size(); ++i) {
-        primitives_[i]   = Primitive{Primitive::SPHERE, i, spheres[i].bounds()};
-        bvhPrimitives[i] = Primitive{Primitive::SPHERE, i, spheres[i].bounds()};
+        tlas_.primitives[i] = Primitive{Primitive::SPHERE, i};
     }
 
-    const size_t tOffset = spheres.size();
-    for (size_t i = 0; i < triangles.size(); ++i) {
-        primitives_[tOffset + i]   = Primitive{Primitive::TRIANGLE, i, meshes[triangles[i].meshIndex].tBounds(triangles[i].index)};
-        bvhPrimitives[tOffset + i] = Primitive{Primitive::TRIANGLE, i, meshes[triangles[i].meshIndex].tBounds(triangles[i].index)};
+    const size_t iOffset = spheres.size();
+    for (size_t i = 0; i < instances.size(); ++i) {
+        tlas_.primitives[iOffset + i] = Primitive{Primitive::INSTANCE, i};
     }
     // Add rest of types when we get them
-    // We will order as we build
-    std::vector<Primitive> orderedPrimitives(primitives_.size());
 
-    int totalNodes             = 1;
-    int orderedPrimitiveOffset = 0;
+    for (auto &primitive: tlas_.primitives) {
+        primitive.bounds = primitiveBounds(primitive);
+    }
+
+    // The builder reorders the primitives in place
+    tlas_.build(bvhBuildMethod_, maxPrimsInNode_);
+
+    buildLights();
+}
+
+float Scene::refitBVH() {
+    if (!bvhBuilt_) return INF;
+
+    updateInstances();
+    const float cost = tlas_.refit([this](const Primitive &primitive) { return primitiveBounds(primitive); });
+    buildLights();
+    return cost;
+}
+
+void Scene::buildLights() {
+    std::vector<Light> allLights = lights;
+
+    // Shadow rays towards infinite lights have to leave the scene
+    for (auto &light: allLights) {
+        if (light.type == Light::INFINITE) light.sceneRadius = getSceneRadius();
+    }
 
-    const BVHNode *root = buildTree(bvhPrimitives, &totalNodes, &orderedPrimitiveOffset, orderedPrimitives, maxPrimsInNode_);
-    primitives_.swap(orderedPrimitives);
+    // Emissive meshes become one area light per triangle, per instance
+    for (auto &instance: instances) {
+        const Mesh &mesh = meshes[instance.meshIndex];
+        if (!mesh.material || !mesh.material->emission) {
+            instance.firstLight = -1;
+            continue;
+        }
 
-    bvhPrimitives.resize(0);
-    bvhPrimitives.shrink_to_fit();
+        instance.firstLight = static_cast<int>(allLights.size());
+        for (int i = 0; i < mesh.numIndices; ++i) {
+            Vec3 v0, v1, v2;
+            mesh.getVertices(i, v0, v1, v2);
+
+            Light light{};
+            light.type      = Light::TRIANGLE;
+            light.position  = instance.objectToWorld.applyToPoint(v0);
+            light.v1        = instance.objectToWorld.applyToPoint(v1);
+            light.v2        = instance.objectToWorld.applyToPoint(v2);
+            light.intensity = mesh.material->emission;
+            light.scale     = 1;
+            allLights.push_back(light);
+        }
+    }
 
-    nodes_     = new LinearBVHNode[totalNodes];
-    int offset = 0;
-    flattenBVH(root, nodes_, &offset);
+    lightSampler_.build(allLights);
+}
 
-    // Clean-up the tree
-    root->destroy();
-    delete root;
+void Scene::enableTextureCache(const size_t budgetBytes) {
+    if (!textureCache_) textureCache_ = std::make_unique<TextureCache>(budgetBytes);
+}
+
+bool Scene::loadEnvironmentMap(const std::string &path, const float scale) {
+    TextureImage image;
+    if (!image.load(path.c_str())) {
+        std::cerr << "Failed to load environment map: " << path << std::endl;
+        return false;
+    }
+    environmentMap_ = std::make_unique<EnvironmentMap>(std::move(image));
+
+    const Light background = {
+            .type        = Light::INFINITE,
+            .intensity   = WHITE,
+            .scale       = scale,
+            .environment = environmentMap_.get()};
+    if (lights.empty() || lights[0].type != Light::INFINITE) {
+        lights.insert(lights.begin(), background);
+    } else {
+        lights[0] = background;
+    }
+    // The light sampler holds a copy of the old background, next event estimation has to sample the new one
+    if (bvhBuilt_) buildLights();
+    std::cout << "Loaded environment map: " << path << std::endl;
+    return true;
 }
 
 Scene createDefaultScene() {
@@ -346,13 +791,15 @@ Scene createMeshScene() {
 
     scene.triangles.push_back({0, 0});
     scene.triangles.push_back({1, 0});
+    scene.addInstance(0);
 
     return scene;
 }
 
-Scene createObjScene(const std::string &path, const Mat4 &t, const Color &background) {
+Scene createObjScene(const std::string &path, const Mat4 &t, const Color &background, const size_t textureCacheBytes) {
     Scene scene;
     scene.name = "OBJ Scene";
+    if (textureCacheBytes > 0) scene.enableTextureCache(textureCacheBytes);
     scene.loadMesh(path);
 
     scene.cameraProperties.center        = Vec3(0, 0, 8);
@@ -364,6 +811,7 @@ Scene createObjScene(const std::string &path, const Mat4 &t, const Color &backgr
 
     std::cout << "Scene loaded with:" << std::endl;
     std::cout << " - " << scene.meshes.size() << " meshes" << std::endl;
+    std::cout << " - " << scene.instances.size() << " instances" << std::endl;
     std::cout << " - " << scene.triangles.size() << " triangles" << std::endl;
 
     int numVertices = 0;
@@ -488,3 +936,38 @@ Scene createKnobScene() {
 
     return scene;
 }
+
+Scene createInstancedKnobScene() {
+    auto scene = createKnobScene();
+    scene.name = "Instanced Knob Scene";
+
+    scene.cameraProperties.center = Vec3(0, 30, 40);
+    scene.cameraProperties.target = Vec3(0, 0, 0);
+    scene.cameraProperties.yfov   = 40;
+
+    // Grid of copies sharing the knob's meshes, the original stays at the center
+    constexpr int GRID_RADIUS  = 16;
+    constexpr float GRID_SPACE = 2.5f;
+    const int numMeshes        = static_cast<int>(scene.meshes.size());
+    for (int z = -GRID_RADIUS; z <= GRID_RADIUS; ++z) {
+        for (int x = -GRID_RADIUS; x <= GRID_RADIUS; ++x) {
+            if (x == 0 && z == 0) continue;
+            const auto t = Transform::translate(Vec3(x * GRID_SPACE, 0, z * GRID_SPACE));
+            for (int m = 0; m < numMeshes; ++m) {
+                scene.addInstance(m, t);
+            }
+        }
+    }
+
+    return scene;
+}
+
+Scene createEnvironmentKnobScene(const std::string &environmentPath) {
+    auto scene = createKnobScene();
+    scene.name = "Environment Knob Scene";
+
+    // The glossy gold and rough glass pick up the bright regions of the map, keeps the constant sky if it fails to load
+    scene.loadEnvironmentMap(environmentPath);
+
+    return scene;
+}
@@ -2,10 +2,17 @@
 #include "bvh.hpp"
 #include "material.hpp"
 #include "mesh.hpp"
+#include "mipmap.hpp"
 #include "primitives.hpp"
+#include "scenecache.hpp"
+#include "texturecache.hpp"
 #include "lights/lights.hpp"
+#include "lights/lightsampler.hpp"
+#include "util/affine.hpp"
 #include "util/rand.hpp"
 
+#include <memory>
+
 constexpr float RAY_EPSILON = 1e-4f;
 
 // Very basic scene struct
@@ -21,6 +28,49 @@ struct CameraProperties {
     Float focusDistance;
 };
 
+/**
+ * Placement of a mesh in the scene
+ * Instances of the same mesh share its BLAS, only the transform is stored per copy
+ */
+struct Instance {
+    int meshIndex;
+    Transform transform;
+    // Applied after transform, e.g. the world matrix of a glTF node
+    Affine placement = Affine::identity();
+
+    // Cached from placement * transform * mesh transform by Scene::updateInstances
+    Affine objectToWorld;
+    Affine worldToObject;
+    AABB bounds;
+
+    // Index of the area light of the mesh's first triangle in Scene::lightSampler(), -1 if it does not emit
+    int firstLight = -1;
+};
+
+/**
+ * Closest hit as recorded during traversal
+ * Only what is needed to find the winner is kept, the full Intersection is built once at the end
+ */
+struct PrimitiveHit {
+    float t;
+    // Barycentrics of v1 and v2 for triangles
+    float b1, b2;
+    // Offset into the TLAS primitives, and into the instance's BLAS primitives
+    int primitive;
+    int subPrimitive;
+};
+
+/**
+ * Bottom level of the scene BVH, one per mesh in object space
+ */
+struct BLAS {
+    BVH bvh;
+#ifdef PRECOMPUTE_TRIANGLES
+    // Intersection data for bvh.primitives, in the same leaf order
+    std::vector<PrecomputedTriangle> triangles;
+#endif
+};
+
 class Scene {
 public:
     std::string name;
@@ -33,8 +83,15 @@ public:
     std::vector<Sphere> spheres;
     std::vector<Triangle> triangles;
     std::vector<Mesh> meshes;
+    std::vector<Instance> instances;
 
-    std::vector<TextureImage> textures;
+    // Indexed by Material::texId
+    std::vector<MIPMap> textures;
+    // loadMesh block compresses 8 bit textures with more texels than this, 0 keeps them uncompressed
+    size_t compressTexturesAbove = 0;
+    // buildBVH saves the BLASes of large meshes here and loads them on later builds over the same geometry
+    // and settings instead of building them again, empty always builds
+    std::string bvhCacheDir = "bvhcache";
 
     CameraProperties cameraProperties;
 
@@ -48,37 +105,98 @@ public:
     bool closestHit(const Ray &r, Interval t, Intersection &record) const;
     bool anyHit(const Ray &r, Interval t) const;
 
+    /**
+     * Packet versions for coherent rays, e.g. camera rays from neighbouring pixels
+     * Packets whose direction signs differ are traced one lane at a time
+     * @return lanes that hit something (closestHit) or are occluded (anyHit)
+     */
+    template<int N>
+    uint32_t closestHit(const RayPacket<N> &packet, Intersection records[N]) const;
+    template<int N>
+    uint32_t anyHit(const RayPacket<N> &packet) const;
+
     [[nodiscard]]
     int numPrimitives() const {
         return spheres.size() + triangles.size();
     }
 
+    /**
+     * Adds the meshes of an asset file with an instance each, along with their materials and diffuse textures
+     * The first load writes a scene cache next to the file (path + ".scene"), later loads map it instead of importing
+     * glTF files (.gltf and .glb) are read directly, with an instance per node that references a mesh
+     */
     void loadMesh(const std::string &path);
 
-    void buildBVH(int maxPrimsInNode = 1);
+    /**
+     * Streams the textures of meshes loaded after this call from tiled files, keeping at most
+     * budgetBytes of texels in memory, instead of loading them whole
+     */
+    void enableTextureCache(size_t budgetBytes);
+
+    /**
+     * @return null unless enableTextureCache() was called
+     */
+    [[nodiscard]] const TextureCache *textureCache() const {
+        return textureCache_.get();
+    }
+
+    /**
+     * Replaces the background light (lights[0]) with an equirectangular environment image
+     * Its sampling distribution is built here, the light sampler is rebuilt if the BVH already is
+     * @return false if the image could not be loaded
+     */
+    bool loadEnvironmentMap(const std::string &path, float scale = 1);
+
+    /**
+     * Places a copy of a mesh, the mesh transform is applied before the instance transform
+     * @return index of the new instance
+     */
+    int addInstance(int meshIndex, const Transform &transform = Transform());
+
+    void buildBVH(BVHBuildMethod method = BVHBuildMethod::SAH, int maxPrimsInNode = 1);
 
     void destroyBVH() {
         if (bvhBuilt_) {
-            delete[] nodes_;
-            nodes_ = nullptr;
+            blas_.clear();
+            tlas_.clear();
             bvhBuilt_ = false;
-            primitives_.clear();
         }
     }
 
-    void rebuildBVH(const int maxPrimsInNode = 1) {
+    void rebuildBVH(const BVHBuildMethod method = BVHBuildMethod::SAH, const int maxPrimsInNode = 1) {
         destroyBVH();
-        buildBVH(maxPrimsInNode);
+        buildBVH(method, maxPrimsInNode);
+    }
+
+    /**
+     * Updates TLAS bounds after transform-only edits, keeping the current topology
+     * Mesh BLASes are in object space and are left untouched
+     * @return SAH cost of the refit TLAS relative to the cost it was built with
+     *         large values mean the tree has degraded and should be rebuilt
+     */
+    float refitBVH();
+
+    /**
+     * Rebuilds only the TLAS, for when instances are added or moved
+     */
+    void rebuildTLAS();
+
+    [[nodiscard]]
+    BVHBuildMethod bvhBuildMethod() const {
+        return bvhBuildMethod_;
     }
 
     AABB bounds() const {
         if (!bvhBuilt_) return AABB();
-        return nodes_[0].bbox;
+        return tlas_.bounds();
     }
 
-    int sampleLightIdx(RNG &rng) const {
-        const int idx = rng.sampleRange(lights.size());
-        return idx;
+    /**
+     * Picks lights for next event estimation, over lights followed by the triangles of emissive meshes
+     * Rebuilt with the TLAS, so changes to lights only show up after the next BVH build or refit
+     */
+    [[nodiscard]] const LightSampler &lightSampler() const {
+        return lightSampler_;
     }
 
     float getSceneRadius() const {
@@ -87,15 +205,42 @@ public:
     }
 
 private:
-    bool closestHitPrimitive(const Primitive &primitive, const Ray &r, const Interval t, Intersection &record) const {
+    // TLAS primitive bounds, in world space
+    AABB primitiveBounds(const Primitive &primitive) const {
+        switch (primitive.type) {
+            case Primitive::SPHERE:
+                return spheres[primitive.index].bounds();
+            case Primitive::INSTANCE:
+                return instances[primitive.index].bounds;
+            default:
+                break;
+        }
+        return {};
+    }
+
+    /**
+     * Recomputes instance matrices and bounds from the current instance and mesh transforms
+     */
+    void updateInstances();
+
+    /**
+     * Creates area lights for the emissive instances and rebuilds the light sampler
+     */
+    void buildLights();
+
+    void buildBLAS(int meshIndex);
+
+    // Identifies a BLAS built over mesh with the current build settings
+    [[nodiscard]] uint64_t blasKey(const Mesh &mesh) const;
+
+    bool closestHitPrimitive(const Primitive &primitive, const Ray &r, const Interval t, PrimitiveHit &hit) const {
         switch(primitive.type) {
             case Primitive::SPHERE: {
-                return spheres[primitive.index].closestHit(r, t, record);
+                hit.b1 = hit.b2 = 0;
+                return spheres[primitive.index].hit(r, t, hit.t);
             }
-            case Primitive::TRIANGLE: {
-                const Triangle &triangle = triangles[primitive.index];
-                float u, v;
-                return meshes[triangle.meshIndex].tClosestHit(r, t, record, triangle.index, u, v);
+            case Primitive::INSTANCE: {
+                return closestHitInstance(instances[primitive.index], r, t, hit);
             }
             default:
                 break;
@@ -103,14 +248,18 @@ private:
         return false;
     }
 
+    /**
+     * Builds the full hit record for the primitive found by traversal
+     */
+    void setIntersection(const Ray &r, const PrimitiveHit &hit, Intersection &record) const;
+
     bool anyHitPrimitive(const Primitive &primitive, const Ray &r, const Interval t) const {
         switch(primitive.type) {
             case Primitive::SPHERE: {
                 return spheres[primitive.index].anyHit(r, t);
             }
-            case Primitive::TRIANGLE: {
-                const Triangle &triangle = triangles[primitive.index];
-                return meshes[triangle.meshIndex].tAnyHit(r, t, triangle.index);
+            case Primitive::INSTANCE: {
+                return anyHitInstance(instances[primitive.index], r, t);
             }
             default:
                 break;
@@ -118,15 +267,40 @@ private:
         return false;
     }
 
+    bool closestHitInstance(const Instance &instance, const Ray &r, Interval t, PrimitiveHit &hit) const;
+    bool anyHitInstance(const Instance &instance, const Ray &r, Interval t) const;
+
+    template<int N>
+    uint32_t closestHitInstance(const Instance &instance, RayPacket<N> &packet, uint32_t lanes, PrimitiveHit hits[N]) const;
+    template<int N>
+    uint32_t anyHitInstance(const Instance &instance, const RayPacket<N> &packet, uint32_t lanes) const;
+
+    // Loads the textures of asset and appends its materials, meshes and instances
+    void addAsset(const MeshAsset &asset);
+
     bool bvhBuilt_ = false;
+    BVHBuildMethod bvhBuildMethod_ = BVHBuildMethod::SAH;
     int maxPrimsInNode_ = 0;
-    std::vector<Primitive> primitives_;
-    LinearBVHNode *nodes_ = nullptr;
+    // One per mesh
+    std::vector<BLAS> blas_;
+    // Over spheres and instances in world space
+    BVH tlas_;
+    LightSampler lightSampler_;
+    // Referenced by the background light
+    std::unique_ptr<EnvironmentMap> environmentMap_;
+    // Referenced by the streamed textures
+    std::unique_ptr<TextureCache> textureCache_;
+    // Memory the arrays of loaded meshes point into, see MeshAsset::storage
+    std::vector<std::shared_ptr<void>> meshStorage_;
 };
 
 Scene createDefaultScene();
 Scene createMeshScene();
-Scene createObjScene(const std::string &path, const Mat4 &t, const Color &background = Color(0.7, 0.8, 1.0));
+// A textureCacheBytes above 0 streams the textures through a TextureCache of that size
+Scene createObjScene(const std::string &path, const Mat4 &t, const Color &background = Color(0.7, 0.8, 1.0), size_t textureCacheBytes = 0);
 Scene createShaderBallScene();
 Scene createShaderBallSceneWithLight();
-Scene createKnobScene();
\ No newline at end of file
+Scene createKnobScene();
+Scene createInstancedKnobScene();
+// Knob lit by an equirectangular environment image instead of the constant sky
+Scene createEnvironmentKnobScene(const std::string &environmentPath);
\ No newline at end of file
@@ -0,0 +1,254 @@
+#include "scenecache.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+// Cache file layout, little endian:
+//   magic, version, sizes of Vec3, Vec2f and Vec3i, source file size and modification time,
+//   number of textures, materials and meshes
+//   texture paths, materials, then name, counts, material and whether there are uvs of every mesh
+//   followed by the indices, vertices, normals and uvs of each mesh, every array starting at a multiple of ARRAY_ALIGNMENT
+// Strings are a 32 bit length and their characters
+static constexpr uint32_t CACHE_MAGIC     = 0x5358544a; // "JTXS"
+static constexpr uint32_t CACHE_VERSION   = 1;
+static constexpr size_t ARRAY_ALIGNMENT = 64;
+
+namespace {
+// Identifies the version of the source file a cache was written from
+struct SourceStamp {
+    uint64_t size = 0;
+    int64_t time  = 0;
+
+    static bool of(const std::string &path, SourceStamp &stamp) {
+        namespace fs = std::filesystem;
+        std::error_code error;
+        stamp.size = fs::file_size(path, error);
+        if (error) return false;
+        stamp.time = fs::last_write_time(path, error).time_since_epoch().count();
+        return !error;
+    }
+};
+
+class CacheWriter {
+public:
+    explicit CacheWriter(std::ofstream &out)
+        : out_(out) {}
+
+    void bytes(const void *data, const size_t size) {
+        out_.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+        offset_ += size;
+    }
+
+    template<typename T>
+    void value(const T value) {
+        bytes(&value, sizeof(T));
+    }
+
+    void vec3(const Vec3 &v) {
+        value(v.x);
+        value(v.y);
+        value(v.z);
+    }
+
+    void string(const std::string &s) {
+        value(static_cast<uint32_t>(s.size()));
+        bytes(s.data(), s.size());
+    }
+
+    template<typename T>
+    void array(const T *data, const size_t count) {
+        static constexpr char zeros[ARRAY_ALIGNMENT] = {};
+        bytes(zeros, (ARRAY_ALIGNMENT - offset_ % ARRAY_ALIGNMENT) % ARRAY_ALIGNMENT);
+        bytes(data, count * sizeof(T));
+    }
+
+private:
+    std::ofstream &out_;
+    size_t offset_ = 0;
+};
+
+// Reads from a mapping, any read past its end fails the reader instead of touching memory
+class CacheReader {
+public:
+    CacheReader(uint8_t *data, const size_t size)
+        : data_(data),
+          size_(size) {}
+
+    [[nodiscard]] bool ok() const { return ok_; }
+
+    template<typename T>
+    T value() {
+        T value{};
+        if (!reserve(sizeof(T))) return value;
+        std::memcpy(&value, data_ + offset_ - sizeof(T), sizeof(T));
+        return value;
+    }
+
+    Vec3 vec3() {
+        const float x = value<float>();
+        const float y = value<float>();
+        const float z = value<float>();
+        return {x, y, z};
+    }
+
+    std::string string() {
+        const uint32_t size = value<uint32_t>();
+        if (!reserve(size)) return {};
+        return {reinterpret_cast<const char *>(data_ + offset_ - size), size};
+    }
+
+    template<typename T>
+    T *array(const size_t count) {
+        if (!reserve((ARRAY_ALIGNMENT - offset_ % ARRAY_ALIGNMENT) % ARRAY_ALIGNMENT)) return nullptr;
+        if (count > size_ / sizeof(T) || !reserve(count * sizeof(T))) return nullptr;
+        return reinterpret_cast<T *>(data_ + offset_ - count * sizeof(T));
+    }
+
+private:
+    uint8_t *data_;
+    size_t size_;
+    size_t offset_ = 0;
+    bool ok_       = true;
+
+    bool reserve(const size_t size) {
+        ok_ = ok_ && size <= size_ - offset_;
+        if (ok_) offset_ += size;
+        return ok_;
+    }
+};
+}
+
+// Directory of path including the trailing separator, empty if there is none
+static std::string directoryOf(const std::string &path) {
+    const size_t lastSlash = path.find_last_of("/\\");
+    return lastSlash == std::string::npos ? "" : path.substr(0, lastSlash + 1);
+}
+
+bool writeSceneCache(const std::string &cachePath, const std::string &sourcePath, const MeshAsset &asset) {
+    SourceStamp stamp;
+    if (!SourceStamp::of(sourcePath, stamp)) return false;
+    const std::string baseDir = directoryOf(sourcePath);
+
+    const std::string tempPath = cachePath + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary);
+        if (!out) return false;
+
+        CacheWriter writer(out);
+        writer.value(CACHE_MAGIC);
+        writer.value(CACHE_VERSION);
+        writer.value(static_cast<uint32_t>(sizeof(Vec3)));
+        writer.value(static_cast<uint32_t>(sizeof(Vec2f)));
+        writer.value(static_cast<uint32_t>(sizeof(Vec3i)));
+        writer.value(stamp.size);
+        writer.value(stamp.time);
+        writer.value(static_cast<uint32_t>(asset.texturePaths.size()));
+        writer.value(static_cast<uint32_t>(asset.materials.size()));
+        writer.value(static_cast<uint32_t>(asset.meshes.size()));
+
+        for (const std::string &texturePath: asset.texturePaths) {
+            // Relative to the asset, so the cache moves along with it
+            writer.string(texturePath.starts_with(baseDir) ? texturePath.substr(baseDir.size()) : texturePath);
+        }
+
+        for (const Material &material: asset.materials) {
+            writer.value(static_cast<uint32_t>(material.type));
+            writer.vec3(material.albedo);
+            writer.value(material.refractionIndex);
+            writer.vec3(material.IOR);
+            writer.vec3(material.k);
+            writer.value(material.alphaX);
+            writer.value(material.alphaY);
+            writer.vec3(material.emission);
+            writer.value(static_cast<int32_t>(material.texId));
+        }
+
+        for (size_t m = 0; m < asset.meshes.size(); ++m) {
+            const Mesh &mesh = asset.meshes[m];
+            writer.string(mesh.name);
+            writer.value(static_cast<int32_t>(mesh.numVertices));
+            writer.value(static_cast<int32_t>(mesh.numIndices));
+            writer.value(static_cast<int32_t>(asset.meshMaterials[m]));
+            writer.value(static_cast<uint32_t>(mesh.uvs != nullptr));
+        }
+
+        for (const Mesh &mesh: asset.meshes) {
+            writer.array(mesh.indices, mesh.numIndices);
+            writer.array(mesh.vertices, mesh.numVertices);
+            writer.array(mesh.normals, mesh.numVertices);
+            if (mesh.uvs) writer.array(mesh.uvs, mesh.numVertices);
+        }
+        if (!out) return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, cachePath, error);
+    return !error;
+}
+
+bool readSceneCache(const std::string &cachePath, const std::string &sourcePath, MeshAsset &asset) {
+    SourceStamp stamp;
+    if (!SourceStamp::of(sourcePath, stamp)) return false;
+    std::unique_ptr<MappedFile> file = MappedFile::open(cachePath);
+    if (!file) return false;
+
+    CacheReader reader(file->data(), file->size());
+    if (reader.value<uint32_t>() != CACHE_MAGIC || reader.value<uint32_t>() != CACHE_VERSION ||
+        reader.value<uint32_t>() != sizeof(Vec3) || reader.value<uint32_t>() != sizeof(Vec2f) ||
+        reader.value<uint32_t>() != sizeof(Vec3i) || reader.value<uint64_t>() != stamp.size ||
+        reader.value<int64_t>() != stamp.time) {
+        return false;
+    }
+    const uint32_t numTextures  = reader.value<uint32_t>();
+    const uint32_t numMaterials = reader.value<uint32_t>();
+    const uint32_t numMeshes    = reader.value<uint32_t>();
+
+    MeshAsset cached;
+    const std::string baseDir = directoryOf(sourcePath);
+    for (uint32_t t = 0; t < numTextures && reader.ok(); ++t) {
+        cached.texturePaths.push_back(baseDir + reader.string());
+    }
+
+    for (uint32_t i = 0; i < numMaterials && reader.ok(); ++i) {
+        Material material{};
+        material.type            = static_cast<Material::Type>(reader.value<uint32_t>());
+        material.albedo          = reader.vec3();
+        material.refractionIndex = reader.value<float>();
+        material.IOR             = reader.vec3();
+        material.k               = reader.vec3();
+        material.alphaX          = reader.value<float>();
+        material.alphaY          = reader.value<float>();
+        material.emission        = reader.vec3();
+        material.texId           = reader.value<int32_t>();
+        if (material.texId < -1 || material.texId >= static_cast<int>(numTextures)) return false;
+        cached.materials.push_back(material);
+    }
+
+    std::vector<uint32_t> hasUVs;
+    for (uint32_t m = 0; m < numMeshes && reader.ok(); ++m) {
+        const std::string name = reader.string();
+        const int numVertices  = reader.value<int32_t>();
+        const int numIndices   = reader.value<int32_t>();
+        const int material     = reader.value<int32_t>();
+        hasUVs.push_back(reader.value<uint32_t>());
+        if (numVertices < 0 || numIndices < 0 || material < 0 || material >= static_cast<int>(numMaterials)) return false;
+
+        cached.meshes.emplace_back(name, nullptr, numIndices, nullptr, numVertices, nullptr, nullptr, nullptr);
+        cached.meshes.back().ownsData = false;
+        cached.meshMaterials.push_back(material);
+    }
+
+    for (uint32_t m = 0; m < numMeshes && reader.ok(); ++m) {
+        Mesh &mesh    = cached.meshes[m];
+        mesh.indices  = reader.array<Vec3i>(mesh.numIndices);
+        mesh.vertices = reader.array<Vec3>(mesh.numVertices);
+        mesh.normals  = reader.array<Vec3>(mesh.numVertices);
+        if (hasUVs[m]) mesh.uvs = reader.array<Vec2f>(mesh.numVertices);
+    }
+    if (!reader.ok()) return false;
+
+    cached.storage.push_back(std::move(file));
+    asset = std::move(cached);
+    return true;
+}
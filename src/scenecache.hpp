@@ -0,0 +1,57 @@
+#pragma once
+
+#include "material.hpp"
+#include "mesh.hpp"
+#include "util/mappedfile.hpp"
+
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+/**
+ * Copy of a mesh of the asset, placed by a matrix applied after the mesh transform
+ */
+struct MeshPlacement {
+    int mesh;
+    Affine transform;
+};
+
+/**
+ * Meshes, materials and texture references of one asset file, as Scene::loadMesh adds them
+ * Indices are local to the asset, the scene offsets them when it takes the asset in
+ */
+struct MeshAsset {
+    std::vector<std::string> texturePaths;
+    // Encoded image files of textures embedded in the asset, indexed like texturePaths and empty for textures
+    // that are read from their path. Embedded textures are decoded in memory and never streamed
+    std::vector<std::span<const uint8_t>> textureData;
+    // texId indexes texturePaths
+    std::vector<Material> materials;
+    // Mesh::material is left null, meshMaterials holds the index into materials instead
+    std::vector<Mesh> meshes;
+    std::vector<int> meshMaterials;
+    // Empty places every mesh once with an identity placement
+    std::vector<MeshPlacement> instances;
+    // Keeps alive the memory of meshes that do not own their arrays, and of textureData
+    std::vector<std::shared_ptr<void>> storage;
+};
+
+// Scene caches are binary copies of a MeshAsset, so assets only go through their importer once
+// A cache records the size and modification time of its source file and is ignored once those change.
+// Mesh arrays are stored in their in-memory layout, a loaded cache is mapped and the meshes point straight into
+// the mapping without being parsed or copied.
+// Only what importers that go through a cache fill in is stored, embedded textures and placements are not.
+
+/**
+ * Writes asset to cachePath, under a temporary name first so readers never see a partial file
+ * @param sourcePath file the asset was imported from, texture paths are stored relative to its directory
+ */
+bool writeSceneCache(const std::string &cachePath, const std::string &sourcePath, const MeshAsset &asset);
+
+/**
+ * Maps the cache at cachePath and fills asset from it, its meshes do not own their arrays
+ * and point into the mapping, which is added to asset.storage
+ * @return false if there is no valid cache for sourcePath
+ */
+bool readSceneCache(const std::string &cachePath, const std::string &sourcePath, MeshAsset &asset);
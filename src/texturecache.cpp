@@ -0,0 +1,254 @@
+#include "texturecache.hpp"
+#include "image.hpp"
+#include "mipmap.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+// Tiled file layout, all little endian 32 bit values:
+//   magic, version, tile size, texel format, compressAbove as two values (low first), number of levels,
+//   then width and height of every level
+//   followed by the tiles of each level in row-major order, each a TILE_SIZE^2 TexelBuffer in the texel format
+static constexpr uint32_t TILED_MAGIC   = 0x5458544a; // "JTXT"
+static constexpr uint32_t TILED_VERSION = 2;
+static constexpr int TILED_HEADER_VALUES = 7;
+
+static constexpr int LOCAL_TILES = 64;
+// Local counts are added to the shared statistics in batches of this size
+static constexpr uint64_t LOCAL_FLUSH_INTERVAL = 4096;
+
+static std::atomic<uint64_t> nextCacheId = 1;
+
+namespace {
+struct LocalTile {
+    uint64_t cacheId = 0;
+    uint64_t key     = 0;
+    std::shared_ptr<const void> tile;
+};
+
+struct LocalCache {
+    std::array<LocalTile, LOCAL_TILES> tiles;
+    // Lookups and hits not yet added to the cache with id statsCacheId
+    uint64_t statsCacheId = 0;
+    uint64_t lookups      = 0;
+    uint64_t hits         = 0;
+};
+
+thread_local LocalCache localCache;
+}
+
+TextureCache::TextureCache(const size_t budgetBytes)
+    : id_(nextCacheId++),
+      budgetBytes_(budgetBytes) {}
+
+// Reads the header values up to the number of levels
+static bool readHeader(std::ifstream &in, uint32_t &format, uint64_t &compressAbove, uint32_t &numLevels) {
+    const auto read = [&] {
+        uint32_t value = 0;
+        in.read(reinterpret_cast<char *>(&value), sizeof(value));
+        return value;
+    };
+    if (!in || read() != TILED_MAGIC || read() != TILED_VERSION || read() != TextureCache::TILE_SIZE) return false;
+    format        = read();
+    compressAbove = read();
+    compressAbove |= static_cast<uint64_t>(read()) << 32;
+    numLevels = read();
+    return static_cast<bool>(in) && format <= static_cast<uint32_t>(TexelFormat::BC1);
+}
+
+bool TextureCache::convert(const std::string &path, std::string &tiledPath, const size_t compressAbove) {
+    namespace fs = std::filesystem;
+    tiledPath = path + ".tiles";
+
+    std::error_code error;
+    if (fs::exists(tiledPath, error) && fs::last_write_time(tiledPath, error) >= fs::last_write_time(path, error) && !error) {
+        // Older versions and other compression settings are converted again
+        std::ifstream in(tiledPath, std::ios::binary);
+        uint32_t format, numLevels;
+        uint64_t fileCompressAbove;
+        if (readHeader(in, format, fileCompressAbove, numLevels) && fileCompressAbove == compressAbove) return true;
+    }
+
+    TextureImage image;
+    if (!image.load(path.c_str())) return false;
+    const MIPMap mipmap(image, MIPMap::TRILINEAR, compressAbove);
+    const TexelFormat format = mipmap.texels(0).format();
+
+    // Written under a temporary name, so an interrupted conversion is never mistaken for an up to date file
+    const std::string tempPath = tiledPath + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary);
+        if (!out) return false;
+
+        const auto write = [&](const uint32_t value) { out.write(reinterpret_cast<const char *>(&value), sizeof(value)); };
+        write(TILED_MAGIC);
+        write(TILED_VERSION);
+        write(TILE_SIZE);
+        write(static_cast<uint32_t>(format));
+        write(static_cast<uint32_t>(compressAbove));
+        write(static_cast<uint32_t>(static_cast<uint64_t>(compressAbove) >> 32));
+        write(mipmap.levels());
+        for (int level = 0; level < mipmap.levels(); ++level) {
+            write(mipmap.width(level));
+            write(mipmap.height(level));
+        }
+
+        for (int level = 0; level < mipmap.levels(); ++level) {
+            const int tilesX = (mipmap.width(level) + TILE_SIZE - 1) / TILE_SIZE;
+            const int tilesY = (mipmap.height(level) + TILE_SIZE - 1) / TILE_SIZE;
+            for (int ty = 0; ty < tilesY; ++ty) {
+                for (int tx = 0; tx < tilesX; ++tx) {
+                    // Edge tiles are padded with zeros, lookups never read them
+                    TexelBuffer tile(format, TILE_SIZE, TILE_SIZE);
+                    tile.copyFrom(mipmap.texels(level), tx * TILE_SIZE, ty * TILE_SIZE);
+                    out.write(reinterpret_cast<const char *>(tile.data()), static_cast<std::streamsize>(tile.sizeBytes()));
+                }
+            }
+        }
+        if (!out) return false;
+    }
+
+    fs::rename(tempPath, tiledPath, error);
+    return !error;
+}
+
+int TextureCache::addTexture(const std::string &tiledPath) {
+    auto texture = std::make_unique<Texture>();
+    texture->file.open(tiledPath, std::ios::binary);
+
+    uint32_t format, numLevels;
+    uint64_t compressAbove;
+    if (!readHeader(texture->file, format, compressAbove, numLevels)) {
+        std::cerr << "Invalid tiled texture: " << tiledPath << std::endl;
+        return -1;
+    }
+    texture->format    = static_cast<TexelFormat>(format);
+    texture->tileBytes = TexelBuffer(texture->format, TILE_SIZE, TILE_SIZE).sizeBytes();
+
+    const auto read = [&] {
+        uint32_t value = 0;
+        texture->file.read(reinterpret_cast<char *>(&value), sizeof(value));
+        return value;
+    };
+    std::streamoff offset = static_cast<std::streamoff>(TILED_HEADER_VALUES + 2 * numLevels) * sizeof(uint32_t);
+    texture->levels.resize(numLevels);
+    for (Level &level: texture->levels) {
+        level.width  = static_cast<int>(read());
+        level.height = static_cast<int>(read());
+        level.tilesX = (level.width + TILE_SIZE - 1) / TILE_SIZE;
+        level.tilesY = (level.height + TILE_SIZE - 1) / TILE_SIZE;
+        level.offset = offset;
+        offset += static_cast<std::streamoff>(level.tilesX) * level.tilesY * static_cast<std::streamoff>(texture->tileBytes);
+    }
+    if (!texture->file || numLevels == 0) {
+        std::cerr << "Invalid tiled texture: " << tiledPath << std::endl;
+        return -1;
+    }
+
+    textures_.push_back(std::move(texture));
+    return static_cast<int>(textures_.size()) - 1;
+}
+
+Vec3 TextureCache::texel(const int texture, const int level, const int x, const int y) const {
+    const int tileX    = x / TILE_SIZE;
+    const int tileY    = y / TILE_SIZE;
+    const uint64_t key = tileKey(texture, level, tileX, tileY);
+
+    LocalCache &local = localCache;
+    if (local.statsCacheId != id_) {
+        local.statsCacheId = id_;
+        local.lookups = local.hits = 0;
+    }
+    ++local.lookups;
+
+    // Fibonacci hashing spreads neighbouring tiles over the slots
+    LocalTile &slot = local.tiles[(key * 0x9e3779b97f4a7c15ull) >> 58];
+    const bool hit  = slot.cacheId == id_ && slot.key == key;
+    if (hit) {
+        ++local.hits;
+    } else {
+        slot.cacheId = id_;
+        slot.key     = key;
+        slot.tile    = fetchTile(key, texture, level, tileX, tileY);
+    }
+
+    // Misses already went through the shared cache, so flushing then keeps the shared counts consistent
+    if (!hit || local.lookups >= LOCAL_FLUSH_INTERVAL) {
+        lookups_.fetch_add(local.lookups, std::memory_order_relaxed);
+        localHits_.fetch_add(local.hits, std::memory_order_relaxed);
+        local.lookups = local.hits = 0;
+    }
+
+    return static_cast<const TexelBuffer *>(slot.tile.get())->get(x % TILE_SIZE, y % TILE_SIZE);
+}
+
+std::shared_ptr<const TexelBuffer> TextureCache::fetchTile(const uint64_t key, const int texture, const int level, const int tileX, const int tileY) const {
+    {
+        std::lock_guard lock(mutex_);
+        const auto it = tiles_.find(key);
+        if (it != tiles_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second.lruPosition);
+            sharedHits_.fetch_add(1, std::memory_order_relaxed);
+            return it->second.tile;
+        }
+    }
+
+    // Read outside the lock, other threads keep hitting the cache meanwhile
+    std::shared_ptr<const TexelBuffer> tile = readTile(texture, level, tileX, tileY);
+
+    std::lock_guard lock(mutex_);
+    const auto [it, inserted] = tiles_.try_emplace(key);
+    if (!inserted) {
+        // Another thread read the same tile first
+        return it->second.tile;
+    }
+    lru_.push_front(key);
+    it->second.tile        = tile;
+    it->second.lruPosition = lru_.begin();
+    bytesResident_ += tile->sizeBytes();
+    peakBytesResident_ = std::max(peakBytesResident_, bytesResident_);
+    tileLoads_.fetch_add(1, std::memory_order_relaxed);
+
+    // Keep at least the tile that was just loaded
+    while (bytesResident_ > budgetBytes_ && lru_.size() > 1) {
+        const auto evicted = tiles_.find(lru_.back());
+        bytesResident_ -= evicted->second.tile->sizeBytes();
+        tiles_.erase(evicted);
+        lru_.pop_back();
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return tile;
+}
+
+std::shared_ptr<TexelBuffer> TextureCache::readTile(const int texture, const int level, const int tileX, const int tileY) const {
+    Texture &t     = *textures_[texture];
+    const Level &l = t.levels[level];
+    auto tile      = std::make_shared<TexelBuffer>(t.format, TILE_SIZE, TILE_SIZE);
+
+    std::lock_guard lock(t.fileMutex);
+    t.file.seekg(l.offset + static_cast<std::streamoff>(tileY * l.tilesX + tileX) * static_cast<std::streamoff>(t.tileBytes));
+    t.file.read(reinterpret_cast<char *>(tile->data()), static_cast<std::streamsize>(t.tileBytes));
+    if (!t.file) {
+        // Truncated file, black is better than stopping the render
+        t.file.clear();
+        std::memset(tile->data(), 0, t.tileBytes);
+    }
+    return tile;
+}
+
+TextureCacheStats TextureCache::stats() const {
+    TextureCacheStats stats;
+    stats.lookups    = lookups_.load(std::memory_order_relaxed);
+    stats.localHits  = localHits_.load(std::memory_order_relaxed);
+    stats.sharedHits = sharedHits_.load(std::memory_order_relaxed);
+    stats.tileLoads  = tileLoads_.load(std::memory_order_relaxed);
+    stats.evictions  = evictions_.load(std::memory_order_relaxed);
+
+    std::lock_guard lock(mutex_);
+    stats.bytesResident     = bytesResident_;
+    stats.peakBytesResident = peakBytesResident_;
+    return stats;
+}
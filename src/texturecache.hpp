@@ -0,0 +1,138 @@
+#pragma once
+
+#include "rt.hpp"
+#include "util/texel.hpp"
+
+#include <atomic>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct TextureCacheStats {
+    // Tile lookups, and how many of them the calling thread's own cache or the shared cache answered
+    uint64_t lookups    = 0;
+    uint64_t localHits  = 0;
+    uint64_t sharedHits = 0;
+    // Tiles read from disk, and tiles dropped again to stay within the budget
+    uint64_t tileLoads = 0;
+    uint64_t evictions = 0;
+    size_t bytesResident     = 0;
+    size_t peakBytesResident = 0;
+
+    [[nodiscard]] double hitRate() const {
+        if (lookups == 0) return 0;
+        return static_cast<double>(localHits + sharedHits) / static_cast<double>(lookups);
+    }
+};
+
+/**
+ * Streams MIP map texels from tiled files on disk, with at most budgetBytes of tiles in memory
+ * Textures are converted once into a tiled file next to the source image (see convert()), after that only
+ * the tiles that lookups touch are read. Tiles keep the texel format of the MIP map, so 8 bit and block
+ * compressed textures fit more tiles into the same budget. The least recently used tiles are evicted when over budget.
+ * Each thread keeps a small direct-mapped cache of the tiles it used last, so lookups that stay within
+ * a few tiles never take the lock. Tiles are reference counted, a tile evicted while a thread still
+ * holds it is freed once that thread moves on.
+ */
+class TextureCache {
+public:
+    // Texels per tile side
+    static constexpr int TILE_SIZE = 32;
+
+    explicit TextureCache(size_t budgetBytes);
+
+    TextureCache(const TextureCache &)            = delete;
+    TextureCache &operator=(const TextureCache &) = delete;
+
+    /**
+     * Writes the MIP pyramid of the image at path to a tiled file, unless an up to date one already exists
+     * Safe to call concurrently for different images
+     * @param tiledPath set to the tiled file
+     * @param compressAbove passed on to the MIPMap, files converted with a different value are rewritten
+     */
+    static bool convert(const std::string &path, std::string &tiledPath, size_t compressAbove = 0);
+
+    /**
+     * Opens a tiled file written by convert(), no tiles are read yet
+     * Must not be called while other threads are looking up texels
+     * @return texture index, -1 if the file could not be read
+     */
+    int addTexture(const std::string &tiledPath);
+
+    [[nodiscard]] int levels(const int texture) const {
+        return static_cast<int>(textures_[texture]->levels.size());
+    }
+
+    [[nodiscard]] int width(const int texture, const int level) const {
+        return textures_[texture]->levels[level].width;
+    }
+
+    [[nodiscard]] int height(const int texture, const int level) const {
+        return textures_[texture]->levels[level].height;
+    }
+
+    /**
+     * x and y have to be within the level
+     */
+    [[nodiscard]] Vec3 texel(int texture, int level, int x, int y) const;
+
+    /**
+     * Hits in the thread caches are added in batches, so these lag behind by a few thousand lookups per thread
+     */
+    [[nodiscard]] TextureCacheStats stats() const;
+
+private:
+    struct Level {
+        int width, height;
+        int tilesX, tilesY;
+        // Of the level's first tile in the file
+        std::streamoff offset;
+    };
+
+    struct Texture {
+        TexelFormat format;
+        size_t tileBytes;
+        std::vector<Level> levels;
+        std::ifstream file;
+        std::mutex fileMutex;
+    };
+
+    struct CachedTile {
+        std::shared_ptr<const TexelBuffer> tile;
+        std::list<uint64_t>::iterator lruPosition;
+    };
+
+    // Tells the thread caches of different TextureCaches apart, even at the same address
+    const uint64_t id_;
+    const size_t budgetBytes_;
+    std::vector<std::unique_ptr<Texture>> textures_;
+
+    mutable std::mutex mutex_;
+    mutable std::unordered_map<uint64_t, CachedTile> tiles_;
+    // Most recently used first
+    mutable std::list<uint64_t> lru_;
+    mutable size_t bytesResident_     = 0;
+    mutable size_t peakBytesResident_ = 0;
+
+    mutable std::atomic<uint64_t> lookups_    = 0;
+    mutable std::atomic<uint64_t> localHits_  = 0;
+    mutable std::atomic<uint64_t> sharedHits_ = 0;
+    mutable std::atomic<uint64_t> tileLoads_  = 0;
+    mutable std::atomic<uint64_t> evictions_  = 0;
+
+    static uint64_t tileKey(const int texture, const int level, const int tileX, const int tileY) {
+        return static_cast<uint64_t>(texture) << 48 | static_cast<uint64_t>(level) << 40 |
+               static_cast<uint64_t>(tileY) << 20 | static_cast<uint64_t>(tileX);
+    }
+
+    /**
+     * Shared cache lookup, reads the tile from disk on a miss
+     */
+    std::shared_ptr<const TexelBuffer> fetchTile(uint64_t key, int texture, int level, int tileX, int tileY) const;
+
+    [[nodiscard]] std::shared_ptr<TexelBuffer> readTile(int texture, int level, int tileX, int tileY) const;
+};
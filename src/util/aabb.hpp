@@ -3,6 +3,26 @@
 #include "interval.hpp"
 #include "../rt.hpp"
 
+#ifdef ROBUST_TRAVERSAL
+// Ize's conservative far-plane scale, 1 + 2 * gamma(3), so rounding never culls a box the ray touches
+constexpr float SLAB_FAR_SCALE = 1 + 2 * (3 * std::numeric_limits<float>::epsilon() * 0.5f) /
+                                         (1 - 3 * std::numeric_limits<float>::epsilon() * 0.5f);
+#endif
+
+/**
+ * Ray with the per-ray terms of the slab test precomputed once before traversal
+ */
+struct TraversalRay {
+    Vec3 origin;
+    Vec3 invDir;
+    int dirIsNeg[3];
+
+    explicit TraversalRay(const Ray &r)
+        : origin(r.origin),
+          invDir(1 / r.dir),
+          dirIsNeg{static_cast<int>(invDir.x < 0), static_cast<int>(invDir.y < 0), static_cast<int>(invDir.z < 0)} {}
+};
+
 // TO-DO: Replace with version from PBRTv4
 class AABB {
 public:
@@ -80,6 +100,24 @@ public:
         return true;
     }
 
+    /**
+     * Branchless slab test, the near and far planes are picked by the sign of the direction
+     */
+    [[nodiscard]] bool hit(const TraversalRay &r, const Interval &t) const {
+        const Vec3 &nx = r.dirIsNeg[0] ? pmax : pmin, &fx = r.dirIsNeg[0] ? pmin : pmax;
+        const Vec3 &ny = r.dirIsNeg[1] ? pmax : pmin, &fy = r.dirIsNeg[1] ? pmin : pmax;
+        const Vec3 &nz = r.dirIsNeg[2] ? pmax : pmin, &fz = r.dirIsNeg[2] ? pmin : pmax;
+
+        const float t0 = jtx::max(jtx::max((nx.x - r.origin.x) * r.invDir.x, (ny.y - r.origin.y) * r.invDir.y),
+                                  jtx::max((nz.z - r.origin.z) * r.invDir.z, t.min));
+        float t1       = jtx::min(jtx::min((fx.x - r.origin.x) * r.invDir.x, (fy.y - r.origin.y) * r.invDir.y),
+                                  (fz.z - r.origin.z) * r.invDir.z);
+#ifdef ROBUST_TRAVERSAL
+        t1 *= SLAB_FAR_SCALE;
+#endif
+        return t0 <= jtx::min(t1, t.max);
+    }
+
     Vec3 diagonal() const {
         return pmax - pmin;
     }
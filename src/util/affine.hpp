@@ -0,0 +1,93 @@
+#pragma once
+
+#include "../rt.hpp"
+#include "aabb.hpp"
+
+/**
+ * Row-major 3x4 affine matrix
+ * Used where we need an inverse, or a compact matrix in hot loops (e.g. instance transforms)
+ */
+struct Affine {
+    Vec3 r0, r1, r2;
+    Vec3 t;
+
+    static Affine identity() {
+        return {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {0, 0, 0}};
+    }
+
+    /**
+     * Matrix mapping the basis vectors to c0, c1, c2 and the origin to t
+     */
+    static Affine fromColumns(const Vec3 &c0, const Vec3 &c1, const Vec3 &c2, const Vec3 &t) {
+        return {{c0.x, c1.x, c2.x}, {c0.y, c1.y, c2.y}, {c0.z, c1.z, c2.z}, t};
+    }
+
+    /**
+     * Extracts the affine part of a transform by mapping the origin and basis vectors
+     */
+    static Affine fromTransform(const Transform &transform) {
+        const Vec3 o = transform.applyToPoint(Vec3(0, 0, 0));
+        return fromColumns(transform.applyToPoint(Vec3(1, 0, 0)) - o,
+                           transform.applyToPoint(Vec3(0, 1, 0)) - o,
+                           transform.applyToPoint(Vec3(0, 0, 1)) - o,
+                           o);
+    }
+
+    /**
+     * Composition that applies b first
+     */
+    Affine operator*(const Affine &b) const {
+        return fromColumns(applyToVector({b.r0.x, b.r1.x, b.r2.x}),
+                           applyToVector({b.r0.y, b.r1.y, b.r2.y}),
+                           applyToVector({b.r0.z, b.r1.z, b.r2.z}),
+                           applyToPoint(b.t));
+    }
+
+    [[nodiscard]] Vec3 applyToPoint(const Vec3 &p) const {
+        return {jtx::dot(r0, p) + t.x, jtx::dot(r1, p) + t.y, jtx::dot(r2, p) + t.z};
+    }
+
+    [[nodiscard]] Vec3 applyToVector(const Vec3 &v) const {
+        return {jtx::dot(r0, v), jtx::dot(r1, v), jtx::dot(r2, v)};
+    }
+
+    /**
+     * Multiplies by the transpose of the linear part
+     * Applied to the inverse matrix, this transforms normals
+     */
+    [[nodiscard]] Vec3 applyTransposeToVector(const Vec3 &v) const {
+        return r0 * v.x + r1 * v.y + r2 * v.z;
+    }
+
+    [[nodiscard]] float determinant() const {
+        return jtx::dot(r0, jtx::cross(r1, r2));
+    }
+
+    [[nodiscard]] Affine inverse() const {
+        // Columns of the linear part
+        const Vec3 c0 = {r0.x, r1.x, r2.x};
+        const Vec3 c1 = {r0.y, r1.y, r2.y};
+        const Vec3 c2 = {r0.z, r1.z, r2.z};
+
+        const float invDet = 1 / jtx::dot(c0, jtx::cross(c1, c2));
+
+        Affine inv;
+        inv.r0 = jtx::cross(c1, c2) * invDet;
+        inv.r1 = jtx::cross(c2, c0) * invDet;
+        inv.r2 = jtx::cross(c0, c1) * invDet;
+        inv.t  = -inv.applyToVector(t);
+        return inv;
+    }
+
+    /**
+     * Bounds of a transformed box, via its center and the absolute linear part applied to its extent
+     */
+    [[nodiscard]] AABB applyToBounds(const AABB &b) const {
+        const Vec3 center = applyToPoint(0.5f * (b.pmin + b.pmax));
+        const Vec3 extent = 0.5f * b.diagonal();
+        const Vec3 e      = {jtx::abs(r0.x) * extent.x + jtx::abs(r0.y) * extent.y + jtx::abs(r0.z) * extent.z,
+                             jtx::abs(r1.x) * extent.x + jtx::abs(r1.y) * extent.y + jtx::abs(r1.z) * extent.z,
+                             jtx::abs(r2.x) * extent.x + jtx::abs(r2.y) * extent.y + jtx::abs(r2.z) * extent.z};
+        return {center - e, center + e};
+    }
+};
@@ -0,0 +1,59 @@
+#include "aliastable.hpp"
+
+AliasTable::AliasTable(const std::vector<float> &weights) {
+    // Accumulate in double, large images have millions of weights
+    double sum = 0;
+    for (const float w: weights) sum += w;
+    if (sum == 0) return;
+
+    const int n = static_cast<int>(weights.size());
+    bins_.resize(n);
+    for (int i = 0; i < n; ++i) {
+        bins_[i].p = static_cast<float>(weights[i] / sum);
+    }
+
+    // Vose's method, under and over full bins are paired until every bin holds exactly 1/n
+    struct Outcome {
+        double pHat;
+        int index;
+    };
+    std::vector<Outcome> under, over;
+    for (int i = 0; i < n; ++i) {
+        const double pHat = weights[i] / sum * n;
+        if (pHat < 1) {
+            under.push_back({pHat, i});
+        } else {
+            over.push_back({pHat, i});
+        }
+    }
+
+    while (!under.empty() && !over.empty()) {
+        const Outcome un = under.back();
+        under.pop_back();
+        const Outcome ov = over.back();
+        over.pop_back();
+
+        bins_[un.index].q     = static_cast<float>(un.pHat);
+        bins_[un.index].alias = ov.index;
+
+        // The excess of the over full bin moves back into one of the lists
+        const double pExcess = un.pHat + ov.pHat - 1;
+        if (pExcess < 1) {
+            under.push_back({pExcess, ov.index});
+        } else {
+            over.push_back({pExcess, ov.index});
+        }
+    }
+
+    // Whatever is left is 1 up to rounding error
+    while (!over.empty()) {
+        bins_[over.back().index].q     = 1;
+        bins_[over.back().index].alias = -1;
+        over.pop_back();
+    }
+    while (!under.empty()) {
+        bins_[under.back().index].q     = 1;
+        bins_[under.back().index].alias = -1;
+        under.pop_back();
+    }
+}
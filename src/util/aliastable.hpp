@@ -0,0 +1,59 @@
+#pragma once
+
+#include "lowdiscrepancy.hpp"
+
+#include <vector>
+
+// Follows PBRTv4's AliasTable
+// https://pbr-book.org/4ed/Sampling_Algorithms/The_Alias_Method
+
+/**
+ * Samples an index proportional to a set of non-negative weights in constant time
+ * Each bin holds the probability of keeping its own index, and the index it aliases to otherwise
+ */
+class AliasTable {
+public:
+    AliasTable() = default;
+
+    explicit AliasTable(const std::vector<float> &weights);
+
+    /**
+     * @param pmf probability of the returned index
+     * @param uRemapped u rescaled to [0, 1) within the chosen bin, so it can be reused for another dimension
+     * @return -1 if all weights are zero
+     */
+    int sample(const float u, float *pmf = nullptr, float *uRemapped = nullptr) const {
+        if (bins_.empty()) return -1;
+
+        const int n      = size();
+        const int offset = jtx::min(static_cast<int>(u * static_cast<float>(n)), n - 1);
+        const float up   = jtx::min(u * static_cast<float>(n) - static_cast<float>(offset), ONE_MINUS_EPSILON);
+
+        const Bin &bin = bins_[offset];
+        if (up < bin.q) {
+            if (pmf) *pmf = bin.p;
+            if (uRemapped) *uRemapped = jtx::min(up / bin.q, ONE_MINUS_EPSILON);
+            return offset;
+        }
+        if (pmf) *pmf = bins_[bin.alias].p;
+        if (uRemapped) *uRemapped = jtx::min((up - bin.q) / (1 - bin.q), ONE_MINUS_EPSILON);
+        return bin.alias;
+    }
+
+    [[nodiscard]] float pmf(const int index) const {
+        return bins_[index].p;
+    }
+
+    [[nodiscard]] int size() const {
+        return static_cast<int>(bins_.size());
+    }
+
+private:
+    struct Bin {
+        // Probability of keeping this index, and of sampling it overall
+        float q = 0, p = 0;
+        int alias = -1;
+    };
+
+    std::vector<Bin> bins_;
+};
@@ -8,6 +8,15 @@ static constexpr Float RGB_SCALE = 255.999;
 static const auto WHITE = Color(1, 1, 1);
 static const auto BLACK = Color(0, 0, 0);
 
+DEV INLINE Float maxComponent(const Color &c) {
+    return jtx::max(c.r, jtx::max(c.g, c.b));
+}
+
+// Rec. 709 luminance of linear RGB
+DEV INLINE Float luminance(const Color &c) {
+    return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+}
+
 DEV INLINE void writeColor(std::ostream &out, const Color &pixelColor) {
     const int r = static_cast<int>(RGB_SCALE * pixelColor.r);
     const int g = static_cast<int>(RGB_SCALE * pixelColor.g);
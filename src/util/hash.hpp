@@ -128,3 +128,8 @@ inline uint64_t hash(int a, int b) {
     std::memcpy(buf + sizeof(a), &b, sizeof(b));
     return detail::murmurHash64A((const unsigned char *)buf, sz, 0);
 }
+
+// Hash of size bytes at data, seed chains several buffers into one hash
+inline uint64_t hashBuffer(const void *data, const size_t size, const uint64_t seed = 0) {
+    return detail::murmurHash64A(static_cast<const unsigned char *>(data), size, seed);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "../rt.hpp"
+#include "hash.hpp"
+
+// Most of this follows PBRTv4
+// https://github.com/mmp/pbrt-v4/blob/master/src/pbrt/util/lowdiscrepancy.h
+
+// Largest float below 1, keeps samples in [0, 1)
+static constexpr float ONE_MINUS_EPSILON = 0x1.fffffep-1f;
+
+inline uint32_t reverseBits32(uint32_t n) {
+    n = (n << 16) | (n >> 16);
+    n = ((n & 0x00ff00ff) << 8) | ((n & 0xff00ff00) >> 8);
+    n = ((n & 0x0f0f0f0f) << 4) | ((n & 0xf0f0f0f0) >> 4);
+    n = ((n & 0x33333333) << 2) | ((n & 0xcccccccc) >> 2);
+    n = ((n & 0x55555555) << 1) | ((n & 0xaaaaaaaa) >> 1);
+    return n;
+}
+
+// Spreads the lower 32 bits of x over the even bits
+inline uint64_t leftShift2(uint64_t x) {
+    x &= 0xffffffff;
+    x = (x ^ (x << 16)) & 0x0000ffff0000ffff;
+    x = (x ^ (x << 8)) & 0x00ff00ff00ff00ff;
+    x = (x ^ (x << 4)) & 0x0f0f0f0f0f0f0f0f;
+    x = (x ^ (x << 2)) & 0x3333333333333333;
+    x = (x ^ (x << 1)) & 0x5555555555555555;
+    return x;
+}
+
+inline uint64_t encodeMorton2(const uint32_t x, const uint32_t y) {
+    return (leftShift2(y) << 1) | leftShift2(x);
+}
+
+/**
+ * Element i of a random permutation of [0, n), selected by seed
+ * Kensler, "Correlated Multi-Jittered Sampling"
+ */
+inline int permutationElement(uint32_t i, const uint32_t n, const uint32_t seed) {
+    uint32_t w = n - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= seed;
+        i *= 0xe170893d;
+        i ^= seed >> 16;
+        i ^= (i & w) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929eb3f;
+        i ^= seed >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= n);
+    return static_cast<int>((i + seed) % n);
+}
+
+/**
+ * Hash based Owen scrambling (Laine and Karras), each bit is flipped depending only on the bits above it
+ * Keeps the stratification of the Sobol points while decorrelating pixels, at a fraction of the cost of
+ * hashing every prefix
+ */
+inline uint32_t fastOwenScramble(uint32_t v, const uint32_t seed) {
+    v = reverseBits32(v);
+    v ^= v * 0x3d20adea;
+    v += seed;
+    v *= (seed >> 16) | 1;
+    v ^= v * 0x05526c56;
+    v ^= v * 0x53a22864;
+    return reverseBits32(v);
+}
+
+/**
+ * Owen scrambled sample from one of the first two Sobol dimensions
+ * Dimension 0 is the van der Corput sequence, dimension 1 is generated by the polynomial x + 1.
+ * Higher dimensions are padded from these two by the samplers, so no generator matrix table is needed.
+ * The 32 bit generator matrices only resolve the low 32 bits of the index, the bits above select the scramble
+ * instead. Indices that differ only there (distant pixels of a large ZSobol image) then get unrelated points.
+ */
+inline float sobolSample(const uint64_t fullIndex, const int dimension, uint32_t seed) {
+    if (const uint64_t high = fullIndex >> 32) seed ^= static_cast<uint32_t>(mixBits(high));
+
+    auto index = static_cast<uint32_t>(fullIndex);
+    uint32_t v = 0;
+    if (dimension == 0) {
+        v = reverseBits32(index);
+    } else {
+        for (uint32_t column = 1u << 31; index; index >>= 1, column ^= column >> 1) {
+            if (index & 1) v ^= column;
+        }
+    }
+    v = fastOwenScramble(v, seed);
+    return jtx::min(static_cast<float>(v) * 0x1p-32f, ONE_MINUS_EPSILON);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * Whole file mapped into memory, pages are read from disk on first touch
+ * The mapping is copy on write, so its contents can be modified in place without ever reaching the file
+ */
+class MappedFile {
+public:
+    /**
+     * @return null if the file could not be opened or mapped
+     */
+    static std::unique_ptr<MappedFile> open(const std::string &path);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile &)            = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Page aligned
+    [[nodiscard]] uint8_t *data() const { return data_; }
+    [[nodiscard]] size_t size() const { return size_; }
+
+private:
+    MappedFile() = default;
+
+    uint8_t *data_ = nullptr;
+    size_t size_   = 0;
+};
@@ -49,7 +49,8 @@ public:
         init(seed);
     }
 
-    RNG(const uint32_t x, const uint32_t y, const uint32_t n) {
+    RNG(const uint32_t x, const uint32_t y, const uint32_t n)
+        : state_(0) {
         const auto seed = fnv1a_3(x, y, n);
         init(seed);
     }
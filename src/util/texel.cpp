@@ -0,0 +1,192 @@
+#include "texel.hpp"
+
+#include <algorithm>
+
+const std::array<float, 256> SRGB8_TO_LINEAR = [] {
+    std::array<float, 256> lut{};
+    for (int i = 0; i < 256; ++i) {
+        const float c = static_cast<float>(i) / 255;
+        lut[i]        = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    return lut;
+}();
+
+TexelBuffer::TexelBuffer(const TexelFormat format, const int width, const int height)
+    : format_(format),
+      width_(width),
+      height_(height) {
+    const size_t texels = static_cast<size_t>(width) * height;
+    switch (format) {
+        case TexelFormat::SRGB8:
+            data_.resize(texels * 3);
+            break;
+        case TexelFormat::HALF:
+            data_.resize(texels * 3 * sizeof(uint16_t));
+            break;
+        case TexelFormat::FLOAT:
+            data_.resize(texels * 3 * sizeof(float));
+            break;
+        case TexelFormat::BC1:
+            data_.resize(static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * 8);
+            break;
+    }
+}
+
+void TexelBuffer::copyFrom(const TexelBuffer &src, const int x, const int y) {
+    // Copied in units of single texels, or of whole blocks for BC1
+    int unit, unitBytes;
+    switch (format_) {
+        case TexelFormat::SRGB8: unit = 1, unitBytes = 3; break;
+        case TexelFormat::HALF: unit = 1, unitBytes = 3 * sizeof(uint16_t); break;
+        case TexelFormat::FLOAT: unit = 1, unitBytes = 3 * sizeof(float); break;
+        default: unit = 4, unitBytes = 8; break;
+    }
+    const int srcUnitsX = (src.width_ + unit - 1) / unit;
+    const int dstUnitsX = (width_ + unit - 1) / unit;
+    const int unitsX    = std::min(dstUnitsX, srcUnitsX - x / unit);
+    const int unitsY    = std::min((height_ + unit - 1) / unit, (src.height_ + unit - 1) / unit - y / unit);
+    if (unitsX <= 0) return;
+
+    for (int row = 0; row < unitsY; ++row) {
+        const uint8_t *from = src.data_.data() + (static_cast<size_t>(y / unit + row) * srcUnitsX + x / unit) * unitBytes;
+        std::copy_n(from, static_cast<size_t>(unitsX) * unitBytes, data_.data() + static_cast<size_t>(row) * dstUnitsX * unitBytes);
+    }
+}
+
+// 565 endpoint to 8 bit sRGB, replicating the high bits like the hardware decoders
+static void expand565(const uint16_t c, int rgb[3]) {
+    const int r = c >> 11 & 31, g = c >> 5 & 63, b = c & 31;
+    rgb[0]      = r << 3 | r >> 2;
+    rgb[1]      = g << 2 | g >> 4;
+    rgb[2]      = b << 3 | b >> 2;
+}
+
+// Palette entry index of a block with endpoints c0 and c1
+static void bc1Color(const uint16_t c0, const uint16_t c1, const int index, int rgb[3]) {
+    int e0[3], e1[3];
+    expand565(c0, e0);
+    expand565(c1, e1);
+    for (int c = 0; c < 3; ++c) {
+        switch (index) {
+            case 0: rgb[c] = e0[c]; break;
+            case 1: rgb[c] = e1[c]; break;
+            // c0 <= c1 selects the three color mode, whose last entry is black
+            case 2: rgb[c] = c0 > c1 ? (2 * e0[c] + e1[c] + 1) / 3 : (e0[c] + e1[c]) / 2; break;
+            default: rgb[c] = c0 > c1 ? (e0[c] + 2 * e1[c] + 1) / 3 : 0; break;
+        }
+    }
+}
+
+Vec3 TexelBuffer::getBC1(const int x, const int y) const {
+    const int blocksX    = (width_ + 3) / 4;
+    const uint8_t *block = data_.data() + (static_cast<size_t>(y / 4) * blocksX + x / 4) * 8;
+
+    const uint16_t c0      = static_cast<uint16_t>(block[0] | block[1] << 8);
+    const uint16_t c1      = static_cast<uint16_t>(block[2] | block[3] << 8);
+    const uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 | static_cast<uint32_t>(block[7]) << 24;
+
+    int rgb[3];
+    bc1Color(c0, c1, static_cast<int>(indices >> 2 * ((y % 4) * 4 + x % 4) & 3), rgb);
+    return {SRGB8_TO_LINEAR[rgb[0]], SRGB8_TO_LINEAR[rgb[1]], SRGB8_TO_LINEAR[rgb[2]]};
+}
+
+static uint16_t quantize565(const float rgb[3]) {
+    const auto q = [](const float v, const int max) {
+        return static_cast<int>(std::clamp(v / 255 * static_cast<float>(max) + 0.5f, 0.0f, static_cast<float>(max)));
+    };
+    return static_cast<uint16_t>(q(rgb[0], 31) << 11 | q(rgb[1], 63) << 5 | q(rgb[2], 31));
+}
+
+TexelBuffer TexelBuffer::compressBC1(const TexelBuffer &src) {
+    TexelBuffer dst(TexelFormat::BC1, src.width(), src.height());
+    const int blocksX = (src.width() + 3) / 4;
+    const int blocksY = (src.height() + 3) / 4;
+
+    for (int by = 0; by < blocksY; ++by) {
+        for (int bx = 0; bx < blocksX; ++bx) {
+            // Endpoints are fit in sRGB space, where the decoder interpolates
+            float colors[16][3];
+            float mean[3] = {0, 0, 0};
+            for (int i = 0; i < 16; ++i) {
+                // Edge blocks repeat the last row and column
+                const int x  = std::min(bx * 4 + i % 4, src.width() - 1);
+                const int y  = std::min(by * 4 + i / 4, src.height() - 1);
+                const Vec3 c = src.get(x, y);
+                colors[i][0] = linearToSRGB8(c.x);
+                colors[i][1] = linearToSRGB8(c.y);
+                colors[i][2] = linearToSRGB8(c.z);
+                for (int c2 = 0; c2 < 3; ++c2) mean[c2] += colors[i][c2] / 16;
+            }
+
+            // Principal axis of the colors by power iteration on their covariance
+            float cov[6] = {0, 0, 0, 0, 0, 0};
+            for (const auto &color: colors) {
+                const float r = color[0] - mean[0], g = color[1] - mean[1], b = color[2] - mean[2];
+                cov[0] += r * r;
+                cov[1] += r * g;
+                cov[2] += r * b;
+                cov[3] += g * g;
+                cov[4] += g * b;
+                cov[5] += b * b;
+            }
+            float axis[3] = {1, 1, 1};
+            for (int iteration = 0; iteration < 4; ++iteration) {
+                const float r = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+                const float g = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+                const float b = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+                const float m = std::max({std::abs(r), std::abs(g), std::abs(b)});
+                if (m == 0) break;
+                axis[0] = r / m;
+                axis[1] = g / m;
+                axis[2] = b / m;
+            }
+
+            // Endpoints at the extremes of the colors along the axis
+            float minProj = INF, maxProj = -INF;
+            for (const auto &color: colors) {
+                const float p = (color[0] - mean[0]) * axis[0] + (color[1] - mean[1]) * axis[1] + (color[2] - mean[2]) * axis[2];
+                minProj       = std::min(minProj, p);
+                maxProj       = std::max(maxProj, p);
+            }
+            const float axisLenSqr = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+            float e0[3], e1[3];
+            for (int c = 0; c < 3; ++c) {
+                e0[c] = mean[c] + axis[c] * maxProj / axisLenSqr;
+                e1[c] = mean[c] + axis[c] * minProj / axisLenSqr;
+            }
+            uint16_t c0 = quantize565(e0);
+            uint16_t c1 = quantize565(e1);
+            // Four color mode needs c0 > c1, equal endpoints only ever use index 0
+            if (c0 < c1) std::swap(c0, c1);
+
+            int palette[4][3];
+            for (int i = 0; i < 4; ++i) bc1Color(c0, c1, i, palette[i]);
+
+            uint32_t indices = 0;
+            for (int i = 0; i < 16; ++i) {
+                int best        = 0;
+                float bestError = INF;
+                for (int p = 0; p < (c0 > c1 ? 4 : 1); ++p) {
+                    float error = 0;
+                    for (int c = 0; c < 3; ++c) {
+                        const float d = colors[i][c] - static_cast<float>(palette[p][c]);
+                        error += d * d;
+                    }
+                    if (error < bestError) {
+                        bestError = error;
+                        best      = p;
+                    }
+                }
+                indices |= static_cast<uint32_t>(best) << 2 * i;
+            }
+
+            uint8_t *block = dst.data_.data() + (static_cast<size_t>(by) * blocksX + bx) * 8;
+            block[0]       = static_cast<uint8_t>(c0);
+            block[1]       = static_cast<uint8_t>(c0 >> 8);
+            block[2]       = static_cast<uint8_t>(c1);
+            block[3]       = static_cast<uint8_t>(c1 >> 8);
+            for (int i = 0; i < 4; ++i) block[4 + i] = static_cast<uint8_t>(indices >> 8 * i);
+        }
+    }
+    return dst;
+}
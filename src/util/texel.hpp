@@ -0,0 +1,162 @@
+#pragma once
+
+#include "../rt.hpp"
+
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Storage formats of texture texels, all hold RGB and decode to linear floats
+ */
+enum class TexelFormat : uint32_t {
+    // 8 bit sRGB encoded, the precision of PNG and JPG maps
+    SRGB8 = 0,
+    // 16 bit floats, the usual precision of EXR maps
+    HALF = 1,
+    FLOAT = 2,
+    // 4x4 blocks of two sRGB 565 endpoints and 2 bit indices (BC1/DXT1 without alpha), 0.5 bytes per texel
+    BC1 = 3
+};
+
+// Decoded value of each 8 bit sRGB code
+extern const std::array<float, 256> SRGB8_TO_LINEAR;
+
+inline uint8_t linearToSRGB8(const float v) {
+    const float c = v <= 0.0031308f ? 12.92f * v : 1.055f * std::pow(v, 1 / 2.4f) - 0.055f;
+    return static_cast<uint8_t>(jtx::clamp(c * 255 + 0.5f, 0, 255));
+}
+
+// Round to nearest even, see Fabian Giesen's float_to_half_fast3_rtne
+inline uint16_t floatToHalf(const float f) {
+    uint32_t x          = std::bit_cast<uint32_t>(f);
+    const uint32_t sign = x & 0x80000000u;
+    x ^= sign;
+
+    uint32_t h;
+    if (x >= 0x47800000u) {
+        // Too large for a half, or already inf or NaN
+        h = x > 0x7f800000u ? 0x7e00 : 0x7c00;
+    } else if (x < 0x38800000u) {
+        // Denormal half, the float addition does the rounding
+        h = std::bit_cast<uint32_t>(std::bit_cast<float>(x) + 0.5f) - 0x3f000000u;
+    } else {
+        const uint32_t mantissaOdd = (x >> 13) & 1;
+        x += 0xc8000fffu + mantissaOdd;
+        h = x >> 13;
+    }
+    return static_cast<uint16_t>(h | (sign >> 16));
+}
+
+inline float halfToFloat(const uint16_t h) {
+    constexpr uint32_t SHIFTED_EXP = 0x7c00u << 13;
+    uint32_t f                     = (h & 0x7fffu) << 13;
+    const uint32_t exp             = f & SHIFTED_EXP;
+    f += (127 - 15) << 23;
+    if (exp == SHIFTED_EXP) {
+        // inf or NaN
+        f += (128 - 16) << 23;
+    } else if (exp == 0) {
+        // Denormal, renormalized by a float subtraction
+        f += 1 << 23;
+        f = std::bit_cast<uint32_t>(std::bit_cast<float>(f) - std::bit_cast<float>(113u << 23));
+    }
+    return std::bit_cast<float>(f | (h & 0x8000u) << 16);
+}
+
+/**
+ * width x height RGB texels in one TexelFormat, decoded on every read
+ */
+class TexelBuffer {
+public:
+    TexelBuffer() = default;
+
+    // Zero initialized
+    TexelBuffer(TexelFormat format, int width, int height);
+
+    /**
+     * Block compresses src, which can be in any other format
+     */
+    static TexelBuffer compressBC1(const TexelBuffer &src);
+
+    [[nodiscard]] TexelFormat format() const { return format_; }
+    [[nodiscard]] int width() const { return width_; }
+    [[nodiscard]] int height() const { return height_; }
+
+    /**
+     * Copies the texels of src from (x, y) on to the origin of this buffer, as many as fit into both
+     * Both buffers have to be in the same format, for BC1 x and y have to be multiples of 4
+     */
+    void copyFrom(const TexelBuffer &src, int x, int y);
+
+    [[nodiscard]] size_t sizeBytes() const { return data_.size(); }
+    [[nodiscard]] uint8_t *data() { return data_.data(); }
+    [[nodiscard]] const uint8_t *data() const { return data_.data(); }
+
+    /**
+     * x and y have to be within the buffer
+     */
+    [[nodiscard]] Vec3 get(const int x, const int y) const {
+        const size_t i = static_cast<size_t>(y) * width_ + x;
+        switch (format_) {
+            case TexelFormat::SRGB8: {
+                const uint8_t *t = data_.data() + i * 3;
+                return {SRGB8_TO_LINEAR[t[0]], SRGB8_TO_LINEAR[t[1]], SRGB8_TO_LINEAR[t[2]]};
+            }
+            case TexelFormat::HALF: {
+                const auto *t = reinterpret_cast<const uint16_t *>(data_.data()) + i * 3;
+                return {halfToFloat(t[0]), halfToFloat(t[1]), halfToFloat(t[2])};
+            }
+            case TexelFormat::FLOAT: {
+                const auto *t = reinterpret_cast<const float *>(data_.data()) + i * 3;
+                return {t[0], t[1], t[2]};
+            }
+            case TexelFormat::BC1:
+                return getBC1(x, y);
+        }
+        return {};
+    }
+
+    /**
+     * Not supported for BC1, compress a buffer in another format instead
+     */
+    void set(const int x, const int y, const Vec3 &rgb) {
+        const size_t i = static_cast<size_t>(y) * width_ + x;
+        switch (format_) {
+            case TexelFormat::SRGB8: {
+                uint8_t *t = data_.data() + i * 3;
+                t[0]       = linearToSRGB8(rgb.x);
+                t[1]       = linearToSRGB8(rgb.y);
+                t[2]       = linearToSRGB8(rgb.z);
+                break;
+            }
+            case TexelFormat::HALF: {
+                auto *t = reinterpret_cast<uint16_t *>(data_.data()) + i * 3;
+                t[0]    = floatToHalf(rgb.x);
+                t[1]    = floatToHalf(rgb.y);
+                t[2]    = floatToHalf(rgb.z);
+                break;
+            }
+            case TexelFormat::FLOAT: {
+                auto *t = reinterpret_cast<float *>(data_.data()) + i * 3;
+                t[0]    = rgb.x;
+                t[1]    = rgb.y;
+                t[2]    = rgb.z;
+                break;
+            }
+            case TexelFormat::BC1:
+                break;
+        }
+    }
+
+private:
+    TexelFormat format_ = TexelFormat::FLOAT;
+    int width_          = 0;
+    int height_         = 0;
+    // BC1 stores 8 byte blocks row by row, partial blocks at the right and bottom edges are padded
+    std::vector<uint8_t> data_;
+
+    [[nodiscard]] Vec3 getBC1(int x, int y) const;
+};
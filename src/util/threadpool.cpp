@@ -0,0 +1,89 @@
+#include "threadpool.hpp"
+
+#include <algorithm>
+
+// Pool whose worker is running on this thread, null on threads outside any pool
+static thread_local const ThreadPool *currentPool = nullptr;
+
+ThreadPool::ThreadPool(const int numWorkers) {
+    workers_.reserve(numWorkers);
+    for (int i = 0; i < numWorkers; ++i) {
+        workers_.emplace_back([this] { workerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto &worker: workers_) {
+        worker.join();
+    }
+}
+
+ThreadPool &ThreadPool::global() {
+#ifdef ENABLE_MULTI_THREADING
+    // The thread that waits on a group helps out, so leave a hardware thread for it
+    const int hardwareThreads = static_cast<int>(std::thread::hardware_concurrency());
+    const int numWorkers      = hardwareThreads == 0 ? 3 : std::max(hardwareThreads - 1, 1);
+#else
+    // Still one worker, so work can be moved off the UI thread
+    constexpr int numWorkers = 1;
+#endif
+    static ThreadPool pool(numWorkers);
+    return pool;
+}
+
+void ThreadPool::submit(Task task) {
+    {
+        std::lock_guard lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    wake_.notify_one();
+}
+
+int ThreadPool::availableConcurrency() const {
+    return currentPool == this ? concurrency() - 1 : concurrency();
+}
+
+void ThreadPool::workerLoop() {
+    currentPool = this;
+    while (true) {
+        Task task;
+        {
+            std::unique_lock lock(mutex_);
+            wake_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+            // Queued tasks are drained before exiting, a running task may be waiting on them
+            if (tasks_.empty()) return;
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+bool TaskGroup::runQueued(State &state) {
+    ThreadPool::Task task;
+    {
+        std::lock_guard lock(state.mutex);
+        if (state.queued.empty()) return false;
+        task = std::move(state.queued.front());
+        state.queued.pop_front();
+    }
+    task();
+
+    // Wakes wait() once the last task is done
+    std::lock_guard lock(state.mutex);
+    if (--state.pending == 0) state.done.notify_all();
+    return true;
+}
+
+void TaskGroup::wait() {
+    // Help with the group's queued tasks, only block once everything left is already running
+    while (runQueued(*state_)) {}
+
+    std::unique_lock lock(state_->mutex);
+    state_->done.wait(lock, [this] { return state_->pending == 0; });
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Pool of worker threads that lives for the whole process
+ * Idle workers sleep on a condition variable and wake as soon as a task is submitted,
+ * so rendering a frame or building a BVH no longer pays for thread creation
+ */
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(int numWorkers);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &)            = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /**
+     * Pool shared by the camera, the BVH builders and scene loading, created on first use
+     */
+    static ThreadPool &global();
+
+    /**
+     * Number of threads that can run tasks at once, a thread waiting in TaskGroup::wait counts as one
+     */
+    [[nodiscard]] int concurrency() const {
+        return static_cast<int>(workers_.size()) + 1;
+    }
+
+    /**
+     * Threads that can run a group the calling thread waits on
+     * A worker of this pool is already taken by the caller's own task, so it counts one less than concurrency()
+     */
+    [[nodiscard]] int availableConcurrency() const;
+
+    void submit(Task task);
+
+private:
+    std::vector<std::thread> workers_;
+    std::deque<Task> tasks_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+
+    void workerLoop();
+};
+
+/**
+ * Tasks submitted to a pool that are waited on together
+ * wait() runs the group's own queued tasks instead of blocking while there are any, so tasks can wait on their
+ * own groups (e.g. recursive BVH builds) without starving the pool. Tasks of other groups are never run by wait(),
+ * a waiting thread cannot get stuck in unrelated long running work
+ */
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool &pool = ThreadPool::global())
+        : pool_(pool),
+          state_(std::make_shared<State>()) {}
+
+    ~TaskGroup() {
+        wait();
+    }
+
+    TaskGroup(const TaskGroup &)            = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    template<typename F>
+    void run(F &&f) {
+        {
+            std::lock_guard lock(state_->mutex);
+            state_->queued.emplace_back(std::forward<F>(f));
+            state_->pending++;
+        }
+        // The pool only gets a ticket for one of the group's tasks, it finds nothing left if wait() ran it already
+        // The state is shared, so tickets may run after the group is gone
+        pool_.submit([state = state_] { runQueued(*state); });
+    }
+
+    void wait();
+
+private:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable done;
+        std::deque<ThreadPool::Task> queued;
+        // Queued and running tasks
+        int pending = 0;
+    };
+
+    ThreadPool &pool_;
+    std::shared_ptr<State> state_;
+
+    /**
+     * Runs the oldest queued task of the group on the calling thread
+     * @return false if there was nothing to run
+     */
+    static bool runQueued(State &state);
+};
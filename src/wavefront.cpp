@@ -0,0 +1,231 @@
+#include "wavefront.hpp"
+#include "bsdf/bsdf.hpp"
+#include "integrator.hpp"
+#include "packet.hpp"
+
+// Camera and shadow rays are traced in packets, incoherent ones fall back to single rays inside Scene
+static constexpr int WAVEFRONT_PACKET_SIZE = 16;
+
+WavefrontIntegrator::WavefrontIntegrator(const int maxPaths)
+    : maxPaths_(maxPaths) {
+    rayOrigin_.resize(maxPaths);
+    rayDir_.resize(maxPaths);
+    rayTime_.resize(maxPaths);
+    beta_.resize(maxPaths);
+    radiance_.resize(maxPaths);
+    specularBounce_.resize(maxPaths);
+    samplers_.resize(maxPaths);
+    records_.resize(maxPaths);
+    cameraRays_.resize(maxPaths);
+
+    rayQueue_.reserve(maxPaths);
+    nextRayQueue_.reserve(maxPaths);
+    missQueue_.reserve(maxPaths);
+    for (auto &queue: materialQueues_) {
+        queue.reserve(maxPaths);
+    }
+
+    shadowOrigin_.reserve(maxPaths);
+    shadowDir_.reserve(maxPaths);
+    shadowTMax_.reserve(maxPaths);
+    shadowRadiance_.reserve(maxPaths);
+    shadowPath_.reserve(maxPaths);
+}
+
+void WavefrontIntegrator::clear() {
+    numPaths_   = 0;
+    numBounces_ = 0;
+}
+
+int WavefrontIntegrator::addPath(const RayDifferential &ray, const Sampler &sampler) {
+    const int path = numPaths_++;
+
+    rayOrigin_[path]      = ray.origin;
+    rayDir_[path]         = ray.dir;
+    rayTime_[path]        = ray.time;
+    beta_[path]           = {1, 1, 1};
+    radiance_[path]       = {};
+    specularBounce_[path] = true;
+    samplers_[path]       = sampler;
+    cameraRays_[path]     = ray;
+
+    return path;
+}
+
+void WavefrontIntegrator::trace(const Scene &scene, const int maxDepth, const int rrDepth) {
+    rayQueue_.clear();
+    for (int path = 0; path < numPaths_; ++path) {
+        rayQueue_.push_back(path);
+    }
+
+    for (int depth = 0; !rayQueue_.empty(); ++depth) {
+        intersect(scene, depth);
+        handleMisses(scene);
+        shade(scene, depth, maxDepth, rrDepth);
+        traceShadowRays(scene);
+
+        std::swap(rayQueue_, nextRayQueue_);
+        nextRayQueue_.clear();
+    }
+}
+
+void WavefrontIntegrator::intersect(const Scene &scene, const int depth) {
+    missQueue_.clear();
+    for (auto &queue: materialQueues_) {
+        queue.clear();
+    }
+    // Bucketing by material type doubles as the sort, and keeps path order within each bucket
+    const auto enqueue = [&](const int path, const bool hit) {
+        if (hit) {
+            materialQueues_[records_[path].material->type].push_back(path);
+        } else {
+            missQueue_.push_back(path);
+        }
+    };
+
+    const Interval t(0.001, INF);
+    const int numRays = static_cast<int>(rayQueue_.size());
+
+    if (depth == 0) {
+        // Neighbouring camera rays are coherent
+        for (int begin = 0; begin < numRays; begin += WAVEFRONT_PACKET_SIZE) {
+            const int count = std::min(WAVEFRONT_PACKET_SIZE, numRays - begin);
+
+            RayPacket<WAVEFRONT_PACKET_SIZE> packet;
+            for (int lane = 0; lane < count; ++lane) {
+                const int path = rayQueue_[begin + lane];
+                packet.set(lane, Ray(rayOrigin_[path], rayDir_[path], rayTime_[path]), t);
+            }
+
+            Intersection records[WAVEFRONT_PACKET_SIZE];
+            const uint32_t hits = scene.closestHit(packet, records);
+            for (int lane = 0; lane < count; ++lane) {
+                const int path = rayQueue_[begin + lane];
+                const bool hit = hits >> lane & 1;
+                if (hit) {
+                    records_[path] = records[lane];
+                    records_[path].computeDifferentials(cameraRays_[path]);
+                }
+                enqueue(path, hit);
+            }
+        }
+        return;
+    }
+
+    for (const int path: rayQueue_) {
+        const Ray ray(rayOrigin_[path], rayDir_[path], rayTime_[path]);
+        enqueue(path, scene.closestHit(ray, t, records_[path]));
+    }
+}
+
+void WavefrontIntegrator::handleMisses(const Scene &scene) {
+    const Light &background = scene.lights[0];
+    if (background.type != Light::INFINITE) return;
+
+    for (const int path: missQueue_) {
+        if (specularBounce_[path]) {
+            radiance_[path] += beta_[path] * background.evaluate(Ray(rayOrigin_[path], rayDir_[path], rayTime_[path]));
+        }
+    }
+}
+
+void WavefrontIntegrator::shade(const Scene &scene, const int depth, const int maxDepth, const int rrDepth) {
+    shadowOrigin_.clear();
+    shadowDir_.clear();
+    shadowTMax_.clear();
+    shadowRadiance_.clear();
+    shadowPath_.clear();
+
+    for (const auto &queue: materialQueues_) {
+        numBounces_ += queue.size();
+    }
+
+    // One material type at a time, so the BxDF dispatch below always takes the same branch
+    for (const auto &queue: materialQueues_) {
+        for (const int path: queue) {
+            const Intersection &record = records_[path];
+            Sampler &sampler           = samplers_[path];
+
+            // Emission (L_e), light sampling accounts for it otherwise
+            if (specularBounce_[path]) {
+                radiance_[path] += beta_[path] * record.material->emission;
+            }
+
+            // Depth exceeded
+            if (depth == maxDepth) continue;
+
+            // Both w_o and w_i face outwards
+            const BSDF bsdf(scene, record, -rayDir_[path]);
+
+            {// Light sampling, the occlusion test is deferred to traceShadowRays
+                LightSample ls;
+                LightSampleContext ctx;
+                ctx.p  = record.point;
+                ctx.n  = record.normal;
+                ctx.sn = record.normal;
+
+                const float uLight = sampler.get1D();
+                const Vec2f u      = sampler.get2D();
+
+                SampledLight sampledLight;
+                if (scene.lightSampler().sample(ctx, uLight, sampledLight) && sampledLight.light->sample(ctx, ls, u) && ls.pdf > 0) {
+                    const Vec3 f = bsdf.f(ls.wi) * jtx::absdot(ls.wi, ctx.sn);
+                    if (f) {
+                        // Offset ray from origin along normal to avoid self-collisions
+                        const Vec3 sOrigin = record.point + record.normal * RAY_EPSILON;
+                        const Float lDist  = jtx::distance(sOrigin, ls.p);
+                        pushShadowRay(path, sOrigin, ls.wi, lDist - RAY_EPSILON, beta_[path] * f * ls.radiance / (ls.pdf * sampledLight.pmf));
+                    }
+                }
+            }
+
+            // Sample BSDF
+            const float u  = sampler.get1D();
+            const Vec2f u2 = sampler.get2D();
+            BSDFSample s;
+            if (!bsdf.sample(u, u2, s)) continue;
+
+            // Update beta and set next ray
+            beta_[path] *= s.fSample * jtx::absdot(s.w_i, record.normal) / s.pdf;
+            specularBounce_[path] = s.isSpecular;
+
+            rayOrigin_[path] = record.point + s.w_i * RAY_EPSILON;
+            rayDir_[path]    = s.w_i;
+            rayTime_[path]   = record.t;
+
+            // Bounces are counted from one here, like in integrate()
+            if (!russianRoulette(beta_[path], 1.0f, depth + 1, rrDepth, sampler)) continue;
+
+            if (beta_[path]) nextRayQueue_.push_back(path);
+        }
+    }
+}
+
+void WavefrontIntegrator::pushShadowRay(const int path, const Vec3 &origin, const Vec3 &dir, const Float tMax, const Vec3 &radiance) {
+    shadowOrigin_.push_back(origin);
+    shadowDir_.push_back(dir);
+    shadowTMax_.push_back(tMax);
+    shadowRadiance_.push_back(radiance);
+    shadowPath_.push_back(path);
+}
+
+void WavefrontIntegrator::traceShadowRays(const Scene &scene) {
+    const int numRays = static_cast<int>(shadowPath_.size());
+
+    // Shadow rays towards the same light from neighbouring paths are often coherent
+    for (int begin = 0; begin < numRays; begin += WAVEFRONT_PACKET_SIZE) {
+        const int count = std::min(WAVEFRONT_PACKET_SIZE, numRays - begin);
+
+        RayPacket<WAVEFRONT_PACKET_SIZE> packet;
+        for (int lane = 0; lane < count; ++lane) {
+            packet.set(lane, Ray(shadowOrigin_[begin + lane], shadowDir_[begin + lane]), Interval(0.0f, shadowTMax_[begin + lane]));
+        }
+
+        const uint32_t occluded = scene.anyHit(packet);
+        for (int lane = 0; lane < count; ++lane) {
+            if (!(occluded >> lane & 1)) {
+                radiance_[shadowPath_[begin + lane]] += shadowRadiance_[begin + lane];
+            }
+        }
+    }
+}
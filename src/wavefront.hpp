@@ -0,0 +1,86 @@
+#pragma once
+
+#include "rt.hpp"
+#include "sampler.hpp"
+#include "scene.hpp"
+
+#include <vector>
+
+/**
+ * Streaming version of integrate()
+ * Instead of following one path to the end, all paths of a wave advance one stage at a time:
+ * intersect, sort by material, shade, trace shadow rays. Each stage is a tight loop over SoA queues,
+ * so the same code and data stay hot for the whole wave.
+ * Paths draw their sample dimensions in the same order as integrate(), so both produce the same image.
+ */
+class WavefrontIntegrator {
+public:
+    explicit WavefrontIntegrator(int maxPaths);
+
+    void clear();
+
+    /**
+     * Queues a camera ray, sampler is the pixel's sampler after generating the ray
+     * @return path index
+     */
+    int addPath(const RayDifferential &ray, const Sampler &sampler);
+
+    /**
+     * Runs every queued path to completion
+     */
+    void trace(const Scene &scene, int maxDepth, int rrDepth);
+
+    [[nodiscard]] int numPaths() const {
+        return numPaths_;
+    }
+
+    [[nodiscard]] const Vec3 &radiance(const int path) const {
+        return radiance_[path];
+    }
+
+    /**
+     * Surfaces hit by all paths in the last call to trace(), i.e. the sum of their path lengths
+     */
+    [[nodiscard]] uint64_t numBounces() const {
+        return numBounces_;
+    }
+
+private:
+    static constexpr int NUM_MATERIAL_TYPES = 3;
+
+    int maxPaths_;
+    int numPaths_        = 0;
+    uint64_t numBounces_ = 0;
+
+    // Path state, indexed by path
+    std::vector<Vec3> rayOrigin_;
+    std::vector<Vec3> rayDir_;
+    std::vector<Float> rayTime_;
+    std::vector<Vec3> beta_;
+    std::vector<Vec3> radiance_;
+    std::vector<uint8_t> specularBounce_;
+    std::vector<Sampler> samplers_;
+    std::vector<Intersection> records_;
+    // Differentials are only needed for the first hit, so camera rays are kept whole
+    std::vector<RayDifferential> cameraRays_;
+
+    // Queues of path indices
+    std::vector<int> rayQueue_;
+    std::vector<int> nextRayQueue_;
+    std::vector<int> missQueue_;
+    std::vector<int> materialQueues_[NUM_MATERIAL_TYPES];
+
+    // Shadow rays, at most one per path and bounce
+    std::vector<Vec3> shadowOrigin_;
+    std::vector<Vec3> shadowDir_;
+    std::vector<Float> shadowTMax_;
+    std::vector<Vec3> shadowRadiance_;
+    std::vector<int> shadowPath_;
+
+    void intersect(const Scene &scene, int depth);
+    void handleMisses(const Scene &scene);
+    void shade(const Scene &scene, int depth, int maxDepth, int rrDepth);
+    void traceShadowRays(const Scene &scene);
+
+    void pushShadowRay(int path, const Vec3 &origin, const Vec3 &dir, Float tMax, const Vec3 &radiance);
+};